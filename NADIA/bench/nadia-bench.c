@@ -0,0 +1,717 @@
+// Copyright 2011 Nadia Davidson for The ARC Centre of Excellence in
+// Coherent X-ray Science. This program is distributed under the GNU
+// General Public License. We also ask that you cite this software in
+// publications where you made use of it for any part of the data
+// analysis.
+
+/**
+ * @file nadia-bench.c
+ *
+ * \a nadia-bench.exe - Time the reconstruction classes on synthetic
+ * data, so that changes in speed (e.g. after upgrading the library,
+ * fftw or the compiler) can be found.
+ *
+ * For each array size and reconstruction class a synthetic object
+ * is made, its diffraction pattern simulated, and a number of
+ * iterations are timed. For each case the following are reported:
+ * - setup_s: the time to make the object and set the data,
+ * - iteration_ms: the mean time per iteration,
+ * - fft_ms: the time for one forward and one backward fourier
+ *   transform of an array of the size used,
+ * - propagation_ms: the time for one propagation to and from the
+ *   detector with the class,
+ * - propagation_calls_per_iteration: the number of times each
+ *   iteration propagated to the detector. Some algorithms propagate
+ *   more than once, and one call may transform several arrays (e.g.
+ *   all the modes of PartialCDI, or each wavelength of PolyCDI), so
+ *   propagation_share_ms is the better measure of the transforms,
+ * - propagation_share_ms: the time per iteration spent propagating
+ *   to and from the detector,
+ * - other_ms: iteration_ms - propagation_share_ms, i.e. the time
+ *   spent outside the propagations (PartialCharCDI also transforms
+ *   the intensity while fitting the coherence lengths, which is in
+ *   its scale_intensity stage),
+ * - stages_ms: the time per iteration of each stage timed by the
+ *   Profiler (see Profiler.h),
+ * - first_error and last_error: the error after the first and the
+ *   last iteration,
+ * - convergence_per_s: the number of orders of magnitude the error
+ *   dropped by per second of iterating,
+ * - peak_rss_kb: the high-water mark of the resident memory during
+ *   the case (on Linux the mark is reset between cases, elsewhere it
+ *   is the mark for the whole run).
+ *
+ * The iterations are only broken down into stages (the last four
+ * values before the errors) when the library is built with
+ * --enable-profiling. Otherwise they are written as null. Numbers
+ * which aren't finite (e.g. the error of a reconstruction which
+ * diverged) are also written as null.
+ *
+ * The results are written as JSON, with one case per line. A
+ * previous result file can be given with -b, in which case each case
+ * is compared with the same case in that file, and the program
+ * returns 1 if any are slower by more than the tolerance.
+ *
+ * \par Usage: nadia-bench.exe [-s sizes] [-i iterations] [-c classes] [-t threads] [-o file] [-b baseline file] [-r tolerance]
+ * \par
+ * - sizes: comma separated array sizes (default 256,512,1024)
+ * - iterations: iterations timed per case (default 5)
+ * - classes: comma separated list from planar, fresnel, fresnel_wf,
+ *   partial, partchar, poly and phasediverse (default all)
+ * - threads: the number of threads (see Parallel.h)
+ * - file: the output file (default: standard output)
+ * - baseline file: a previous output to compare with
+ * - tolerance: the fractional slow-down counted as a regression
+ *   (default 0.1)
+ *
+ * \par Example:
+ * \verbatim nadia-bench.exe -s 256,1024,4096 -c planar,fresnel -o new.json -b old.json \endverbatim
+ *
+ **/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <Complex_2D.h>
+#include <Double_2D.h>
+#include <PlanarCDI.h>
+#include <FresnelCDI.h>
+#include <FresnelCDI_WF.h>
+#include <PartialCDI.h>
+#include <PartialCharCDI.h>
+#include <PolyCDI.h>
+#include <PhaseDiverseCDI.h>
+#include <Parallel.h>
+#include <Profiler.h>
+#include <utils.h>
+
+using namespace std;
+
+/** the results for one class and size */
+struct Result{
+  string name;
+  int size;
+  int iterations;
+  double setup_s;
+  double iteration_ms;
+  double fft_ms;
+  double propagation_ms;
+  double first_error;
+  double last_error;
+  long peak_rss_kb;
+
+  /** whether the stages below were timed (see Profiler) */
+  bool profiled;
+  /** the time per iteration in ms, and the calls per iteration, of
+      each Profiler stage */
+  double stage_ms[Profiler::N_STAGES];
+  double stage_calls[Profiler::N_STAGES];
+};
+
+static double now(){
+  struct timeval t;
+  gettimeofday(&t, 0);
+  return t.tv_sec + 1e-6*t.tv_usec;
+}
+
+/** reset the memory high-water mark (Linux only) */
+static void reset_peak_memory(){
+  ofstream clear_refs("/proc/self/clear_refs");
+  if(clear_refs.good())
+    clear_refs << "5" << flush;
+}
+
+/** the memory high-water mark in kB */
+static long get_peak_memory(){
+  ifstream status("/proc/self/status");
+  string line;
+  while(getline(status, line)){
+    if(line.compare(0, 6, "VmHWM:")==0)
+      return atol(line.c_str()+6);
+  }
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+/** split "a,b,c" into its parts */
+static vector<string> split(const string & list){
+  vector<string> parts;
+  stringstream stream(list);
+  string part;
+  while(getline(stream, part, ','))
+    if(part!="")
+      parts.push_back(part);
+  return parts;
+}
+
+/** a sample with a varying amplitude and phase inside a disc, and a
+    support a little larger than the disc */
+static void make_object(Complex_2D & object, Double_2D & support){
+  int n = object.get_size_x();
+  for(int i=0; i<n; i++){
+    for(int j=0; j<n; j++){
+      double r = hypot(i-n/2.0, j-n/2.0);
+      double mag = r < n/8.0 ? 1.0+0.5*cos(i*0.3)*sin(j*0.2) : 0;
+      double phase = 0.01*i*j/n;
+      object.set_real(i, j, mag*cos(phase));
+      object.set_imag(i, j, mag*sin(phase));
+      support.set(i, j, r < n/7.0 ? 1 : 0);
+    }
+  }
+}
+
+/** a curved illumination which is bright inside a disc */
+static void make_white_field(Complex_2D & wf){
+  int n = wf.get_size_x();
+  for(int i=0; i<n; i++){
+    for(int j=0; j<n; j++){
+      double r = hypot(i-n/2.0, j-n/2.0);
+      double mag = r < n/3.0 ? 1.0 : 0.05;
+      wf.set_real(i, j, mag*cos(r*r*0.002));
+      wf.set_imag(i, j, mag*sin(r*r*0.002));
+    }
+  }
+}
+
+/** the time in ms for a forward and backward fft of an nxn array */
+static double time_fft(int n){
+  Complex_2D c(n, n);
+  for(int i=0; i<n; i++)
+    for(int j=0; j<n; j++)
+      c.set_real(i, j, rand()/(double) RAND_MAX);
+
+  //the first transforms include making the plans
+  c.perform_forward_fft();
+  c.perform_backward_fft();
+
+  int repeats = 0;
+  double start = now();
+  do{
+    c.perform_forward_fft();
+    c.perform_backward_fft();
+    repeats++;
+  } while(now()-start < 0.2 && repeats < 100);
+
+  return 1000*(now()-start)/repeats;
+}
+
+/** add the stages timed by a reconstruction's profiler to a result */
+static void add_profile(const Profiler & profile, Result & result){
+  if(!Profiler::is_enabled())
+    return;
+  result.profiled = true;
+  for(int stage=0; stage < Profiler::N_STAGES; stage++){
+    result.stage_ms[stage] += 1000*profile.get_time(stage)/result.iterations;
+    result.stage_calls[stage] += profile.get_calls(stage)/(double) result.iterations;
+  }
+}
+
+/** time the iterations and the propagation of a reconstruction */
+static void time_reconstruction(BaseCDI & proj, Result & result){
+
+  int n = result.size;
+
+  //the first propagation includes making the plans
+  Complex_2D probe(n, n);
+  make_white_field(probe);
+  proj.propagate_to_detector(probe);
+  proj.propagate_from_detector(probe);
+  double start = now();
+  proj.propagate_to_detector(probe);
+  proj.propagate_from_detector(probe);
+  result.propagation_ms = 1000*(now()-start);
+
+  proj.set_algorithm(HIO);
+
+  //the first iteration isn't timed, as it may make plans and
+  //temporary arrays.
+  proj.iterate();
+  result.first_error = proj.get_error();
+
+  proj.reset_profile();
+  start = now();
+  for(int i=0; i < result.iterations; i++)
+    proj.iterate();
+  result.iteration_ms = 1000*(now()-start)/result.iterations;
+  result.last_error = proj.get_error();
+  add_profile(proj.get_profile(), result);
+}
+
+static void bench_planar(Result & result){
+  int n = result.size;
+  Complex_2D object(n, n);
+  Double_2D support(n, n);
+  make_object(object, support);
+
+  Complex_2D estimate(n, n);
+  PlanarCDI proj(estimate);
+  proj.propagate_to_detector(object);
+  Double_2D intensity(n, n);
+  object.get_2d(MAG_SQ, intensity);
+
+  proj.set_support(support);
+  proj.set_intensity(intensity);
+  proj.initialise_estimate(0);
+  result.setup_s = now();
+
+  time_reconstruction(proj, result);
+}
+
+static void bench_fresnel(Result & result){
+  int n = result.size;
+  double wavelength = 4.892e-10;
+  double fd = 0.9078777;
+  double fs = 2.16e-3;
+  double ps = 13.5e-6*1024/n;
+
+  Complex_2D wf(n, n);
+  make_white_field(wf);
+  Complex_2D object(n, n);
+  Double_2D support(n, n);
+  make_object(object, support);
+
+  Complex_2D estimate(n, n);
+  FresnelCDI proj(estimate, wf, wavelength, fd, fs, ps, 1.0);
+
+  //the sample is a weak phase object
+  for(int i=0; i<n; i++){
+    for(int j=0; j<n; j++){
+      double phase = 0.3*object.get_mag(i, j);
+      object.set_real(i, j, cos(phase));
+      object.set_imag(i, j, sin(phase));
+      support.set(i, j, hypot(i-n/2.0, j-n/2.0) < n/3.0 ? 1 : 0);
+    }
+  }
+  Complex_2D esw(n, n);
+  proj.set_transmission_function(object, &esw);
+  proj.propagate_to_detector(esw);
+  Double_2D intensity(n, n);
+  esw.get_2d(MAG_SQ, intensity);
+
+  proj.set_support(support);
+  proj.set_intensity(intensity);
+  proj.initialise_estimate(0);
+  result.setup_s = now();
+
+  time_reconstruction(proj, result);
+}
+
+static void bench_fresnel_wf(Result & result){
+  int n = result.size;
+  double ps = 13.5e-6*1024/n;
+
+  //the detector sees a bright disc
+  Double_2D intensity(n, n);
+  for(int i=0; i<n; i++)
+    for(int j=0; j<n; j++)
+      intensity.set(i, j, hypot(i-n/2.0, j-n/2.0) < n/3.0 ? 1 : 0.01);
+
+  Complex_2D estimate(n, n);
+  FresnelCDI_WF proj(estimate, 4.892e-10, 16.353e-3,
+		     0.909513 - 16.353e-3, ps);
+  proj.set_support(163e-6);
+  proj.set_intensity(intensity);
+  proj.initialise_estimate(0);
+  result.setup_s = now();
+
+  time_reconstruction(proj, result);
+}
+
+static void bench_partial(Result & result){
+  int n = result.size;
+  Complex_2D object(n, n);
+  Double_2D support(n, n);
+  make_object(object, support);
+
+  Complex_2D estimate(n, n);
+  PartialCDI proj(estimate, 13.3e-6, 40.0e-3, 13.5e-6, 13.5e-6,
+		  1400, 1.4, 12, 3);
+  proj.set_threshold(1e-6);
+  proj.set_transmission(object);
+  Double_2D intensity = proj.propagate_modes_to_detector();
+
+  proj.set_support(support);
+  proj.set_intensity(intensity);
+  proj.initialise_estimate(0);
+  result.setup_s = now();
+
+  time_reconstruction(proj, result);
+}
+
+static void bench_partchar(Result & result){
+  int n = result.size;
+  Complex_2D object(n, n);
+  Double_2D support(n, n);
+  make_object(object, support);
+
+  Complex_2D estimate(n, n);
+  PartialCharCDI proj(estimate);
+  proj.propagate_to_detector(object);
+  Double_2D intensity(n, n);
+  object.get_2d(MAG_SQ, intensity);
+
+  //partial coherence blurs the diffraction pattern
+  Double_2D blurred = gaussian_convolution(intensity, 1.2, 0.8);
+
+  proj.set_support(support);
+  proj.set_intensity(blurred);
+  proj.initialise_estimate(0);
+  result.setup_s = now();
+
+  time_reconstruction(proj, result);
+}
+
+static void bench_poly(Result & result){
+  int n = result.size;
+  Complex_2D object(n, n);
+  Double_2D support(n, n);
+  make_object(object, support);
+
+  //a gaussian spectrum. The wavelength is 1/energy, as for
+  //spectrum files (see read_spec).
+  const int n_lambda = 11;
+  Double_2D spectrum(n_lambda, 2);
+  for(int i=0; i<n_lambda; i++){
+    double energy = 1400 + 20*(i - n_lambda/2);
+    spectrum.set(i, WL, 1.0/energy);
+    spectrum.set(i, WEIGHT, exp(-pow((energy-1400)/50.0, 2)));
+  }
+
+  Complex_2D estimate(n, n);
+  PolyCDI proj(estimate, 0.9, 1, 0);
+  proj.set_spectrum(spectrum);
+  estimate = object;
+  proj.propagate_to_detector(object);
+  proj.expand_wl(object);
+  Double_2D intensity = proj.get_intensity();
+  for(int i=0; i<n; i++)
+    for(int j=0; j<n; j++)
+      intensity.set(i, j, intensity.get(i, j)*intensity.get(i, j));
+
+  proj.set_support(support);
+  proj.set_intensity(intensity);
+  proj.initialise_estimate(0);
+  result.setup_s = now();
+
+  time_reconstruction(proj, result);
+}
+
+static void bench_phasediverse(Result & result){
+  int n = result.size;
+  const int frames = 3;
+  double wavelength = 4.892e-10;
+  double fd = 0.9078777;
+  double fs = 2.16e-3;
+  double ps = 13.5e-6*1024/n;
+
+  Complex_2D wf(n, n);
+  make_white_field(wf);
+
+  //the same data is used for each frame, as only the time is of
+  //interest.
+  Double_2D intensity(n, n);
+  Double_2D support(n, n);
+  for(int i=0; i<n; i++){
+    for(int j=0; j<n; j++){
+      intensity.set(i, j, pow(wf.get_mag(i, j), 2));
+      support.set(i, j, hypot(i-n/2.0, j-n/2.0) < n/3.0 ? 1 : 0);
+    }
+  }
+
+  PhaseDiverseCDI pd;
+  vector<Complex_2D *> estimates;
+  vector<FresnelCDI *> projs;
+  for(int k=0; k < frames; k++){
+    estimates.push_back(new Complex_2D(n, n));
+    projs.push_back(new FresnelCDI(*estimates[k], wf, wavelength, fd, fs,
+				   ps, 1.0));
+    projs[k]->set_support(support);
+    projs[k]->set_intensity(intensity);
+    projs[k]->initialise_estimate(k);
+    pd.add_new_position(projs[k], 3.0*k, 2.0*k);
+  }
+  pd.initialise_estimate();
+  result.setup_s = now();
+
+  //the propagation is that of one frame
+  Complex_2D probe(n, n);
+  make_white_field(probe);
+  projs[0]->propagate_to_detector(probe);
+  projs[0]->propagate_from_detector(probe);
+  double start = now();
+  projs[0]->propagate_to_detector(probe);
+  projs[0]->propagate_from_detector(probe);
+  result.propagation_ms = 1000*(now()-start);
+
+  pd.iterate();
+  result.first_error = projs[0]->get_error();
+  for(int k=0; k < frames; k++)
+    projs[k]->reset_profile();
+  start = now();
+  for(int i=0; i < result.iterations; i++)
+    pd.iterate();
+  result.iteration_ms = 1000*(now()-start)/result.iterations;
+  result.last_error = projs[0]->get_error();
+
+  //the frames' stages add up to those of the whole iteration
+  for(int k=0; k < frames; k++)
+    add_profile(projs[k]->get_profile(), result);
+
+  for(int k=0; k < frames; k++){
+    delete projs[k];
+    delete estimates[k];
+  }
+}
+
+/** write a number as JSON, which has no nan or inf */
+static string json_number(double value){
+  //nan and inf have all the exponent bits set. The bits are tested
+  //(as in IterationScheduler) because -ffast-math lets the compiler
+  //assume that floating point tests never see them.
+  unsigned long long bits;
+  memcpy(&bits, &value, sizeof(bits));
+  if(((bits >> 52) & 0x7ff) == 0x7ff)
+    return "null";
+  ostringstream s;
+  s << value;
+  return s.str();
+}
+
+/** write one result as a line of JSON */
+static string to_json(const Result & r){
+
+  double seconds = r.iteration_ms*r.iterations/1000.0;
+  double convergence = 0;
+  if(seconds > 0 && r.first_error > 0 && r.last_error > 0)
+    convergence = log10(r.first_error/r.last_error)/seconds;
+
+  //the breakdown of the iterations needs the profiler
+  string propagations = "null";
+  string propagation_share = "null";
+  string other = "null";
+  string stages = "null";
+  if(r.profiled){
+    double share = r.stage_ms[Profiler::PROPAGATE_TO_DETECTOR]
+      + r.stage_ms[Profiler::PROPAGATE_FROM_DETECTOR];
+    propagations = json_number(r.stage_calls[Profiler::PROPAGATE_TO_DETECTOR]);
+    propagation_share = json_number(share);
+    other = json_number(r.iteration_ms - share);
+
+    ostringstream st;
+    st << "{";
+    for(int stage=0; stage < Profiler::N_STAGES; stage++)
+      st << (stage ? ", " : "") << "\"" << Profiler::get_name(stage)
+	 << "\": " << json_number(r.stage_ms[stage]);
+    st << "}";
+    stages = st.str();
+  }
+
+  ostringstream s;
+  s << "{\"class\": \"" << r.name << "\", "
+    << "\"size\": " << r.size << ", "
+    << "\"iterations\": " << r.iterations << ", "
+    << "\"setup_s\": " << json_number(r.setup_s) << ", "
+    << "\"iteration_ms\": " << json_number(r.iteration_ms) << ", "
+    << "\"fft_ms\": " << json_number(r.fft_ms) << ", "
+    << "\"propagation_ms\": " << json_number(r.propagation_ms) << ", "
+    << "\"propagation_calls_per_iteration\": " << propagations << ", "
+    << "\"propagation_share_ms\": " << propagation_share << ", "
+    << "\"other_ms\": " << other << ", "
+    << "\"stages_ms\": " << stages << ", "
+    << "\"first_error\": " << json_number(r.first_error) << ", "
+    << "\"last_error\": " << json_number(r.last_error) << ", "
+    << "\"convergence_per_s\": " << json_number(convergence) << ", "
+    << "\"peak_rss_kb\": " << r.peak_rss_kb << "}";
+  return s.str();
+}
+
+/** get a number from a line written by to_json() */
+static double json_value(const string & line, const string & key){
+  size_t pos = line.find("\"" + key + "\": ");
+  if(pos==string::npos)
+    return -1;
+  return atof(line.c_str() + pos + key.size() + 4);
+}
+
+/** get a string from a line written by to_json() */
+static string json_string(const string & line, const string & key){
+  size_t pos = line.find("\"" + key + "\": \"");
+  if(pos==string::npos)
+    return "";
+  pos += key.size() + 5;
+  return line.substr(pos, line.find("\"", pos) - pos);
+}
+
+/** read the iteration times from an earlier run, by class and size */
+static map<string,double> read_baseline(const string & file_name){
+  map<string,double> times;
+  ifstream file(file_name.c_str());
+  if(!file.good()){
+    cout << "Could not open the file " << file_name << endl;
+    exit(1);
+  }
+  string line;
+  while(getline(file, line)){
+    string name = json_string(line, "class");
+    if(name=="")
+      continue;
+    ostringstream key;
+    key << name << "_" << (int) json_value(line, "size");
+    times[key.str()] = json_value(line, "iteration_ms");
+  }
+  return times;
+}
+
+void print_usage(){
+  cout << "Usage: nadia-bench.exe [-s sizes] [-i iterations] "
+       << "[-c classes] [-t threads] [-o file] [-b baseline file] "
+       << "[-r tolerance]" << endl
+       << "where sizes and classes are comma separated lists. The "
+       << "classes are: planar, fresnel, fresnel_wf, partial, "
+       << "partchar, poly and phasediverse" << endl;
+}
+
+int main(int argc, char * argv[]){
+
+  string sizes = "256,512,1024";
+  string classes = "planar,fresnel,fresnel_wf,partial,partchar,poly,phasediverse";
+  int iterations = 5;
+  string output_file = "";
+  string baseline_file = "";
+  double tolerance = 0.1;
+
+  for(int i=1; i < argc; i++){
+    if(i+1 >= argc || argv[i][0]!='-' || strlen(argv[i])!=2){
+      print_usage();
+      return 1;
+    }
+    switch(argv[i][1]){
+    case 's': sizes = argv[++i]; break;
+    case 'i': iterations = atoi(argv[++i]); break;
+    case 'c': classes = argv[++i]; break;
+    case 't': nadia::set_num_threads(atoi(argv[++i])); break;
+    case 'o': output_file = argv[++i]; break;
+    case 'b': baseline_file = argv[++i]; break;
+    case 'r': tolerance = atof(argv[++i]); break;
+    default:
+      print_usage();
+      return 1;
+    }
+  }
+  if(iterations < 1)
+    iterations = 1;
+
+  map<string,double> baseline;
+  if(baseline_file!="")
+    baseline = read_baseline(baseline_file);
+
+  vector<string> size_list = split(sizes);
+  vector<string> class_list = split(classes);
+
+  ostringstream json;
+  json << "{\"nadia_bench\": 1, "
+       << "\"threads\": " << nadia::get_num_threads() << ", "
+#ifdef DOUBLE_PRECISION
+       << "\"precision\": \"double\", "
+#else
+       << "\"precision\": \"float\", "
+#endif
+       << "\"results\": [" << endl;
+
+  int regressions = 0;
+  bool first = true;
+
+  //some classes print their progress to standard output, so send it
+  //to standard error until the results are written.
+  streambuf * cout_buffer = cout.rdbuf(cerr.rdbuf());
+
+  for(unsigned int s=0; s < size_list.size(); s++){
+    for(unsigned int c=0; c < class_list.size(); c++){
+
+      Result result;
+      result.name = class_list[c];
+      result.size = atoi(size_list[s].c_str());
+      result.iterations = iterations;
+      result.propagation_ms = 0;
+      result.profiled = false;
+      for(int stage=0; stage < Profiler::N_STAGES; stage++){
+	result.stage_ms[stage] = 0;
+	result.stage_calls[stage] = 0;
+      }
+
+      cerr << "Timing " << result.name << " at " << result.size
+	   << "x" << result.size << "..." << endl;
+
+      reset_peak_memory();
+      result.fft_ms = time_fft(result.size);
+
+      double start = now();
+      if(result.name=="planar")
+	bench_planar(result);
+      else if(result.name=="fresnel")
+	bench_fresnel(result);
+      else if(result.name=="fresnel_wf")
+	bench_fresnel_wf(result);
+      else if(result.name=="partial")
+	bench_partial(result);
+      else if(result.name=="partchar")
+	bench_partchar(result);
+      else if(result.name=="poly")
+	bench_poly(result);
+      else if(result.name=="phasediverse")
+	bench_phasediverse(result);
+      else{
+	cout.rdbuf(cout_buffer);
+	cout << "Unknown class " << result.name << endl;
+	print_usage();
+	return 1;
+      }
+      //the bench functions leave the time the setup finished
+      result.setup_s -= start;
+      result.peak_rss_kb = get_peak_memory();
+
+      json << (first ? "" : ",\n") << "  " << to_json(result);
+      first = false;
+
+      ostringstream key;
+      key << result.name << "_" << result.size;
+      if(baseline.count(key.str()) && baseline[key.str()] > 0){
+	double change = result.iteration_ms/baseline[key.str()] - 1;
+	if(change > tolerance){
+	  cerr << "REGRESSION: " << result.name << " at " << result.size
+	       << " is " << (int)(100*change) << "% slower ("
+	       << result.iteration_ms << " ms per iteration, was "
+	       << baseline[key.str()] << " ms)" << endl;
+	  regressions++;
+	}
+      }
+    }
+  }
+
+  json << endl << "]}" << endl;
+  cout.rdbuf(cout_buffer);
+
+  if(output_file==""){
+    cout << json.str();
+  }
+  else{
+    ofstream file(output_file.c_str());
+    file << json.str();
+    if(!file.good()){
+      cout << "Could not write the file " << output_file << endl;
+      return 1;
+    }
+  }
+
+  return regressions > 0 ? 1 : 0;
+}
@@ -58,10 +58,12 @@
 #define PHASERETRIEVALBASE_H
 
 #include <map>
+#include <vector>
 #include <string>
 #include "Double_2D.h"
 #include <Complex_2D.h>
 #include "types.h"
+#include <Profiler.h>
 
 /** The number of reconstruction algorithms */
 #define NALGORITHMS 9 
@@ -103,7 +105,10 @@ class BaseCDI{
   //  FourierT fft; 
 
    /** temporary Complex_2Ds which are used in the computation of the
-      PFS and PF terms for each iteration. */
+      PFS and PF terms for each iteration. temp_complex_PF is also
+      used for the PSF term. temp_complex_PS and temp_complex_PSF are
+      only needed when the support constraint is not a simple mask
+      (see support_is_mask()). */
   Complex_2D * temp_complex_PFS;
   Complex_2D * temp_complex_PF;
   Complex_2D * temp_complex_PS;
@@ -121,6 +126,16 @@ class BaseCDI{
   /** A mask of the beam-stop which is used when scaling the intensity */
   Double_2D * beam_stop;
 
+  /** copies of intensity_sqrt and beam_stop with the quadrants
+      swapped, i.e. in the order the detector plane is left in by an
+      fft. These are only made if scale_intensity_fft_order() is
+      used. */
+  Double_2D * intensity_sqrt_fft_order;
+  Double_2D * beam_stop_fft_order;
+
+  /** false if the fft ordered copies need to be remade */
+  bool fft_order_valid;
+
   /** the algorithm which is being used: ER, HIO etc. */
   int algorithm;
 
@@ -128,6 +143,11 @@ class BaseCDI{
      coefficients for each term in the iteration equation.*/
   double algorithm_structure[NTERMS];
 
+  /** the coefficients of algorithm_structure, in the order they are
+      given to Complex_2D::combine(): I, Pf, PfPs, Ps, PsPf. These
+      are worked out when the algorithm is set. */
+  double combine_coefficients[NTERMS];
+
   /** the difference between the intensity in the detector plane 
       the current estimated intensity. */
   double current_error;
@@ -150,6 +170,10 @@ class BaseCDI{
       number */
   static std::map<std::string,int> * algNameMap;
 
+  /** the time spent in each stage of the iterations (only filled
+      when the library is built with --enable-profiling) */
+  Profiler profile;
+
 
  public:
   
@@ -418,6 +442,17 @@ class BaseCDI{
    */ 
   virtual void apply_support(Complex_2D & c);
 
+  /**
+   * Whether apply_support() is the same as multiplying by the
+   * support. If so, iterate() can apply the support while combining
+   * the terms of the algorithm, instead of making extra copies of
+   * the estimate. Classes which override apply_support() with
+   * something else should override this to return false.
+   *
+   * @return true if no transmission constraint is in use.
+   */
+  virtual bool support_is_mask();
+
   /**
    * Apply the intensity constraint. The ESW is projected to the
    * detector plane, the intensity is scaled to match the measured
@@ -436,6 +471,20 @@ class BaseCDI{
    */  
   virtual void scale_intensity(Complex_2D & c);
 
+  /**
+   * The same as scale_intensity(), but for a field which has been
+   * transformed with Complex_2D::perform_forward_fft() alone, i.e. it
+   * has not been centred (invert()) or scaled. Both are taken care of
+   * here: the measured intensity is read in fft order and the
+   * result is scaled so that Complex_2D::perform_backward_fft() takes
+   * it straight back to the sample plane. This allows the modulus
+   * projection to be done with a single pass over the array between
+   * the two transforms.
+   *
+   * @param c The complex field in unshifted fft order.
+   */
+  void scale_intensity_fft_order(Complex_2D & c);
+
 
   /**
    * Propagate to the sample plane using a fast fourier transform.
@@ -458,9 +507,71 @@ class BaseCDI{
    * each. By default we use FFTW_MEASURE. FFTW_ESTIMATE is used for
    * testing purposes.
    *
+   * Plans can be saved between runs by also giving a wisdom file (see
+   * FFTWPlanCache::set_wisdom_file). Wisdom from an earlier run, or
+   * from the nadia-plan-warmup tool, is loaded straight away.
+   *
    * @param type - FFTW_ESTIMATE, FFTW_MEASURE or FFTW_PATIENT
+   * @param wisdom_file - A file to load and save fftw wisdom. By
+   * default the wisdom file is not changed.
+   */
+  void set_fftw_type(int type, const std::string & wisdom_file="");
+
+  /**
+   * Set the number of threads this reconstruction uses, in place of
+   * the library setting (see Parallel.h). This is useful when
+   * several reconstructions are run at the same time, e.g. the
+   * frames of a PhaseDiverseCDI reconstruction, so that each one
+   * uses only its share of the processors.
+   *
+   * @param n The number of threads, or 0 to use the library setting.
+   */
+  void set_num_threads(int n);
+
+  /**
+   * Get the number of threads this reconstruction uses.
+   *
+   * @return The number of threads.
+   */
+  int get_num_threads() const;
+
+  /**
+   * Get the number of calls to, and the time spent in, each stage
+   * of the iterations so far (see Profiler.h). The counters are only
+   * filled when the library is built with --enable-profiling.
+   *
+   * @return The counters
+   */
+  const Profiler & get_profile() const{
+    return profile;
+  }
+
+  /**
+   * Set the counters returned by get_profile() back to zero.
+   */
+  void reset_profile(){
+    profile.reset();
+  }
+
+  /**
+   * Get the arrays which hold the state of the reconstruction from
+   * one iteration to the next (the estimate, support, intensity and
+   * best estimates), e.g. to move them into a FrameStore. Arrays
+   * which haven't been made yet are not included.
+   *
+   * @param complex_arrays The complex arrays are added to this
+   * @param real_arrays The real arrays are added to this
+   */
+  virtual void get_state_arrays(std::vector<Complex_2D*> & complex_arrays,
+				std::vector<Double_2D*> & real_arrays);
+
+  /**
+   * Free the temporary arrays used during an iteration. They are
+   * made again by the next call to iterate(). This saves memory when
+   * many reconstructions are iterated in turn (as in
+   * PhaseDiverseCDI with frame streaming).
    */
-  void set_fftw_type(int type);
+  virtual void release_workspace();
 
 
 
@@ -517,9 +628,19 @@ class BaseCDI{
   
   void support_constraint(Complex_2D & c);
 
+  /** apply "mask" (in place of the support) as support_constraint()
+      would */
+  void support_constraint(Complex_2D & c, const Double_2D & mask);
+
   void reallocate_temp_complex_memory();
 
+  void update_fft_order_arrays();
+
   void update_n_best();
+
+  /** store "estimate" among the best estimates if "error" is lower
+      than one of theirs */
+  void update_n_best(const Complex_2D & estimate, double error);
     
 };
 
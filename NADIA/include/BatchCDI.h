@@ -0,0 +1,190 @@
+// Copyright 2011 Nadia Davidson for The ARC Centre of Excellence in
+// Coherent X-ray Science. This program is distributed under the GNU
+// General Public License. We also ask that you cite this software in
+// publications where you made use of it for any part of the data
+// analysis.
+
+/**
+ * @file BatchCDI.h
+ * @class BatchCDI
+ *
+ * @brief Planar CDI reconstruction of many random starts at once.
+ *
+ * Planar reconstructions are usually repeated from many random first
+ * guesses (seeds), and the best results are kept or averaged. Run
+ * as separate PlanarCDI reconstructions, each one needs its own copy
+ * of the intensity, the support and the beam-stop. A BatchCDI
+ * instead holds one copy of these, which is shared by "n_seeds"
+ * estimates. The estimates are stored one after the other in a
+ * single block of memory, so each fourier transform is done for all
+ * of them at once with a batched fftw plan (see
+ * FFTWPlanCache::get_many_plan). The other steps of each iteration
+ * (the support and modulus constraints and combining the terms of
+ * the algorithm) are shared between threads one estimate at a time.
+ *
+ * A BatchCDI is used in the same way as a PlanarCDI. For example:
+ * <br><kbd>BatchCDI batch(esw, 50, 5);</kbd>
+ * <br><kbd>batch.set_support(support);</kbd>
+ * <br><kbd>batch.set_intensity(data);</kbd>
+ * <br><kbd>batch.initialise_estimate(seed);</kbd>
+ * <br><kbd>for(...) batch.iterate();</kbd>
+ * <br>after which the result from each seed is given by
+ * get_estimate() and get_seed_error(), and the n_best best
+ * estimates from all seeds by BaseCDI::get_best_result().
+ *
+ * get_error() gives the lowest error of all the seeds. The
+ * Complex_2D passed to the constructor is only used for its size
+ * and its fftw and thread settings; copy_best_estimate() can be used
+ * to fill it with the seed which currently has the lowest error.
+ *
+ * Shrinkwrap gives each seed its own support, made from its own
+ * estimate. Transmission constraints are not supported.
+ */
+
+#ifndef BATCHCDI_H
+#define BATCHCDI_H
+
+#include <vector>
+#include "PlanarCDI.h"
+
+class BatchCDI : public PlanarCDI{
+
+ protected:
+
+  /** the number of estimates */
+  int n_seeds;
+
+  /** the estimates, one after the other, and a Complex_2D for each
+      one */
+  FFTW_COMPLEX * estimate_memory;
+  std::vector<Complex_2D *> estimates;
+
+  /** the PF and PFS terms for each estimate (see BaseCDI). These are
+      only made if the algorithm needs them. */
+  FFTW_COMPLEX * pf_memory;
+  std::vector<Complex_2D *> temp_pf;
+  FFTW_COMPLEX * pfs_memory;
+  std::vector<Complex_2D *> temp_pfs;
+
+  /** the support of each seed after shrinkwrap, or 0 if it uses the
+      shared support */
+  std::vector<Double_2D *> seed_support;
+
+  /** the error of each estimate */
+  std::vector<double> seed_error;
+
+ public:
+
+  /**
+   * Constructor.
+   *
+   * @param complex An array of the size of the estimates. The fftw
+   * and thread settings (see BaseCDI::set_fftw_type() and
+   * BaseCDI::set_num_threads()) are taken from it.
+   * @param n_seeds The number of estimates to reconstruct
+   * @param n_best The number of best estimates to keep, from all the
+   * seeds.
+   */
+  BatchCDI(Complex_2D & complex, int n_seeds, unsigned int n_best=0);
+
+  /**
+   * Destructor
+   */
+  virtual ~BatchCDI();
+
+  /**
+   * Iterate every estimate once with the current algorithm.
+   */
+  virtual int iterate();
+
+  /**
+   * Set each estimate to random numbers inside the support, as
+   * PlanarCDI does. Estimate i is made with the seed "seed+i".
+   *
+   * @param seed The seed used for the first estimate
+   */
+  virtual void initialise_estimate(int seed=0);
+
+  /**
+   * Apply the shrinkwrap algorithm to each estimate separately. See
+   * BaseCDI::apply_shrinkwrap(). From then on each seed has its own
+   * support.
+   */
+  virtual void apply_shrinkwrap(double gauss_width=1.5,
+				double threshold=0.1);
+
+  /**
+   * Transmission constraints can't be used with a BatchCDI. This
+   * exits with an error message.
+   */
+  virtual void set_complex_constraint(TransmissionConstraint & trans_constraint);
+
+  /**
+   * @return The number of estimates
+   */
+  int get_n_seeds() const{
+    return n_seeds;
+  };
+
+  /**
+   * Get one of the estimates.
+   *
+   * @param seed The estimate number, from 0 to get_n_seeds()-1.
+   * @return The estimate. It can be changed, but not resized.
+   */
+  Complex_2D & get_estimate(int seed);
+
+  /**
+   * Get the error of one estimate from the last iteration (see
+   * BaseCDI::get_error()).
+   *
+   * @param seed The estimate number
+   * @return The error metric
+   */
+  double get_seed_error(int seed) const;
+
+  /**
+   * Get the support used by one estimate.
+   *
+   * @param seed The estimate number
+   * @return The support
+   */
+  const Double_2D & get_seed_support(int seed) const;
+
+  /**
+   * @return The number of the estimate with the lowest error.
+   */
+  int get_best_seed() const;
+
+  /**
+   * Copy the estimate with the lowest error into the Complex_2D
+   * given to the constructor.
+   */
+  void copy_best_estimate();
+
+ protected:
+
+  /**
+   * Apply the intensity constraint to a block of n_seeds arrays
+   * stored one after the other, and record the error of each.
+   *
+   * @param block The first array
+   * @param arrays A Complex_2D for each array in the block
+   */
+  void project_intensity_batch(FFTW_COMPLEX * block,
+			       std::vector<Complex_2D *> & arrays);
+
+  /**
+   * Make a block of n_seeds arrays, and a Complex_2D for each
+   * one.
+   */
+  FFTW_COMPLEX * allocate_block(std::vector<Complex_2D *> & arrays);
+
+  /**
+   * Free a block made by allocate_block().
+   */
+  void free_block(FFTW_COMPLEX * block, std::vector<Complex_2D *> & arrays);
+
+};
+
+#endif
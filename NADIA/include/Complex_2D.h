@@ -26,10 +26,8 @@
 #include <fftw3.h>
 #include <Double_2D.h>
 #include <types.h>
-
-#ifndef NUM_THREADS
-#define NUM_THREADS 1
-#endif
+#include <FFTWPlanCache.h>
+#include <Parallel.h>
 
 
 template<class T>
@@ -41,15 +39,20 @@ class ComplexR_2D{
   /* A flag which is passed to fftw when plans are created */
   int fftw_type;
 
-  /** "array" holds the data */
+  /** the number of threads for this object, or 0 to use the
+      library setting (see Parallel.h) */
+  int num_threads;
+
+  /** "array" holds the data. The fftw plans used to transform it
+      are shared between objects (see FFTWPlanCache) */
   FFTW_COMPLEX *array;
-  /* A fftw plan for forward fourier transforms */
-  FFTW_PLAN f_forward;
-  /* A fftw plan for backward fourier transforms */
-  FFTW_PLAN f_backward;
 
   int malloc_size;
 
+  /** false if "array" belongs to someone else (see the constructor
+      which takes the memory to use) */
+  bool owns_array;
+
   
  public:
 
@@ -62,6 +65,22 @@ class ComplexR_2D{
    */
   ComplexR_2D(int x_size, int y_size);
 
+  /**
+   * Constructor that uses memory which has already been allocated,
+   * rather than allocating its own. This allows several Complex_2Ds
+   * to be stored one after the other in one block (e.g. so they can
+   * be fourier transformed together, see
+   * FFTWPlanCache::get_many_plan). The memory is not freed by this
+   * object, and must outlive it. The size of the array can't be
+   * changed.
+   * 
+   * @param x_size The number of samplings in the horizontal direction
+   * @param y_size The number of samplings in the vertical direction
+   * @param memory At least x_size*y_size values, preferably
+   * allocated with fftw_malloc.
+   */
+  ComplexR_2D(int x_size, int y_size, FFTW_COMPLEX * memory);
+
   /**
    * Destructor
    *
@@ -80,40 +99,25 @@ class ComplexR_2D{
 
 
   /**
-   *Assignment Operator
+   *Assignment Operator. The memory is only allocated again if the
+   *number of values has changed. The fftw plans are shared between
+   *arrays (see FFTWPlanCache), so they are not affected.
    */
 
   ComplexR_2D& operator=(const ComplexR_2D& rhs){
 
-    nx = rhs.get_size_x();
-    ny = rhs.get_size_y();
+    if(this == &rhs)
+      return *this;
 
-    malloc_size=sizeof(FFTW_COMPLEX)*rhs.get_size_x()*rhs.get_size_y();
-
-    FFTW_FREE(array);
-    if(f_forward)
-          FFTW_DESTROY_PLAN(f_forward);
-    if(f_backward)
-          FFTW_DESTROY_PLAN(f_backward);
-
-    array = (FFTW_COMPLEX*) FFTW_MALLOC(malloc_size);
+    resize(rhs.get_size_x(), rhs.get_size_y());
 
     memcpy(array, rhs.array, malloc_size);
 
+    //the plans are shared, so keep the planner flag of the original.
+    fftw_type = rhs.fftw_type;
+    num_threads = rhs.num_threads;
 
-    //initalise the fftw plans to null (not created yet. We will
-    //create them when needed to avoid unnecessary time overhead).
-    f_forward = 0;
-    f_backward = 0;
-    fftw_type = FFTW_MEASURE;
-
-/*    for(int i=0; i <rhs.get_size_x(); i++){
-      for(int j=0; j < rhs.get_size_y(); j++){
-	set_real(i, j, rhs.get_real(i, j));
-	set_imag(i, j, rhs.get_imag(i, j));
-      }
-    }
-*/
+    return *this;
   };
 
   /**
@@ -123,34 +127,60 @@ class ComplexR_2D{
 
   ComplexR_2D& operator=(const Double_2D& rhs){
 
-    nx = rhs.get_size_x();
-    ny = rhs.get_size_y();
-
-    FFTW_FREE(array);
-    if(f_forward)
-      FFTW_DESTROY_PLAN(f_forward);
-    if(f_backward)
-      FFTW_DESTROY_PLAN(f_backward);
- 
-    malloc_size=sizeof(FFTW_COMPLEX)*rhs.get_size_x()*rhs.get_size_y();
-    array=(FFTW_COMPLEX*) FFTW_MALLOC(malloc_size);
-
-    //initalise the fftw plans to null (not created yet. We will
-    //create them when needed to avoid unnecessary time overhead).
-    f_forward = 0;
-    f_backward = 0;
+    resize(rhs.get_size_x(), rhs.get_size_y());
+
     fftw_type = FFTW_MEASURE;
 
-    for(int i=0; i <rhs.get_size_x(); i++){
-      for(int j=0; j < rhs.get_size_y(); j++){
-	set_real(i, j, rhs.get(i, j));
-	set_imag(i, j, 0);
-      }
+    const int n = nx*ny;
+    NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(n,get_num_threads()))
+    for(int k=0; k<n; k++){
+      array[k][REAL] = rhs.array[k];
+      array[k][IMAG] = 0;
     }
 
+    return *this;
   };
 
+#if __cplusplus >= 201103L
 
+  /**
+   *Move Constructor. The memory of "object" is taken over, and
+   *"object" is left empty (of no size).
+   */
+  ComplexR_2D(ComplexR_2D&& object)
+    : nx(object.nx), ny(object.ny), fftw_type(object.fftw_type),
+    num_threads(object.num_threads), array(object.array),
+    malloc_size(object.malloc_size), owns_array(object.owns_array){
+    object.nx = 0;
+    object.ny = 0;
+    object.array = 0;
+    object.malloc_size = 0;
+  };
+
+  /**
+   *Move Assignment. The memory of "rhs" is taken over, and "rhs" is
+   *left empty (of no size).
+   */
+  ComplexR_2D& operator=(ComplexR_2D&& rhs){
+    if(this != &rhs){
+      if(array && owns_array)
+	FFTW_FREE(array);
+      nx = rhs.nx;
+      ny = rhs.ny;
+      fftw_type = rhs.fftw_type;
+      num_threads = rhs.num_threads;
+      array = rhs.array;
+      malloc_size = rhs.malloc_size;
+      owns_array = rhs.owns_array;
+      rhs.nx = 0;
+      rhs.ny = 0;
+      rhs.array = 0;
+      rhs.malloc_size = 0;
+    }
+    return *this;
+  };
+
+#endif
 
   /**
    * Set the value at point x,y. Note that this is
@@ -325,6 +355,41 @@ class ComplexR_2D{
     return ny;
   };
 
+  /**
+   * Get direct access to the values. They are stored contiguously,
+   * row by row, in the fftw interleaved format: the value at (x,y)
+   * is at [x*get_size_y()+y], with [REAL] and [IMAG] components.
+   * This is for loops over the whole array which need to be fast;
+   * the setter and getter methods should be used otherwise.
+   *
+   * @return A pointer to the first value.
+   */
+  FFTW_COMPLEX * get_array(){
+    return array;
+  };
+
+  /**
+   * Get direct read-only access to the values. See get_array().
+   *
+   * @return A pointer to the first value.
+   */
+  const FFTW_COMPLEX * get_array() const{
+    return array;
+  };
+
+  /**
+   * Move the values into memory allocated elsewhere (e.g. a
+   * FrameStore), which the array then uses instead of its own, as if
+   * it had been made with the constructor which takes "memory". The
+   * memory is not freed by this object, and must outlive it (or be
+   * given back with move_to(0)).
+   *
+   * @param memory At least get_size_x()*get_size_y() values,
+   * preferably aligned as fftw_malloc would, or 0 to move the values
+   * back into memory owned by the array.
+   */
+  void move_to(FFTW_COMPLEX * memory);
+
   /**
    * Get a 2D array of real numbers. 
    * 
@@ -336,6 +401,30 @@ class ComplexR_2D{
    */
   void get_2d(int type, Double_2D & result) const;
 
+  /**
+   * Copy the values into separate real and imaginary arrays. The
+   * fourier transforms need the interleaved layout used by this
+   * class, but kernels which treat the two components independently
+   * can work on the split (structure-of-arrays) layout instead, which
+   * is easier for the compiler to vectorise. Use set_split() to copy
+   * the values back.
+   *
+   * @param real A Real_2D with the same dimensions as this object,
+   * which is filled with the real components.
+   * @param imag A Real_2D with the same dimensions as this object,
+   * which is filled with the imaginary components.
+   */
+  void get_split(Real_2D<T> & real, Real_2D<T> & imag) const;
+
+  /**
+   * Set the values from separate real and imaginary arrays. See
+   * get_split().
+   *
+   * @param real The real components.
+   * @param imag The imaginary components.
+   */
+  void set_split(const Real_2D<T> & real, const Real_2D<T> & imag);
+
   /**
    * Scale the real and imaginary components of the array by a factor. 
    * 
@@ -357,7 +446,7 @@ class ComplexR_2D{
    * calling Complex_2D::scale() followed by Complex_2D:add()
    * separately.
    */
-  void add(ComplexR_2D & c2, T scale=1);
+  void add(const ComplexR_2D & c2, T scale=1);
 
 
   /**
@@ -374,7 +463,7 @@ class ComplexR_2D{
    * separately.
    */
 
-  void multiply(ComplexR_2D & c2, T scale=1);
+  void multiply(const ComplexR_2D & c2, T scale=1);
 
   /**
    * Multiple a Double_2D to this Complex_2D. The values in this object
@@ -389,10 +478,53 @@ class ComplexR_2D{
    * calling Complex_2D::scale() followed by Complex_2D:multiply()
    * separately.
    */
-  void multiply(Double_2D & d2, T scale=1);
+  void multiply(const Double_2D & d2, T scale=1);
+
 
 
 
+  /**
+   * Replace the magnitude of this field with a measured one, while
+   * keeping the phase (the modulus projection). This is done in a
+   * single branch-free pass, which the compiler is able to
+   * vectorise, and the error sums are calculated at the same
+   * time. It is used by the scale_intensity() methods of the CDI
+   * classes.
+   *
+   * The field being projected is t = input_scale*(c + offset), where
+   * c is this Complex_2D. Where the mask is 1 it is replaced by
+   * t*amplitude/|t|, or t*amplitude/reference if a reference
+   * magnitude is given. Where the mask is 0, t is unchanged. The
+   * result is multiplied by output_scale and the offset is
+   * subtracted again.
+   *
+   * @param amplitude The measured amplitude (square root of the
+   * intensity).
+   * @param mask A mask with values of 0 (excluded, e.g. behind a
+   * beam-stop) or 1. If it is null all points are projected.
+   * @param norm2_mag This is incremented by the sum of amplitude^2
+   * over the unmasked points.
+   * @param norm2_diff This is incremented by the sum of
+   * (|t|-amplitude)^2, or (reference-amplitude)^2, over the unmasked
+   * points.
+   * @param reference The magnitude to scale from, in place of
+   * |t|. Points where it is 0 are set to 0. May be null.
+   * @param offset A field added before the projection and subtracted
+   * afterwards. May be null.
+   * @param input_scale A factor applied to the field before the
+   * projection.
+   * @param output_scale A factor applied to the result.
+   * @param x_offset, y_offset The position in this Complex_2D of the
+   * element corresponding to (0,0) in the amplitude, mask and
+   * reference arrays. These arrays may be smaller than this one.
+   */
+  void project_modulus(const Real_2D<T> & amplitude,
+		       const Real_2D<T> * mask,
+		       double & norm2_mag, double & norm2_diff,
+		       const Real_2D<T> * reference=0,
+		       const ComplexR_2D<T> * offset=0,
+		       T input_scale=1, T output_scale=1,
+		       int x_offset=0, int y_offset=0);
 
   /**
    * Get the norm of this Complex_2D: @f $     $ @f.
@@ -415,6 +547,41 @@ class ComplexR_2D{
    */
   void copy(const ComplexR_2D & c);
 
+  /**
+   * Copy the values from another Complex_2D to this one, multiplying
+   * them by a mask at the same time. This is equivalent to calling
+   * copy() and then multiply(), but only makes one pass over the
+   * arrays.
+   *
+   * @param c The Complex_2D which will be copied from.
+   * @param mask The real array the values are multiplied by.
+   */
+  void copy(const ComplexR_2D & c, const Real_2D<T> & mask);
+
+  /**
+   * Replace this array, x, by a linear combination of itself and
+   * other arrays. This is the last step of each iteration of the
+   * reconstruction algorithms:
+   * <br> x = c[0] x + c[1] a + c[2] b + c[3] P(x) + c[4] P(a)
+   * <br> where P(x) is either mask*x, if a mask is given, or the
+   * values in px (and P(a) is mask*a or pa).
+   *
+   * All the arrays are read in a single pass. Terms with a zero
+   * coefficient are left out entirely (their array may be null), and
+   * a loop specialised for the terms which are used is picked before
+   * the pass starts, so there is no per-element branching.
+   *
+   * @param coefficients The five coefficients c[0] to c[4].
+   * @param a, b, px, pa The arrays in the combination. They must all
+   * have the same dimensions as this array.
+   * @param mask If given, P() is taken to be multiplication by the
+   * mask, and px and pa are not used.
+   */
+  void combine(const double coefficients[5],
+	       const ComplexR_2D * a, const ComplexR_2D * b,
+	       const ComplexR_2D * px, const ComplexR_2D * pa,
+	       const Real_2D<T> * mask=0);
+
 
   /**
    * Rearrange the matrix so that the corners are placed in the
@@ -436,6 +603,17 @@ class ComplexR_2D{
    */
   void invert(bool scale=false);
 
+  /**
+   * Multiply every element by @f$ \mathrm{scale} \times (-1)^{x+y} @f$.
+   * For arrays with even dimensions, doing this before a fourier
+   * transform has the same effect as calling invert() after it (and
+   * the other way around for a backward transform), but it only
+   * needs a single sequential pass over the array.
+   *
+   * @param scale A factor which all elements are also multiplied by.
+   */
+  void checkerboard(T scale=1);
+
   void conjugate();
 
 
@@ -443,7 +621,9 @@ class ComplexR_2D{
    * Forward fourier transform the Complex_2D object. The
    * Complex_2D is not scaled to give the same normalisation as 
    * before the transform. The invert() function can be used to
-   * acheive this.
+   * acheive this. The fftw plan is taken from the FFTWPlanCache, so
+   * it is only created the first time an array of this size is
+   * transformed.
    *
    */
   void perform_forward_fft();
@@ -457,18 +637,58 @@ class ComplexR_2D{
    */
   void perform_backward_fft();
 
+  /**
+   * Forward fourier transform the Complex_2D object and centre the
+   * result, scaled by 1/sqrt(nx*ny). This gives the same result as
+   * calling perform_forward_fft() followed by invert(true), but for
+   * even dimensions the quadrant swap and scaling are done with
+   * checkerboard() before the transform.
+   */
+  void perform_forward_fft_centred();
+
+  /**
+   * The reverse of perform_forward_fft_centred(). This gives the same
+   * result as calling invert(true) followed by
+   * perform_backward_fft().
+   */
+  void perform_backward_fft_centred();
+
   void mirror();
 
 
+  /**
+   * Perform a complex-to-real backward fourier transform. This array
+   * must hold the half spectrum of a real array, as made by
+   * perform_forward_fft_real(), i.e. it must be nx x (ny/2+1) where
+   * nx and ny are the size of "result". The transform is not scaled,
+   * and the contents of this array are lost.
+   *
+   * @param result The real array the transform is written to
+   */
   void perform_backward_fft_real(Double_2D & result);
 
-  void perform_forward_fft_real(Double_2D & input);
+  /**
+   * Perform a real-to-complex forward fourier transform of "input"
+   * and store the result in this array. Only the non-redundant half
+   * of the spectrum is stored: this array is resized to
+   * nx x (ny/2+1), where nx and ny are the size of "input", and
+   * holds the values with j <= ny/2. The rest of the spectrum is
+   * given by F(i,j) = conj(F((nx-i)%nx,ny-j)). The half spectrum can
+   * be multiplied, conjugated etc. in the usual way, and
+   * transformed back with perform_backward_fft_real(). This is
+   * about twice as fast as the full complex transform and uses half
+   * the memory.
+   *
+   * @param input The real array to transform. It is not changed.
+   */
+  void perform_forward_fft_real(const Double_2D & input);
 
   /**
    * A flag which is passed to fftw when plans are created. It maybe
    * either FFTW_ESTIMATE, FFTW_MEASURE or FFTW_PATIENT. See the fftw
    * documentation for a description of each. By default we use
-   * FFTW_MEASURE. FFTW_ESTIMATE is used for testing purposes.
+   * FFTW_MEASURE. FFTW_ESTIMATE is used for testing purposes. Copies
+   * of this object inherit the flag.
    *
    * @param type - FFTW_ESTIMATE, FFTW_MEASURE or FFTW_PATIENT
    */
@@ -476,16 +696,75 @@ class ComplexR_2D{
     fftw_type = type;
   };
 
+  /**
+   * Get the flag which is passed to fftw when plans are created.
+   *
+   * @return FFTW_ESTIMATE, FFTW_MEASURE or FFTW_PATIENT
+   */
+  int get_fftw_type() const{
+    return fftw_type;
+  };
+
+  /**
+   * Set the number of threads used for the fourier transforms and
+   * the other operations on this array, in place of the library
+   * setting (nadia::set_num_threads()). Copies of this object
+   * inherit the setting.
+   *
+   * @param n The number of threads, or 0 to go back to using the
+   * library setting.
+   */
+  void set_num_threads(int n){
+    num_threads = n < 0 ? 0 : n;
+  };
+
+  /**
+   * Get the number of threads used for the operations on this array.
+   *
+   * @return The number of threads.
+   */
+  int get_num_threads() const{
+    return nadia::get_num_threads(num_threads);
+  };
+
   /**
    * Create the same complex with some padding. The padding is filled with 0s
    **/
 
-  ComplexR_2D get_padded(int x_add, int y_add);
+  ComplexR_2D get_padded(int x_add, int y_add) const;
 
   /**
    * Create the same complex without the some padding. 
    */
-  ComplexR_2D get_unpadded(int x_add, int y_add);
+  ComplexR_2D get_unpadded(int x_add, int y_add) const;
+
+  /**
+   * Copy this array into the centre of "result" and fill the rest of
+   * "result" with 0s. This is the same as get_padded(), but "result"
+   * is only allocated again if its size is wrong, so it can be
+   * reused between iterations. "result" takes the fftw and thread
+   * settings of this array, and must not be this array.
+   *
+   * @param result The padded array, which will be
+   * (nx+2*x_add)x(ny+2*y_add).
+   * @param x_add The padding on each side in x
+   * @param y_add The padding on each side in y
+   */
+  void pad_into(ComplexR_2D & result, int x_add, int y_add) const;
+
+  /**
+   * Copy the centre of this array into "result", dropping the
+   * padding. This is the same as get_unpadded(), but "result" is
+   * only allocated again if its size is wrong. "result" takes the
+   * fftw and thread settings of this array, and must not be this
+   * array.
+   *
+   * @param result The unpadded array, which will be
+   * (nx-2*x_add)x(ny-2*y_add).
+   * @param x_add The padding on each side in x
+   * @param y_add The padding on each side in y
+   */
+  void unpad_into(ComplexR_2D & result, int x_add, int y_add) const;
 
 
 
@@ -499,11 +778,15 @@ class ComplexR_2D{
    */
   int check_bounds(int x, int y) const;
 
-
   /**
-   * Create the fftw plans for forward and backward fast fourier transforms
+   * Change the size of the array. The memory is only allocated again
+   * if the number of values has changed, and the values are not
+   * kept.
+   *
+   * @param x_size The new number of samplings in x
+   * @param y_size The new number of samplings in y
    */
-  void initialise_fft();
+  void resize(int x_size, int y_size);
 
 
 };
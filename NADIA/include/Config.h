@@ -104,6 +104,18 @@ class Config{
    */  
   std::list<std::string> * getStringList(std::string key);
 
+  /**
+   * Is the key in the config file? Unlike the access methods above,
+   * this does not change the status, so it can be used for
+   * optional settings.
+   * 
+   * @param key The key, or field name 
+   * @return true if the key was found
+   */
+  bool hasKey(std::string key){
+    return mapping.find(key)!=mapping.end();
+  };
+
   /**
    * Were all the requests for a key-value pair successful?  If any
    * of the keys were not found in the file (after calling the access
@@ -27,7 +27,14 @@
 
 #include <math.h>
 #include <cstring>
+#include <cstdlib>
 #include <iostream>
+#include <Parallel.h>
+
+/** The alignment, in bytes, of the memory allocated for a
+    Real_2D. This is a cache line, which is enough for any of the
+    SIMD instruction sets. */
+#define REAL_2D_ALIGNMENT 64
 
 template <class T>
 class Real_2D{
@@ -43,14 +50,20 @@ class Real_2D{
   /** the size in y */
   int ny;
 
+  /** false if "array" belongs to someone else (see move_to()) */
+  bool owns_array;
+
  public:
 
+  /** the type of the values in the array */
+  typedef T value_type;
+
   template <class TT>friend class ComplexR_2D;
   /**
    * A constructor which creates an empty array (of no size).  Note
    * that memory has not been allocated if this method is used.
    */
-  Real_2D():nx(0),ny(0){};
+  Real_2D():array(0),nx(0),ny(0),owns_array(true){};
   
   /**
    * Constructor that creates a 2D object with the given dimensions.
@@ -66,15 +79,48 @@ class Real_2D{
    * Destructor. Memory is deallocated here.
    */
   ~Real_2D(){
-    if(nx > 0 ){
-      delete [] array;
-    }  
-    
+    if(owns_array)
+      free(array);
+  };
+
+#if __cplusplus >= 201103L
+
+  /**
+   * Move constructor. The memory of "object" is taken over, and
+   * "object" is left empty (of no size).
+   */
+  Real_2D(Real_2D&& object):array(object.array),nx(object.nx),ny(object.ny),
+    owns_array(object.owns_array){
+    object.array = 0;
+    object.nx = 0;
+    object.ny = 0;
+  };
+
+  /**
+   * Move assignment. The memory of "rhs" is taken over, and "rhs" is
+   * left empty (of no size).
+   */
+  Real_2D& operator=(Real_2D&& rhs){
+    if(this != &rhs){
+      if(owns_array)
+	free(array);
+      array = rhs.array;
+      nx = rhs.nx;
+      ny = rhs.ny;
+      owns_array = rhs.owns_array;
+      rhs.array = 0;
+      rhs.nx = 0;
+      rhs.ny = 0;
+    }
+    return *this;
   };
+
+#endif
      
   /**
    * Allocate memory for the array. This should only be used if
-   * the constructor was called with no parameters!
+   * the constructor was called with no parameters! The memory is
+   * aligned to REAL_2D_ALIGNMENT bytes and set to zero.
    * 
    * @param x_size The number of samplings in the horizontal direction
    * @param y_size The number of samplings in the vertical direction
@@ -82,7 +128,13 @@ class Real_2D{
   void allocate_memory(int x_size, int y_size){
     nx = x_size;
     ny = y_size;
-    array = new T[nx*ny];
+    void * memory = 0;
+    if(posix_memalign(&memory, REAL_2D_ALIGNMENT, sizeof(T)*nx*ny)!=0){
+      std::cout << "Could not allocate memory. Exiting.."<<std::endl;
+      exit(1);
+    }
+    array = (T*) memory;
+    owns_array = true;
     memset(array, 0, sizeof(T)*nx*ny);
 
     return;
@@ -142,6 +194,66 @@ class Real_2D{
     return array[x*ny+y];
   };
 
+  /**
+   * Get direct access to the values. They are stored contiguously,
+   * row by row, so the value at (x,y) is at [x*get_size_y()+y], and
+   * the start of the array is aligned to REAL_2D_ALIGNMENT
+   * bytes. This is for loops over the whole array which need to be
+   * fast; set() and get() should be used otherwise.
+   *
+   * @return A pointer to the first value.
+   */
+  inline T * get_array(){
+    return array;
+  };
+
+  /**
+   * Get direct read-only access to the values. See get_array().
+   *
+   * @return A pointer to the first value.
+   */
+  inline const T * get_array() const{
+    return array;
+  };
+
+  /**
+   * Move the values into memory allocated elsewhere (e.g. a
+   * FrameStore), which the array then uses instead of its own. The
+   * memory is not freed by this object, and must outlive it (or be
+   * given back with move_to(0)). The array can't be resized while it
+   * uses the memory.
+   *
+   * @param memory At least get_size_x()*get_size_y() values, aligned
+   * to REAL_2D_ALIGNMENT bytes, or 0 to move the values back into
+   * memory owned by the array.
+   */
+  void move_to(T * memory){
+    if(memory == array)
+      return;
+    T * old_array = array;
+    bool owned = owns_array;
+    if(memory){
+      memcpy(memory, old_array, sizeof(T)*nx*ny);
+      array = memory;
+      owns_array = false;
+    }
+    else{
+      allocate_memory(nx, ny);
+      memcpy(array, old_array, sizeof(T)*nx*ny);
+    }
+    if(owned)
+      free(old_array);
+  };
+
+  /**
+   * Get the total number of values in the array.
+   *
+   * @return nx*ny
+   */
+  inline int get_size() const {
+    return nx*ny;
+  };
+
   /**
    * Get the size in x;
    * 
@@ -209,9 +321,10 @@ class Real_2D{
    */
   T get_sum() const{
     T total = 0;
-    for(int i=0; i<nx; i++)
-      for(int j=0; j<ny; j++)
-	total+=array[i*ny+j];
+    const int n = nx*ny;
+    NADIA_OMP(parallel for NADIA_OMP_CLAUSES(n) reduction(+:total))
+    for(int k=0; k<n; k++)
+      total+=array[k];
     return total;
   };
 
@@ -223,9 +336,10 @@ class Real_2D{
    */
   T get_abs_sum() const{
     T total = 0;
-    for(int i=0; i<nx; i++)
-      for(int j=0; j<ny; j++)
-	total+=fabs(array[i*ny+j]);
+    const int n = nx*ny;
+    NADIA_OMP(parallel for NADIA_OMP_CLAUSES(n) reduction(+:total))
+    for(int k=0; k<n; k++)
+      total+=fabs(array[k]);
     return total;
   };
 
@@ -254,12 +368,10 @@ class Real_2D{
       return 0;
 
     T max = array[0];
-    for(int i=0; i<nx; i++){
-      for(int j=0; j<ny; j++){
-	if(array[i*ny+j]>max)
-	  max = array[i*ny+j];
-      }
-    }
+    const int n = nx*ny;
+    NADIA_OMP(parallel for NADIA_OMP_CLAUSES(n) reduction(max:max))
+    for(int k=1; k<n; k++)
+      max = array[k]>max ? array[k] : max;
     return max;
 
   };
@@ -274,26 +386,29 @@ class Real_2D{
       return 0;
 
     T min = array[0];
-    for(int i=0; i<nx; i++){
-      for(int j=0; j<ny; j++){
-	if(array[i*ny+j]<min)
-	  min = array[i*ny+j];
-      }
-    }
+    const int n = nx*ny;
+    NADIA_OMP(parallel for NADIA_OMP_CLAUSES(n) reduction(min:min))
+    for(int k=1; k<n; k++)
+      min = array[k]<min ? array[k] : min;
     return min;
 
   };
 
   void add(const Real_2D<T> & other_array, double norm=1.0){
-    for(int i=0; i< nx; i++)
-      for(int j=0; j< ny; j++)
-	array[i*ny+j]+=norm*other_array.get(i,j);
+    const T t_norm = norm;
+    const T * other = other_array.array;
+    const int n = nx*ny;
+    NADIA_OMP(parallel for NADIA_OMP_CLAUSES(n))
+    for(int k=0; k<n; k++)
+      array[k]+=t_norm*other[k];
   };
 
   void scale(double scale_by){
-    for(int i=0; i< nx; i++)
-      for(int j=0; j< ny; j++)
-	array[i*ny+j]*=scale_by;
+    const T t_scale = scale_by;
+    const int n = nx*ny;
+    NADIA_OMP(parallel for NADIA_OMP_CLAUSES(n))
+    for(int k=0; k<n; k++)
+      array[k]*=t_scale;
   };
 
 
@@ -301,18 +416,20 @@ class Real_2D{
    * Square all array values in-place. 
    */
   void square(){
-    for(int i=0; i< nx; i++)
-      for(int j=0; j< ny; j++)
-	array[i*ny+j] *= array[i*ny+j];
+    const int n = nx*ny;
+    NADIA_OMP(parallel for NADIA_OMP_CLAUSES(n))
+    for(int k=0; k<n; k++)
+      array[k] *= array[k];
   };
 
   /**
    * Square-root all array values in-place. 
    */
   void sq_root(){
-    for(int i=0; i< nx; i++)
-      for(int j=0; j< ny; j++)
-	array[i*ny+j] = sqrt(array[i*ny+j]);
+    const int n = nx*ny;
+    NADIA_OMP(parallel for NADIA_OMP_CLAUSES(n))
+    for(int k=0; k<n; k++)
+      array[k] = sqrt(array[k]);
   };
 
   /**
@@ -327,24 +444,32 @@ class Real_2D{
   };
 
   /**
-   * Set the assignment operator
+   * Set the assignment operator. The memory is only allocated again
+   * if the number of values has changed.
    */
   Real_2D& operator=(const Real_2D& rhs){
 
-    //Clean up
-    if(nx > 0 ){
-      delete [] array;
-    }
+    if(this == &rhs)
+      return *this;
 
-    //Construct again
-    allocate_memory(rhs.get_size_x(),rhs.get_size_y());
+    if(nx*ny != rhs.nx*rhs.ny){
+      if(!owns_array){
+	std::cout << "A Double_2D which uses memory allocated elsewhere "
+		  << "can not be resized. Exiting..." << std::endl;
+	exit(1);
+      }
+      //Clean up
+      free(array);
+      //Construct again
+      allocate_memory(rhs.get_size_x(),rhs.get_size_y());
+    }
+    else{
+      nx = rhs.nx;
+      ny = rhs.ny;
+    }
     memcpy(array, rhs.array, sizeof(T)*nx*ny);
-    /*
-       for(int i =0; i<rhs.get_size_x(); i++){
-       for(int j=0; j<rhs.get_size_y(); j++){
-       set(i, j, rhs.get(i, j));
-       }
-       }*/
+
+    return *this;
   };
 
 };
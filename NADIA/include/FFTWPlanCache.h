@@ -0,0 +1,238 @@
+// Copyright 2011 Nadia Davidson for The ARC Centre of Excellence in
+// Coherent X-ray Science. This program is distributed under the GNU
+// General Public License. We also ask that you cite this software in
+// publications where you made use of it for any part of the data
+// analysis.
+
+/**
+ * @file FFTWPlanCache.h
+ * @class FFTWPlanCache
+ *
+ * @brief A process-wide registry of fftw plans.
+ *
+ * Creating an fftw plan with FFTW_MEASURE (or FFTW_PATIENT) is
+ * expensive, often more so than the reconstruction itself for large
+ * arrays. This class makes sure that each plan is created only once
+ * for a given array shape, transform direction, set of fftw flags and
+ * number of threads, and is then shared by every Complex_2D in the
+ * program. Plans are
+ * run through the fftw "new-array execute" interface, so they may be
+ * applied to any array of the correct shape, including copies and
+ * temporary arrays.
+ *
+ * The precision of the plans (float or double) is fixed when the
+ * library is compiled (see types.h). All methods are static and
+ * thread-safe.
+ *
+ * Plans can also be kept between program runs by giving a wisdom
+ * file, either with set_wisdom_file() or through the environment
+ * variable NADIA_FFTW_WISDOM. The wisdom is loaded before the first
+ * plan is made. The new plans are written to the file once, when the
+ * program exits (or save_wisdom() is called), rather than as each
+ * one is made, so planning never waits for the file. The file is
+ * replaced in one step and wisdom other programs have added to it is
+ * kept, so several programs can share one file. Wisdom made with
+ * FFTW_PATIENT or FFTW_EXHAUSTIVE (see the
+ * nadia-plan-warmup tool) is also used when FFTW_MEASURE plans are
+ * asked for, so the planning time is removed from later runs.
+ */
+
+#ifndef FFTW_PLAN_CACHE_H
+#define FFTW_PLAN_CACHE_H
+
+#include <map>
+#include <string>
+#include <pthread.h>
+#include <fftw3.h>
+#include <types.h>
+
+class FFTWPlanCache{
+
+  /** A key which uniquely identifies a plan */
+  struct PlanKey{
+    int nx;
+    int ny;
+    int direction;
+    int flags;
+    int threads;
+    int howmany;
+    bool real;
+
+    bool operator<(const PlanKey & rhs) const{
+      if(real!=rhs.real) return real < rhs.real;
+      if(howmany!=rhs.howmany) return howmany < rhs.howmany;
+      if(nx!=rhs.nx) return nx < rhs.nx;
+      if(ny!=rhs.ny) return ny < rhs.ny;
+      if(direction!=rhs.direction) return direction < rhs.direction;
+      if(flags!=rhs.flags) return flags < rhs.flags;
+      return threads < rhs.threads;
+    };
+  };
+
+  /** the plans which have been created so far */
+  static std::map<PlanKey,FFTW_PLAN> plans;
+
+  /** protects "plans" and the fftw planner (which is not thread-safe) */
+  static pthread_mutex_t mutex;
+
+  /** the file wisdom is read from and saved to ("" for none) */
+  static std::string wisdom_file;
+
+  /** whether NADIA_FFTW_WISDOM has been looked at yet */
+  static bool wisdom_initialised;
+
+  /** whether plans have been made since the wisdom file was saved */
+  static bool wisdom_changed;
+
+  /** load the wisdom file if one has been set. mutex must be held */
+  static void initialise_wisdom();
+
+  /** set "wisdom_file", and make sure it is saved when the program
+      exits. mutex must be held */
+  static void use_wisdom_file(const std::string & file_name);
+
+  /** write the wisdom to a temporary file and rename it to
+      "file_name". mutex must not be held */
+  static int write_wisdom(const std::string & file_name);
+
+  /** find the plan for "key", or make it with make_plan() if it is
+      not in the cache yet. */
+  static FFTW_PLAN find_or_make_plan(PlanKey & key, int threads);
+
+  /** create a new plan on scratch arrays. mutex must be held */
+  static FFTW_PLAN make_plan(const PlanKey & key);
+
+ public:
+
+  /**
+   * Get the plan for an in-place complex-to-complex 2D transform. The
+   * plan is created the first time it is asked for, using a scratch
+   * array, so the contents of "array" are never touched. If "array"
+   * does not have the SIMD alignment fftw expects an unaligned plan
+   * is returned instead.
+   *
+   * @param nx The number of samplings in the horizontal direction
+   * @param ny The number of samplings in the vertical direction
+   * @param direction FFTW_FORWARD or FFTW_BACKWARD
+   * @param flags The fftw planner flags, e.g. FFTW_MEASURE
+   * @param array The array the plan will be executed on.
+   * @param threads The number of threads the transform should use.
+   * This is ignored unless the library was built with
+   * --enable-threads.
+   * @return The plan. It must not be destroyed by the caller.
+   */
+  static FFTW_PLAN get_plan(int nx, int ny, int direction, int flags,
+			    FFTW_COMPLEX * array, int threads=1);
+
+  /**
+   * Get the plan for in-place complex-to-complex 2D transforms of
+   * "howmany" arrays at once (see fftw_plan_many_dft). The arrays
+   * must be stored one after the other, each nx x ny. Transforming
+   * a stack of small arrays together is quicker than one at a time,
+   * and the multi-threaded version shares the arrays between
+   * threads rather than splitting each transform.
+   *
+   * @param nx The number of samplings of each array in x
+   * @param ny The number of samplings of each array in y
+   * @param howmany The number of arrays
+   * @param direction FFTW_FORWARD or FFTW_BACKWARD
+   * @param flags The fftw planner flags, e.g. FFTW_MEASURE
+   * @param array The first array the plan will be executed on.
+   * @param threads The number of threads the transform should use.
+   * @return The plan. It must not be destroyed by the caller.
+   */
+  static FFTW_PLAN get_many_plan(int nx, int ny, int howmany,
+				 int direction, int flags,
+				 FFTW_COMPLEX * array, int threads=1);
+
+  /**
+   * Get the plan for a real-to-complex (r2c) or complex-to-real (c2r)
+   * 2D transform. Because the transform of a real array is Hermitian,
+   * only ny/2+1 of the ny columns are stored on the complex side (see
+   * the fftw documentation on "r2c"), which halves the work and the
+   * memory of the transform. As for get_plan(), the plan is made on
+   * scratch arrays and can be executed on any arrays of the right
+   * size (with FFTW_EXECUTE_DFT_R2C or FFTW_EXECUTE_DFT_C2R). Note
+   * that c2r transforms always overwrite their input.
+   *
+   * @param nx The number of samplings of the real array in x
+   * @param ny The number of samplings of the real array in y
+   * @param direction FFTW_FORWARD for real-to-complex, FFTW_BACKWARD
+   * for complex-to-real.
+   * @param flags The fftw planner flags, e.g. FFTW_MEASURE
+   * @param real The real array the plan will be executed on
+   * (nx x ny).
+   * @param complex The complex array the plan will be executed on
+   * (nx x (ny/2+1)).
+   * @param threads The number of threads the transform should use.
+   * @return The plan. It must not be destroyed by the caller.
+   */
+  static FFTW_PLAN get_real_plan(int nx, int ny, int direction, int flags,
+				 FFTW_REAL * real, FFTW_COMPLEX * complex,
+				 int threads=1);
+
+  /**
+   * Set the file which fftw wisdom is read from and written to. Any
+   * wisdom already in the file is loaded straight away, and the file
+   * is rewritten with the new plans when the program exits (see
+   * save_wisdom()). This overrides the NADIA_FFTW_WISDOM environment
+   * variable.
+   *
+   * @param file_name The wisdom file. An empty string turns off
+   * saving of wisdom.
+   * @return SUCCESS if the file was read (or does not exist yet),
+   * FAILURE if it exists but could not be read.
+   */
+  static int set_wisdom_file(const std::string & file_name);
+
+  /**
+   * Get the name of the current wisdom file.
+   *
+   * @return The file name, or "" if none has been set.
+   */
+  static std::string get_wisdom_file();
+
+  /**
+   * Read fftw wisdom from a file.
+   *
+   * @param file_name The file to read
+   * @return SUCCESS or FAILURE
+   */
+  static int import_wisdom(const std::string & file_name);
+
+  /**
+   * Write all the fftw wisdom gathered so far to a file. The file is
+   * written under another name and then renamed, so it is never seen
+   * half written.
+   *
+   * @param file_name The file to write
+   * @return SUCCESS or FAILURE
+   */
+  static int export_wisdom(const std::string & file_name);
+
+  /**
+   * Write the wisdom file (see set_wisdom_file()) if plans have been
+   * made since it was read or last saved. Wisdom which other programs
+   * have saved to the file in the meantime is merged in first. This
+   * is done automatically when the program exits, but can be called
+   * earlier, e.g. by a long-running program after its first
+   * reconstruction.
+   *
+   * @return SUCCESS, or FAILURE if the file could not be written.
+   */
+  static int save_wisdom();
+
+  /**
+   * Get the number of plans held in the cache.
+   */
+  static int get_size();
+
+  /**
+   * Destroy all the plans held in the cache. This should only be
+   * called when no transforms are running.
+   */
+  static void clear();
+
+};
+
+#endif
@@ -0,0 +1,155 @@
+// Copyright 2011 Nadia Davidson for The ARC Centre of Excellence in
+// Coherent X-ray Science. This program is distributed under the GNU
+// General Public License. We also ask that you cite this software in
+// publications where you made use of it for any part of the data
+// analysis.
+
+/**
+ * @file FrameStore.h
+ * @class FrameStore
+ *
+ * @brief Keeps the arrays of many frames in a memory-mapped scratch
+ * file, so they don't all need to fit in memory at once.
+ *
+ * The arrays of a frame are moved into a region of the file with
+ * add_arrays() (see Complex_2D::move_to() and Double_2D::move_to()).
+ * The arrays are used as normal, and the operating system reads the
+ * parts which are needed from the file. To keep this from stalling
+ * the reconstruction, the next frame can be read in the background
+ * with prefetch() while the current one is used, and a frame which
+ * is finished with can be dropped from memory with release().
+ *
+ * This is used by PhaseDiverseCDI when frame streaming is turned on
+ * (see PhaseDiverseCDI::set_frame_streaming()), so that scans with
+ * thousands of positions can be reconstructed on one workstation.
+ *
+ * The scratch file should be on a disk. The default directory
+ * ($TMPDIR or /tmp) is often a tmpfs, in which case "spilled to the
+ * file" still means held in memory or swap.
+ *
+ * The file is deleted as soon as it is made, so it disappears when
+ * the FrameStore is destroyed (or the program exits). The arrays
+ * must not be used after that, unless they were moved back into
+ * their own memory with move_to(0).
+ */
+
+#ifndef FRAME_STORE_H
+#define FRAME_STORE_H
+
+#include <vector>
+#include <cstddef>
+#include <pthread.h>
+#include <Complex_2D.h>
+#include <Double_2D.h>
+
+class FrameStore{
+
+  /** the scratch file */
+  int fd;
+
+  /** the number of bytes in the file */
+  size_t file_size;
+
+  /** the mapped regions of each frame. A frame has more than one
+      if arrays were added to it later. */
+  std::vector< std::vector<char *> > region_start;
+  std::vector< std::vector<size_t> > region_size;
+
+  /** the thread reading a frame in the background, and the frame it
+      is reading (-1 if there is none) */
+  pthread_t prefetch_thread;
+  int prefetch_frame;
+
+ public:
+
+  /**
+   * Constructor. The scratch file is made straight away.
+   *
+   * @param directory The directory to put the scratch file in. If
+   * this is 0, $TMPDIR is used, or /tmp if that isn't set. On many
+   * systems these are tmpfs, which is held in memory (or swap), so
+   * the frames would not really leave memory. Give a directory on a
+   * disk for large scans.
+   */
+  FrameStore(const char * directory=0);
+
+  /**
+   * Destructor. The file is unmapped and removed.
+   */
+  ~FrameStore();
+
+  /**
+   * Move arrays of a frame into a new region of the file. Null
+   * pointers in the lists, and arrays which are already in the
+   * frame, are skipped.
+   *
+   * @param frame The number of the frame. This is either a frame
+   * which is already in the store, or get_number_of_frames() to add
+   * a new one.
+   * @param complex_arrays The complex arrays of the frame
+   * @param real_arrays The real arrays of the frame
+   */
+  void add_arrays(int frame,
+		  const std::vector<Complex_2D*> & complex_arrays,
+		  const std::vector<Double_2D*> & real_arrays);
+
+  /**
+   * Get the number of frames which have been added.
+   *
+   * @return The number of frames
+   */
+  int get_number_of_frames() const{
+    return region_start.size();
+  };
+
+  /**
+   * Get the size of the scratch file.
+   *
+   * @return The number of bytes
+   */
+  size_t get_size() const{
+    return file_size;
+  };
+
+  /**
+   * Check whether some memory is inside a frame.
+   *
+   * @param frame The number of the frame
+   * @param memory A pointer to check
+   * @return true if "memory" is inside one of the frame's regions
+   */
+  bool contains(int frame, const void * memory) const;
+
+  /**
+   * Start reading a frame into memory on a background thread. Any
+   * earlier prefetch is finished first. Nothing is done if "frame"
+   * isn't in the store.
+   *
+   * @param frame The number of the frame
+   */
+  void prefetch(int frame);
+
+  /**
+   * Wait for the background read (if any) to finish.
+   */
+  void wait();
+
+  /**
+   * Let the operating system drop a frame from memory. Its values are
+   * kept in the file, and are read back when they are next used.
+   *
+   * @param frame The number of the frame
+   */
+  void release(int frame);
+
+ private:
+
+  /** read every page of a frame, on the prefetch thread */
+  static void * read_frame(void * store);
+
+  FrameStore(const FrameStore &);
+  FrameStore & operator=(const FrameStore &);
+
+};
+
+#endif
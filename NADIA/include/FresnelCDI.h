@@ -215,6 +215,19 @@ class FresnelCDI: public BaseCDI{
 
   const Complex_2D & get_illumination_at_sample();
 
+  /**
+   * As BaseCDI::get_state_arrays(), but the illumination and
+   * propagation coefficients are included as well.
+   */
+  virtual void get_state_arrays(std::vector<Complex_2D*> & complex_arrays,
+				std::vector<Double_2D*> & real_arrays);
+
+  /**
+   * As BaseCDI::release_workspace(), but the array used by the
+   * transmission constraint is freed as well.
+   */
+  virtual void release_workspace();
+
 
 
   /**  double refine_sample_to_focal_length(double min=0, double max=0,
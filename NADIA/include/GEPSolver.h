@@ -0,0 +1,158 @@
+// Copyright 2012 T'Mir Julius for The ARC Centre of Excellence in
+// Coherent X-ray Science. This program is distributed under the GNU
+// General Public License. We also ask that you cite this software in
+// publications where you made use of it for any part of the data
+// analysis.
+
+/**
+ * @file GEPSolver.h
+ * @class GEPSolver
+ *
+ * @brief Solves the generalised eigenproblem JC=nSC used to split a
+ * partially coherent beam into modes, and keeps the solutions.
+ *
+ * The problem is solved with LAPACK (zhegv, or the divide and
+ * conquer version zhegvd for large matrices). The LAPACK workspace
+ * is sized by a workspace query and put on the heap, so any number
+ * of modes can be used.
+ *
+ * The eigenvectors and eigenvalues only depend on the number of
+ * Legendre polynomials, the number of modes and the coherence
+ * lengths. PartialCDI stores each solution with add_solution() and
+ * looks for it with find_solution() before solving, so calling
+ * PartialCDI::set_threshold(), or making many PartialCDI objects
+ * with the same coherence, doesn't repeat the work. The most recent
+ * solutions are kept for the whole process.
+ *
+ * All methods are static and thread-safe.
+ */
+
+#ifndef GEP_SOLVER_H
+#define GEP_SOLVER_H
+
+#include <map>
+#include <list>
+#include <vector>
+#include <pthread.h>
+#include <Complex_2D.h>
+
+class GEPSolver{
+
+  /** The parameters which identify a solution */
+  struct SolutionKey{
+    int nleg;
+    int nmode;
+    double lcx;
+    double lcy;
+
+    bool operator<(const SolutionKey & rhs) const{
+      if(nleg!=rhs.nleg) return nleg < rhs.nleg;
+      if(nmode!=rhs.nmode) return nmode < rhs.nmode;
+      if(lcx!=rhs.lcx) return lcx < rhs.lcx;
+      return lcy < rhs.lcy;
+    };
+  };
+
+  /** The eigenvectors (in fortran order, real and imaginary parts
+      interleaved) and the eigenvalues */
+  struct Solution{
+    int size;
+    std::vector<double> vectors;
+    std::vector<double> eigen;
+  };
+
+  /** the solutions kept so far */
+  static std::map<SolutionKey,Solution> solutions;
+
+  /** the order the solutions were added in, oldest first */
+  static std::list<SolutionKey> solution_order;
+
+  /** the largest number of solutions kept */
+  static unsigned int max_solutions;
+
+  /** the size of matrix from which zhegvd is used */
+  static int divide_and_conquer_size;
+
+  /** protects the members above */
+  static pthread_mutex_t mutex;
+
+ public:
+
+  /**
+   * Solve A x = n B x, where A and B are Hermitian and B is positive
+   * definite. Only the lower triangles are read.
+   *
+   * @param A The matrix A. It is replaced by the eigenvectors, one
+   * in each y column.
+   * @param B The matrix B. It is replaced by its Cholesky factor.
+   * @param eigen The eigenvalues, in ascending order, are added to
+   * the end of this.
+   * @return SUCCESS, or FAILURE if the matrices are the wrong size or
+   * LAPACK could not solve the problem (A, B and eigen are then left
+   * as they are).
+   */
+  static int solve(Complex_2D & A, Complex_2D & B,
+		   std::vector<double> & eigen);
+
+  /**
+   * Look for a solution which was added with add_solution().
+   *
+   * @param nleg The number of Legendre polynomials
+   * @param nmode The number of modes
+   * @param lcx The coherence length in x
+   * @param lcy The coherence length in y
+   * @param vectors Filled with the eigenvectors if the solution is
+   * found. It must already be the size of the problem.
+   * @param eigen The eigenvalues are added to the end of this if the
+   * solution is found.
+   * @return true if the solution was found
+   */
+  static bool find_solution(int nleg, int nmode, double lcx, double lcy,
+			    Complex_2D & vectors,
+			    std::vector<double> & eigen);
+
+  /**
+   * Keep a solution, so it can be found with find_solution(). The
+   * oldest solution is dropped once there are too many.
+   *
+   * @param nleg The number of Legendre polynomials
+   * @param nmode The number of modes
+   * @param lcx The coherence length in x
+   * @param lcy The coherence length in y
+   * @param vectors The eigenvectors
+   * @param eigen The eigenvalues
+   */
+  static void add_solution(int nleg, int nmode, double lcx, double lcy,
+			   const Complex_2D & vectors,
+			   const std::vector<double> & eigen);
+
+  /**
+   * Set the size of matrix from which the divide and conquer solver
+   * (zhegvd) is used. It is quicker for large problems, but needs
+   * more workspace. The default is 100.
+   *
+   * @param size The matrix size. 0 always uses zhegvd, and a very
+   * large number never does.
+   */
+  static void set_divide_and_conquer_size(int size);
+
+  /**
+   * Set the largest number of solutions to keep. The default is 16.
+   *
+   * @param n The number of solutions
+   */
+  static void set_max_solutions(unsigned int n);
+
+  /**
+   * Get the number of solutions being kept.
+   */
+  static int get_size();
+
+  /**
+   * Drop all the solutions being kept.
+   */
+  static void clear();
+
+};
+
+#endif
@@ -0,0 +1,191 @@
+// Copyright 2011 Nadia Davidson for The ARC Centre of Excellence in
+// Coherent X-ray Science. This program is distributed under the GNU
+// General Public License. We also ask that you cite this software in
+// publications where you made use of it for any part of the data
+// analysis.
+
+/**
+ * @file GaussianFilter.h
+ * @class GaussianFilter
+ *
+ * @brief Convolution of a 2D array with a (separable) Gaussian.
+ *
+ * Gaussian blurring is used to soften the support, in the shrinkwrap
+ * algorithm, and to model partial coherence in PartialCharCDI (where
+ * it is done many times per iteration while fitting the coherence
+ * lengths). This class provides three ways of doing it and chooses
+ * the quickest one for the width of the Gaussian and the size of the
+ * array:
+ * - DIRECT: the array is convolved with the sampled Gaussian, first
+ *   along y and then along x. The cost grows with the width of the
+ *   kernel, so this is used for kernels of up to
+ *   GAUSSIAN_DIRECT_MAX_TAPS points.
+ * - FOURIER: the array is zero padded and multiplied by the fourier
+ *   transform of the kernel, using real-to-complex fftw plans. The
+ *   transforms of the kernels are cached, so repeated filtering with
+ *   the same width (as in PartialCharCDI) only costs two transforms,
+ *   whatever the width. This gives the same result as DIRECT, and is
+ *   used for wider kernels.
+ * - RECURSIVE: the recursive (IIR) filter of Young and van Vliet
+ *   (Signal Processing 44 (1995) 139-151). The cost does not depend
+ *   on the width and no padding is needed, but the kernel is not
+ *   truncated and its shape is only approximately Gaussian (to about
+ *   3% of the peak). It is used when the kernel is wider than the
+ *   array, where the padding for FOURIER would be largest.
+ *
+ * In all cases the array is treated as if it were surrounded by
+ * zeros, and the kernel is normalised to sum to one. The kernel is
+ * cut off at kernel_size_in_std_dev standard deviations from its
+ * centre (except by RECURSIVE).
+ *
+ * All methods are static and thread-safe.
+ */
+
+#ifndef GAUSSIAN_FILTER_H
+#define GAUSSIAN_FILTER_H
+
+#include <map>
+#include <vector>
+#include <pthread.h>
+#include <Double_2D.h>
+
+/** kernels with at most this many points (in both directions) are
+    applied directly */
+#define GAUSSIAN_DIRECT_MAX_TAPS 31
+
+/** the smallest standard deviation (in pixels) the recursive filter
+    is used for */
+#define GAUSSIAN_RECURSIVE_MIN_SIGMA 2.0
+
+/** the recursive filter doesn't truncate the kernel, so it is only
+    used when the requested kernel is at least this many standard
+    deviations from the centre */
+#define GAUSSIAN_RECURSIVE_MIN_SIZE 3.0
+
+/** the most kernel transforms kept by the FOURIER method */
+#define GAUSSIAN_CACHE_SIZE 64
+
+class GaussianFilter{
+
+  /** A key which identifies the transform of a 1D kernel */
+  struct KernelKey{
+    int n;
+    int radius;
+    double sigma;
+
+    bool operator<(const KernelKey & rhs) const{
+      if(n!=rhs.n) return n < rhs.n;
+      if(radius!=rhs.radius) return radius < rhs.radius;
+      return sigma < rhs.sigma;
+    };
+  };
+
+  /** the kernel transforms made so far */
+  static std::map<KernelKey, std::vector<double> > kernels;
+
+  /** protects "kernels" */
+  static pthread_mutex_t mutex;
+
+  static void apply_direct(Double_2D & array, double sigma_x,
+			   double sigma_y, int radius_x, int radius_y);
+
+  static void apply_recursive(Double_2D & array, double sigma_x,
+			      double sigma_y);
+
+  static void apply_fourier(Double_2D & array, double sigma_x,
+			    double sigma_y, int radius_x, int radius_y);
+
+ public:
+
+  /** the ways the convolution can be done (see the class
+      description) */
+  enum method_type {AUTO, DIRECT, RECURSIVE, FOURIER};
+
+  /**
+   * Convolve an array with a Gaussian.
+   *
+   * @param input The array to blur
+   * @param result The blurred array. This must be the same size as
+   * "input", and may be the same array.
+   * @param sigma_x The standard deviation of the Gaussian along x
+   * (the first index) in pixels. 0 means no blurring along x.
+   * @param sigma_y The standard deviation along y (the second index)
+   * @param kernel_size_in_std_dev How many standard deviations from
+   * the centre the kernel extends.
+   * @param type AUTO to choose the quickest method, or one of DIRECT,
+   * RECURSIVE or FOURIER.
+   */
+  static void apply(const Double_2D & input, Double_2D & result,
+		    double sigma_x, double sigma_y,
+		    double kernel_size_in_std_dev=3.0, int type=AUTO);
+
+  /**
+   * Get the method apply() would use with type=AUTO.
+   *
+   * @param nx The size of the array in x
+   * @param ny The size of the array in y
+   * @param sigma_x The standard deviation along x in pixels
+   * @param sigma_y The standard deviation along y in pixels
+   * @param kernel_size_in_std_dev How many standard deviations from
+   * the centre the kernel extends.
+   * @return DIRECT, RECURSIVE or FOURIER
+   */
+  static int choose_method(int nx, int ny, double sigma_x,
+			   double sigma_y, double kernel_size_in_std_dev);
+
+  /**
+   * Get the sampled, normalised Gaussian used by the DIRECT and
+   * FOURIER methods.
+   *
+   * @param sigma The standard deviation in pixels
+   * @param radius The number of points either side of the centre
+   * @return The 2*radius+1 values of the kernel
+   */
+  static std::vector<double> get_kernel(double sigma, int radius);
+
+  /**
+   * Get the discrete fourier transform of the kernel from
+   * get_kernel(), centred on the first point of an array of n
+   * points. The kernel is symmetric, so the transform is real.
+   *
+   * @param n The number of points to transform over
+   * @param sigma The standard deviation in pixels
+   * @param radius The number of points either side of the centre
+   * @return The n values of the transform. Only the first n/2+1 are
+   * needed for a half spectrum.
+   */
+  static std::vector<double> get_kernel_transform(int n, double sigma,
+						  int radius);
+
+  /**
+   * As get_kernel_transform(), but the transform is kept in a cache
+   * shared with the FOURIER method, so it is only made once for each
+   * size, width and radius.
+   *
+   * @param n The number of points to transform over
+   * @param sigma The standard deviation in pixels
+   * @param radius The number of points either side of the centre
+   * @return The n values of the transform
+   */
+  static std::vector<double> get_cached_kernel_transform(int n,
+							 double sigma,
+							 int radius);
+
+  /**
+   * Get the number of points either side of the centre of a kernel.
+   *
+   * @param sigma The standard deviation in pixels
+   * @param kernel_size_in_std_dev How many standard deviations from
+   * the centre the kernel extends.
+   * @return The radius of the kernel in pixels
+   */
+  static int get_radius(double sigma, double kernel_size_in_std_dev);
+
+  /**
+   * Remove all the cached kernel transforms.
+   */
+  static void clear();
+
+};
+
+#endif
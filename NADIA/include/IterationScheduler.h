@@ -0,0 +1,141 @@
+// Copyright 2011 Nadia Davidson for The ARC Centre of Excellence in
+// Coherent X-ray Science. This program is distributed under the GNU
+// General Public License. We also ask that you cite this software in
+// publications where you made use of it for any part of the data
+// analysis.
+
+/**
+ * @file IterationScheduler.h
+ * @class IterationScheduler
+ *
+ * @brief Decides when to stop or change a reconstruction from the
+ * trend of the error.
+ *
+ * A reconstruction is normally run for a fixed number of iterations
+ * of each algorithm, even if the error stopped improving long
+ * before. An IterationScheduler is given the error after each
+ * iteration (BaseCDI::get_error()) and says what to do next:
+ * <ul>
+ * <li>CONTINUE - carry on with the current algorithm.</li>
+ * <li>APPLY_SHRINKWRAP - the error has reached a plateau, so update
+ * the support with BaseCDI::apply_shrinkwrap() and carry on. This is
+ * only done set_plateau_shrinkwraps() times per algorithm.</li>
+ * <li>NEXT_ALGORITHM - the error has reached a plateau (and no more
+ * shrinkwraps are allowed), or it has diverged. Move on to the next
+ * algorithm, e.g. from HIO to ER.</li>
+ * <li>STOP - the error is below the target. Stop the
+ * reconstruction.</li>
+ * </ul>
+ *
+ * The error is on a plateau when the lowest error has improved by
+ * less than a fraction "tolerance" over the last "window"
+ * iterations. The lowest error is used, rather than the current
+ * one, as algorithms like HIO don't reduce the error every
+ * iteration. The error has diverged when it is more than
+ * "divergence_factor" times the lowest error seen with the current
+ * algorithm, or is not a finite number.
+ *
+ * Each check is off until it is set, so by default update() always
+ * returns CONTINUE. start_algorithm() should be called when the
+ * algorithm is changed, and reset() whenever something else makes
+ * the error jump (e.g. a shrinkwrap which was not asked for by the
+ * scheduler).
+ *
+ * An example of its use can be found in tools/CDI_reconstruction.c.
+ */
+
+#ifndef ITERATION_SCHEDULER_H
+#define ITERATION_SCHEDULER_H
+
+#include <vector>
+
+class IterationScheduler{
+
+  /** the plateau window in iterations (0 for off) */
+  int window;
+
+  /** the fractional improvement expected over the window */
+  double tolerance;
+
+  /** the divergence factor (0 for off) */
+  double divergence_factor;
+
+  /** the error to stop at (0 for off) */
+  double target_error;
+
+  /** the number of shrinkwraps allowed per algorithm on plateaus */
+  int plateau_shrinkwraps;
+
+  /** the lowest error after each iteration since the last reset */
+  std::vector<double> lowest_error;
+
+  /** the number of plateau shrinkwraps with this algorithm */
+  int shrinkwraps;
+
+ public:
+
+  /** what to do after an iteration (see the class description) */
+  enum { CONTINUE, APPLY_SHRINKWRAP, NEXT_ALGORITHM, STOP };
+
+  /**
+   * Constructor. All the checks are off.
+   */
+  IterationScheduler();
+
+  /**
+   * Turn on plateau detection.
+   *
+   * @param window The number of iterations over which the
+   * improvement is measured. 0 turns plateau detection off.
+   * @param tolerance The error is on a plateau if the lowest error
+   * has dropped by less than this fraction over the window.
+   */
+  void set_plateau(int window, double tolerance=0.01);
+
+  /**
+   * Turn on the divergence guard.
+   *
+   * @param factor The error has diverged if it is more than this
+   * many times the lowest error with the current algorithm. 0 turns
+   * the guard off.
+   */
+  void set_divergence_factor(double factor);
+
+  /**
+   * Stop once the error is at or below "error".
+   *
+   * @param error The target error, or 0 for no target.
+   */
+  void set_target_error(double error);
+
+  /**
+   * Set how many times a plateau may trigger a shrinkwrap with each
+   * algorithm, before it moves on to the next algorithm instead. By
+   * default no shrinkwraps are asked for.
+   *
+   * @param n The number of shrinkwraps.
+   */
+  void set_plateau_shrinkwraps(int n);
+
+  /**
+   * Give the error from the last iteration and get what to do next.
+   *
+   * @param error The error, from BaseCDI::get_error()
+   * @return CONTINUE, APPLY_SHRINKWRAP, NEXT_ALGORITHM or STOP
+   */
+  int update(double error);
+
+  /**
+   * Forget the error history, e.g. after a shrinkwrap.
+   */
+  void reset();
+
+  /**
+   * Forget the error history and the number of shrinkwraps. This
+   * should be called when the algorithm is changed.
+   */
+  void start_algorithm();
+
+};
+
+#endif
@@ -0,0 +1,114 @@
+// Copyright 2011 Nadia Davidson for The ARC Centre of Excellence in
+// Coherent X-ray Science. This program is distributed under the GNU
+// General Public License. We also ask that you cite this software in
+// publications where you made use of it for any part of the data
+// analysis.
+
+/**
+ * @file Parallel.h
+ *
+ * @brief Settings for the multi-threaded parts of the library.
+ *
+ * When the library is built with --enable-threads, the fourier
+ * transforms use the multi-threaded fftw routines and the loops over
+ * whole arrays (scaling, adding, the support and modulus
+ * constraints etc.) are shared between threads using OpenMP. The
+ * number of threads used for both can be changed at any time with
+ * nadia::set_num_threads(), so the same build can be used on a
+ * workstation and on a cluster node. Without --enable-threads
+ * everything runs on a single thread and these functions have no
+ * effect.
+ *
+ * The number of threads is chosen in this order:
+ * - the last call to nadia::set_num_threads(),
+ * - the NADIA_NUM_THREADS environment variable,
+ * - the number of threads OpenMP would use (which can be set with
+ *   OMP_NUM_THREADS), i.e. the number of processors by default.
+ *
+ * Complex_2D and the reconstruction classes (BaseCDI) can also be
+ * given their own thread count, which is used in place of the
+ * library setting. This lets several reconstructions run at the same
+ * time, each with a share of the processors.
+ *
+ * Loops over arrays with fewer than NADIA_PARALLEL_MIN_SIZE elements
+ * are always run on one thread, since starting the threads would
+ * take longer than the loop itself.
+ *
+ * Inside the library a loop is made parallel with:
+ * <br><kbd>NADIA_OMP(parallel for NADIA_OMP_CLAUSES(n))</kbd>
+ * <br>where n is the number of elements the loop touches, or with
+ * NADIA_OMP_CLAUSES_WITH(n,threads) to give the thread count.
+ * NADIA_OMP() is used rather than \#pragma omp so that, without
+ * --enable-threads, the directive and its clauses (and so the thread
+ * count) are left out altogether.
+ */
+
+#ifndef NADIA_PARALLEL_H
+#define NADIA_PARALLEL_H
+
+/** an OpenMP directive, e.g. NADIA_OMP(parallel for). It is left
+    out when the library is built without OpenMP. */
+#ifdef _OPENMP
+#define NADIA_OMP(directive) NADIA_PRAGMA(omp directive)
+#define NADIA_PRAGMA(text) _Pragma(#text)
+#else
+#define NADIA_OMP(directive)
+#endif
+
+/** the smallest number of array elements worth using threads for */
+#define NADIA_PARALLEL_MIN_SIZE 16384
+
+/** the OpenMP clauses used to start "threads" threads for an array
+    of size n */
+#define NADIA_OMP_PARALLEL_CLAUSES_WITH(n,threads) \
+  if((n) >= NADIA_PARALLEL_MIN_SIZE) num_threads(threads)
+
+/** the OpenMP clauses used to start threads for an array of size n */
+#define NADIA_OMP_PARALLEL_CLAUSES(n) \
+  NADIA_OMP_PARALLEL_CLAUSES_WITH(n,nadia::get_num_threads())
+
+/** the OpenMP clauses used for the array loops */
+#define NADIA_OMP_CLAUSES_WITH(n,threads) \
+  NADIA_OMP_PARALLEL_CLAUSES_WITH(n,threads) schedule(static)
+
+/** the OpenMP clauses used for the array loops */
+#define NADIA_OMP_CLAUSES(n) \
+  NADIA_OMP_PARALLEL_CLAUSES(n) schedule(static)
+
+namespace nadia{
+
+  /**
+   * Set the number of threads used by the fourier transforms and the
+   * array operations. This can be called at any time. Fourier
+   * transforms of a size which has not been used with this number of
+   * threads before will need a new fftw plan.
+   *
+   * @param n The number of threads. Values less than 1 are treated
+   * as 1.
+   */
+  void set_num_threads(int n);
+
+  /**
+   * Get the number of threads used by the fourier transforms and the
+   * array operations. See the description at the top of this file
+   * for how the default is chosen.
+   *
+   * @return The number of threads.
+   */
+  int get_num_threads();
+
+  /**
+   * Get the number of threads an object should use, given its own
+   * setting.
+   *
+   * @param requested The number of threads set for the object, or 0
+   * (or less) if none was set.
+   * @return "requested" if it was set, otherwise get_num_threads().
+   */
+  inline int get_num_threads(int requested){
+    return requested > 0 ? requested : get_num_threads();
+  }
+
+}
+
+#endif
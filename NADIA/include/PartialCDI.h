@@ -31,13 +31,45 @@ protected:
 
 
   /**
-   * A vector holding a pointer to each of the FresnelCDI/PlanarCDI objects */
-  std::vector<Complex_2D> singleCDI;
+   * A vector holding each mode with the transmission function
+   * applied. The modes are views of single_memory, where they are
+   * stored one after the other, so that they can be propagated
+   * together with one fftw plan (see FFTWPlanCache::get_many_plan). */
+  std::vector<Complex_2D *> singleCDI;
+  FFTW_COMPLEX * single_memory;
 
   /**
    * A vector holding the initial wave described as a series of modes.*/
   std::vector<Complex_2D> singlemode;
 
+  /**
+   * The modes after each of the projections in iterate() (the PFS,
+   * PF, PS and PSF terms). Like singleCDI, they are kept from one
+   * iteration to the next, so the arrays are only made again when
+   * the modes or the algorithm change (see
+   * reallocate_mode_workspace()), and each set is stored in one
+   * block of memory. */
+  std::vector<Complex_2D *> temp_modes_PFS;
+  std::vector<Complex_2D *> temp_modes_PF;
+  std::vector<Complex_2D *> temp_modes_PS;
+  std::vector<Complex_2D *> temp_modes_PSF;
+  FFTW_COMPLEX * pfs_memory;
+  FFTW_COMPLEX * pf_memory;
+  FFTW_COMPLEX * ps_memory;
+  FFTW_COMPLEX * psf_memory;
+
+  /** The intensity summed over the modes (see sum_intensity()) */
+  Double_2D mode_intensity;
+
+  /**
+   * Whether the modes are propagated one at a time (see
+   * set_lean_modes()). singleCDI and the temp_modes then only hold
+   * the dominant mode, and the other modes pass through
+   * lean_scratch. */
+  bool lean;
+  std::vector<Complex_2D *> lean_scratch;
+  FFTW_COMPLEX * lean_memory;
+
   /** A vector holding the weighting function for each frame */  
   std::vector<Double_2D * > weights; 
 
@@ -180,6 +212,20 @@ public:
    */
   void set_threshold(double new_threshold);
 
+  /**
+   * Choose how the modes are held during the reconstruction. By
+   * default every mode is kept at the detector, so they can be
+   * propagated together. In lean mode each mode is propagated on its
+   * own, its weighted intensity is added to the total, and the array
+   * is reused for the next mode. Only the dominant mode, which is the
+   * one propagated back to the sample, is kept. This needs memory for
+   * a few modes rather than all of them, at the cost of the batched
+   * transform.
+   *
+   * @param lean_modes true to hold only the dominant mode
+   */
+  void set_lean_modes(bool lean_modes);
+
 private:
 
   /**
@@ -187,7 +233,8 @@ private:
    * of the partially coherent wave where JC=nSC where
    * H = integral(P*l(r1)J(r1, r2)Pm(r2)) dr1 dr2 and 
    * S=integral(P*l(r)pm(r))dr where Pl is an orhtonormal
-   * basis set, in this case, the Legendre polynomials
+   * basis set, in this case, the Legendre polynomials.
+   * The program exits if the eigenproblem can't be solved.
    */
   void initialise_matrices(int leg, int modes);
 
@@ -233,7 +280,7 @@ private:
    * 
    * @param c The Complex_2d to be scaled
    */
-  void scale_intensity(std::vector<Complex_2D> & c);
+  void scale_intensity(std::vector<Complex_2D *> & c);
 
   /**
    * for scaling the transmission
@@ -241,9 +288,13 @@ private:
   //  void scale_intensity(Complex_2D & c);
 
   /**
-   * add the intensities across all modes 
+   * add the intensities across all modes, weighted by their
+   * eigenvalues. This is one pass over the modes.
+   *
+   * @param c The modes
+   * @return The sum, which is kept in mode_intensity
    */
-  Double_2D sum_intensity(std::vector<Complex_2D> & c);
+  Double_2D & sum_intensity(std::vector<Complex_2D *> & c);
 
   /**
    * calculate the transmission function by dividing 
@@ -273,6 +324,86 @@ private:
    */
   void fill_modes(Complex_2D & c);
 
+  /**
+   * Make sure singleCDI holds an array for each mode, and that the
+   * temp_modes arrays needed by the current algorithm exist (the
+   * others are freed). Nothing is allocated if the arrays are already
+   * the right size, so this is cheap to call every iteration.
+   */
+  void reallocate_mode_workspace();
+
+  /**
+   * Make "stack" hold "n" arrays, stored one after the other in
+   * "memory". Nothing is done if it already has "n" arrays.
+   */
+  void allocate_stack(std::vector<Complex_2D *> & stack,
+		      FFTW_COMPLEX * & memory, unsigned int n);
+
+  /** free the arrays and memory of a stack */
+  void free_stack(std::vector<Complex_2D *> & stack,
+		  FFTW_COMPLEX * & memory);
+
+  /**
+   * Fill singleCDI with the modes multiplied by the transmission
+   * function. The checkerboard which centres the forward transform
+   * (see Complex_2D::checkerboard()) can be applied in the same pass.
+   *
+   * @param centre Whether to apply the checkerboard
+   * @return true if the checkerboard was applied (it can't be for
+   * odd sized arrays).
+   */
+  bool transmit_modes(bool centre);
+
+  /**
+   * The generic algorithm code of iterate() for lean mode (see
+   * set_lean_modes()).
+   */
+  void iterate_lean();
+
+  /**
+   * Multiply one mode by the transmission function, as in
+   * transmit_modes().
+   *
+   * @param mode The mode
+   * @param c The array to fill
+   * @param centre Whether to apply the checkerboard
+   * @return true if the checkerboard was applied
+   */
+  bool transmit_mode(int mode, Complex_2D & c, bool centre);
+
+  /**
+   * Propagate the modes to the detector one at a time for lean mode
+   * (see set_lean_modes()), and add up their weighted intensities in
+   * mode_intensity. Only the dominant mode is kept.
+   *
+   * @param dominant The array which is left holding the dominant
+   * mode at the detector
+   * @param support Whether to apply the support to the modes before
+   * propagating them
+   * @return mode_intensity
+   */
+  Double_2D & propagate_modes_lean(Complex_2D & dominant, bool support);
+
+  /**
+   * Scale the dominant mode at the detector to the measured
+   * intensity, given the intensity summed over the modes. The sum is
+   * changed to its square root.
+   */
+  void scale_intensity(Complex_2D & dominant, Double_2D & intensity);
+
+  /**
+   * Propagate every array of a stack to the detector with one
+   * batched transform.
+   *
+   * @param stack The arrays
+   * @param memory The memory they are stored in
+   * @param centred true if the checkerboard has already been applied
+   * (see transmit_modes()).
+   */
+  void propagate_stack_to_detector(std::vector<Complex_2D *> & stack,
+				   FFTW_COMPLEX * memory,
+				   bool centred=false);
+
 };
 
 
@@ -12,6 +12,7 @@
 #include <BaseCDI.h>
 #include <utils.h>
 #include <map>
+#include <vector>
 
 // Initial guess for coherence-spread (measured in pixels)
 #define DEFAULT_INITIAL_LX 0.7
@@ -20,7 +21,8 @@
 #define DEFAULT_MINIMA_SEARCH_BOUNDS_COEFFICIENT 2.5 // Use ([current_estimate]/[this], [current_estimate] * [this]) as the search interval for the energy-minimising beam coherence value
 #define DEFAULT_MINIMA_SEARCH_TOLERANCE 0.1 // Tolerated error in finding the energy-minimising coherence values
 #define DEFAULT_MINIMA_MOVING_AVERAGE_WEIGHT 0.01 // The minima will be updated to be: this*new_measurement + (1-this)*last_value
-#define DEFAULT_MINIMA_RECALCULATION_INTERVAL 5 // The minima will be updated once every [this many] generations
+#define DEFAULT_MINIMA_RECALCULATION_INTERVAL 1 // The minima will be updated once every [this many] generations
+#define MINIMA_SEARCH_MAX_ROUNDS 4 // lx and ly are fitted together by searching in each in turn, at most this many times
 
 #define MIN_SEARCH_LBOUND 0.2 // Don't bother searching near zero where the gaussian is delta-fn-like
 #define MIN_SEARCH_RBOUND 1.0 // Don't let the search region get too small
@@ -57,10 +59,6 @@ class PartialCharCDI:public BaseCDI {
     
     void scale_intensity(Complex_2D & c); // Scale the magnitude of the complex estimate using a convolution of estimate intensity
 
-    // Allow these MathFunctions to access convoluted_estimate_error externally:
-    friend class error_in_lx;
-    friend class error_in_ly;
-
   protected:
     /**
      * Last calculated coherence lengths.
@@ -79,6 +77,7 @@ class PartialCharCDI:public BaseCDI {
     double px_y_size;
 
     Double_2D measured_intensity; // Un-square-rooted detector intensity - needed for measuring gaussian convolution error
+    Complex_2D measured_spectrum; // The (half) fourier transform of measured_intensity, used to fit lx and ly
     
   private:
     unsigned int iteration; // Count of the number of iterations in the scale_intensity function (to know when to reevaluate lx and ly)
@@ -88,14 +87,14 @@ class PartialCharCDI:public BaseCDI {
     double minima_search_tolerance; // Precision to which lx and ly are calculated
     double minima_moving_average_weight; // A running average will be used to estimate lx and ly. Each new update will be weighted at this fraction.
     
-    Double_2D get_convoluted_intensity_estimate(Double_2D const & estimated_intensity, Double_2D const & measured_intensity);
+    Double_2D get_convoluted_intensity_estimate(Double_2D const & estimated_intensity);
     
     /**
      * Take the integral over the absolute difference between the measured_intensity and the convolution of estimated_intesity
      * and a gaussian of standard deviations lx and ly in x and y directions respectivley.
      *
-     * This is a measure for how accurate the estimate is given known coherence lengths lx and ly. It is used internally to
-     * automatically fit for lx and ly (by minimising its value in lx and ly) every few iterations.
+     * This is a measure for how accurate the estimate is given known coherence lengths lx and ly. The fit of lx and ly
+     * uses the (much cheaper) squared difference from SpectralCoherenceError instead.
      *
      * This call is quite expensive.
      */
@@ -107,52 +106,76 @@ class PartialCharCDI:public BaseCDI {
  * Tools for finding minima of lx and ly:
  */
 
+/**
+ * The squared difference between the measured intensity and the
+ * estimated intensity convolved with a gaussian, as a function of
+ * the standard deviations lx and ly:
+ *
+ *   sum |M - G(lx,ly)*E|^2
+ *
+ * By Parseval's theorem this is the same sum over the fourier
+ * transforms, where the convolution is a product. The transforms of
+ * M and E are only made once, and the three terms |M|^2, Re(M* E)
+ * and |E|^2 are stored. The gaussian is separable, so each (lx, ly)
+ * only costs a multiply and add over the (half) spectrum, rather than
+ * a full convolution. Values are cached, so the minima search can
+ * ask for the same point more than once for free.
+ *
+ * The convolution is treated as periodic. The intensity is small at
+ * the edge of a diffraction pattern, so this makes little difference.
+ */
+class SpectralCoherenceError {
+  public:
+      /**
+       * @param measured_spectrum The transform of the measured
+       * intensity, from Complex_2D::perform_forward_fft_real().
+       * @param estimated_intensity The estimated intensity
+       */
+      SpectralCoherenceError(Complex_2D const & measured_spectrum, Double_2D const & estimated_intensity);
+
+      /** the error for the gaussian with standard deviations lx
+          (along the second index) and ly (along the first) */
+      double call(double lx, double ly);
+
+  private:
+      int nx;
+      int ny;
+      int ny_half;
+
+      // sum over the spectrum of |M|^2
+      double measured_term;
+
+      // 2*Re(conj(M)E) and |E|^2 at each point of the half spectrum,
+      // weighted by the number of times the point appears in the full
+      // spectrum.
+      std::vector<double> cross_term;
+      std::vector<double> estimate_term;
+
+      std::map<std::pair<double,double>, double> cache;
+};
+
 class error_in_lx : public MathFunction {
-  // convoluted_estimate_error as a function only of lx (with caching)
+  // The spectral error as a function only of lx
   public:
-      error_in_lx(Double_2D const & measured_intensity, Double_2D const & estimated_intensity, double ly) : estimated_intensity_(estimated_intensity), measured_intensity_(measured_intensity), ly_(ly) {
-        cache.clear();
-      }
+      error_in_lx(SpectralCoherenceError & error, double ly) : error_(error), ly_(ly) {}
       virtual double call(double lx){
-        double result;
-        if(cache.find(lx) == cache.end()){ // Cache the expensive call
-          result = PartialCharCDI::convoluted_estimate_error(measured_intensity_, estimated_intensity_, lx, ly_);
-          cache[lx] = result;
-        } else{
-          result = cache[lx];
-        }
-
-        return result;
+        return error_.call(lx, ly_);
       }
   private:
+          SpectralCoherenceError & error_;
           double ly_;
-          Double_2D const & estimated_intensity_;
-          Double_2D const & measured_intensity_;
-          std::map<double, double> cache;
 };
 
 class error_in_ly : public MathFunction {
-  // convoluted_estimate_error as a function only of ly (with caching)
+  // The spectral error as a function only of ly
   public:
-      error_in_ly(Double_2D const & measured_intensity, Double_2D const & estimated_intensity, double lx) : estimated_intensity_(estimated_intensity), measured_intensity_(measured_intensity), lx_(lx) {
-        cache.clear();
-      }
+      error_in_ly(SpectralCoherenceError & error, double lx) : error_(error), lx_(lx) {}
       virtual double call(double ly){
-        double result;
-        if(cache.find(ly) == cache.end()){ // Cache the expensive call
-          result = PartialCharCDI::convoluted_estimate_error(measured_intensity_, estimated_intensity_, lx_, ly);
-          cache[ly] = result;
-        } else{
-          result = cache[ly];
-        }
-
-        return result;
+        return error_.call(lx_, ly);
       }
   private:
+          SpectralCoherenceError & error_;
           double lx_;
-          Double_2D const & estimated_intensity_;
-          Double_2D const & measured_intensity_;
-          std::map<double, double> cache;
 };
 
 #endif
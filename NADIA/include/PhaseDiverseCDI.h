@@ -88,6 +88,10 @@
 
 
 #include <BaseCDI.h>
+#include <TiledComplex_2D.h>
+#include <FrameStore.h>
+#include <map>
+#include <string>
 #include <vector>
 
 //forward declarations
@@ -117,8 +121,13 @@ class PhaseDiverseCDI{
   double gamma;
   std::vector<double> alpha;
 
-  /** The current estimate of the 'global' sample function */
-  Complex_2D * object;
+  /** The current estimate of the 'global' sample function. Only the
+      tiles under the frames are stored (see TiledComplex_2D). */
+  TiledComplex_2D * object;
+
+  /** A dense copy of the 'global' sample function, made by
+      get_transmission() */
+  Complex_2D * dense_object;
 
   /** The number of iterations to perform for each 'local' frame */
   int iterations_per_cycle;
@@ -128,6 +137,10 @@ class PhaseDiverseCDI{
       i.e. 2 allows alignment to within half a pixel. */
   int scale;
 
+  /** The positions of the sub-pixel points within a 'local' pixel
+      when scale>1, made in the constructor. */
+  std::vector<double> sub_pos;
+
   /** The size in x and y of the 'global' sample function. */
   int nx,ny;
   
@@ -142,6 +155,32 @@ class PhaseDiverseCDI{
   /** a flag indicating whether the weights need to be recalculated */
   bool weights_set;
 
+  /** for each pixel of the 'global' object, 1 if some frame has a
+      non-zero weight there and 0 otherwise. Like the object, this is
+      kept in tiles (row-major, TiledComplex_2D::TILE_SIZE square),
+      keyed by the position of the tile's first pixel, and only the
+      tiles under the frames are made. It is remade with the weights,
+      so whenever the frames or their positions change. */
+  std::map<std::pair<int,int>, std::vector<unsigned char> > covered;
+
+  /** whether "covered" matches the current object tiles */
+  bool coverage_set;
+
+  /** the number of threads used in parallel mode, or 0 for the
+      library setting (see Parallel.h) */
+  int num_threads;
+
+  /** whether the frames are kept in a scratch file (see
+      set_frame_streaming()) */
+  bool stream_frames;
+
+  /** the directory for the scratch file, or empty for the default */
+  std::string scratch_directory;
+
+  /** the scratch file holding the frames, once it has been made. 
+      Frame n of the store is frame n of the reconstruction. */
+  FrameStore * frame_store;
+
  public:
 
   enum {CROSS_CORRELATION,MINIMUM_ERROR};
@@ -217,6 +256,59 @@ class PhaseDiverseCDI{
     iterations_per_cycle = iterations;
   }
 
+  /**
+   * Set the number of threads used in parallel mode. The frames are
+   * independent until they are merged, so in parallel mode they are
+   * iterated at the same time, one frame per thread. Each thread takes
+   * the next frame as soon as it finishes one, so frames which take
+   * longer don't hold up the others. While this happens the threads
+   * are split between the frames (see BaseCDI::set_num_threads), and
+   * afterwards the frames go back to the library setting. The merge
+   * into the 'global' object is also shared between the threads.
+   * This has no effect in series mode, or if the library was built
+   * without --enable-threads.
+   *
+   * @param n The number of threads, or 0 (the default) to use the
+   * library setting (see Parallel.h).
+   */
+  void set_num_threads(int n){
+    num_threads = n < 0 ? 0 : n;
+  }
+
+  /**
+   * Keep the frames in a memory-mapped scratch file rather than in
+   * memory (see FrameStore), so that scans with more frames than fit
+   * in memory can be reconstructed. Each frame's arrays (its
+   * estimate, support, intensity, illumination etc.) are moved into
+   * the file when it is added with add_new_position(), and any which
+   * the frame makes later are moved after it is first iterated. The
+   * temporary arrays used by an iteration are freed after each
+   * frame. In series mode the next frame is read in the background
+   * while the current one is iterated.
+   *
+   * Call this before adding the frames. Note that the frames can't be
+   * used once the PhaseDiverseCDI is destroyed or remove_positions()
+   * is called, unless streaming is turned off first, which moves the
+   * frames back into memory.
+   *
+   * @param stream true to stream the frames, false to keep them in
+   * memory (the default).
+   * @param directory The directory for the scratch file. By default
+   * $TMPDIR or /tmp is used, but these are often tmpfs, which keeps
+   * the file in memory (or swap) and so saves nothing. Give a
+   * directory on a disk.
+   */
+  void set_frame_streaming(bool stream, const char * directory=0);
+
+  /**
+   * Get the size of the scratch file used for frame streaming.
+   *
+   * @return The number of bytes, or 0 if frames aren't streamed.
+   */
+  size_t get_scratch_size() const{
+    return frame_store ? frame_store->get_size() : 0;
+  }
+
   /**
    * Set the feed-back parameter.
    *
@@ -250,10 +342,46 @@ class PhaseDiverseCDI{
   /**
    * This function allows you to access the 'global' sample function.
    *
+   * The 'global' sample function is stored sparsely, so the array
+   * returned is a dense copy which is refreshed on each call. Changes
+   * to it do not affect the reconstruction (use set_transmission()).
+   *
    * @return The current estimate of either the transmission (for
    * FresnelCDI) or exit-surface-wave (for PlanarCDI)
    */
   Complex_2D * get_transmission();
+
+  /**
+   * Check whether the 'global' sample function exists yet. It is
+   * made by initialise_estimate() or set_transmission(). This is
+   * cheaper than testing get_transmission(), which makes a dense copy.
+   *
+   * @return true if there is a 'global' sample function
+   */
+  bool has_transmission() const{
+    return object!=0;
+  };
+
+  /**
+   * Get the size in x of the 'global' sample function, without making
+   * the dense copy that get_transmission() returns.
+   *
+   * @return The number of pixels in x, or 0 if there is no 'global'
+   * sample function yet.
+   */
+  int get_size_x() const{
+    return nx;
+  };
+
+  /**
+   * Get the size in y of the 'global' sample function. See
+   * get_size_x().
+   *
+   * @return The number of pixels in y
+   */
+  int get_size_y() const{
+    return ny;
+  };
   
 
 
@@ -361,6 +489,46 @@ class PhaseDiverseCDI{
    */
   void add_to_object(int n_probe);
 
+  /**
+   * As add_to_object(int), but only the rows i_begin to i_end-1 of
+   * the 'global' object are changed and the result of the frame
+   * (single_result) must already be up to date. This lets several
+   * threads merge the frames at once, each into its own rows.
+   *
+   * @param n_probe The local frame number.
+   * @param i_begin The first row of the object to change.
+   * @param i_end One past the last row to change.
+   */
+  void add_to_object(int n_probe, int i_begin, int i_end);
+
+  /**
+   * Do the 'small' iterations of every frame for parallel mode,
+   * sharing the frames between threads.
+   */
+  void iterate_frames();
+
+  /**
+   * Merge the frames into the 'global' object for parallel mode,
+   * with each thread merging into its own band of rows.
+   */
+  void merge_frames();
+
+  /**
+   * With frame streaming, move any arrays of a frame which are not in
+   * the scratch file yet into it, free the frame's temporary arrays,
+   * and let its memory go. The frame is added to the scratch file if
+   * it isn't there already.
+   *
+   * @param n_probe The frame
+   */
+  void stream_out_frame(int n_probe);
+
+  /**
+   * Move the frames out of the scratch file back into memory, and
+   * remove the file.
+   */
+  void stream_in_frames();
+
   /**
    * Update a 'local' frame result from the 'global' object.
    *
@@ -392,9 +560,16 @@ class PhaseDiverseCDI{
    * This function is used to reallocate memory for the 'global'
    * sample object. It is only used when add_new_position is called,
    * in the case that the frame does not fit within the bounds of the
-   * current object array.
+   * current object array. The values already in the object are kept.
+   *
+   * @param new_nx The new size in x
+   * @param new_ny The new size in y
+   * @param shift_x The number of pixels the old values are moved
+   * in x, for growing the object towards negative x.
+   * @param shift_y See shift_x
    */
-  void reallocate_object_memory(int new_nx, int new_ny);
+  void reallocate_object_memory(int new_nx, int new_ny,
+				int shift_x=0, int shift_y=0);
 
   /**
    * This function is used during reconstruction in parallel mode. It
@@ -420,6 +595,15 @@ class PhaseDiverseCDI{
    */
   void set_up_weights();
 
+  /**
+   * Work out which pixels of the 'global' object are covered by a
+   * frame (see "covered"). Only the pixels under each frame are
+   * checked, so this costs about the total area of the frames rather
+   * than the object area times the number of frames. It is called by
+   * set_up_weights().
+   */
+  void update_coverage();
+
   /**
    * A position alignment function. See "adjust_positions" above for more detail.
    *
@@ -23,10 +23,38 @@
 
 class PlanarCDI : public BaseCDI{
 
+ protected:
+
+  /** whether the modulus projection is done between uncentred
+      transforms (see set_fused_projection) */
+  bool fused_projection;
+
  public:
 
  PlanarCDI(Complex_2D & complex, unsigned int n_best=0)
-   :BaseCDI(complex,n_best){};
+   :BaseCDI(complex,n_best),
+    fused_projection(true){};
+
+  /**
+   * Turn the fused modulus projection on or off. When it is on
+   * (the default), the projection onto the measured intensity does
+   * not centre the transformed field. Instead the centring and
+   * scaling are folded into the modulus constraint, which reads the
+   * measured intensity in fft order. This removes two passes over
+   * the array from each projection. The result is the same either
+   * way. Arrays with odd dimensions always use the unfused
+   * projection.
+   *
+   * Note that subclasses which override scale_intensity() should
+   * turn this off.
+   *
+   * @param fused true to turn the fused projection on.
+   */
+  void set_fused_projection(bool fused){
+    fused_projection = fused;
+  };
+
+  virtual void project_intensity(Complex_2D & c);
   
   /**
    * Get the autocorrelation function of the intensity data.
@@ -41,6 +69,17 @@ class PlanarCDI : public BaseCDI{
 
   virtual void propagate_from_detector(Complex_2D & c);
 
+ protected:
+
+  /**
+   * Fill "c" with random numbers inside the support, as
+   * initialise_estimate() does for the estimate.
+   *
+   * @param c The array to fill
+   * @param seed The seed for the random number generator
+   */
+  void fill_random_estimate(Complex_2D & c, int seed);
+
 };
 
 
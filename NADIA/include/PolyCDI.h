@@ -78,6 +78,10 @@ protected:
   /** The calculated intensity at the detector */
   Double_2D intensity_sqrt_calc;
 
+  /** A padded copy of the estimate, which is reused for the
+      projection to the detector each iteration */
+  Complex_2D padded;
+
   double lambdac;
 
   /** The matrices describing the source properties.*/
@@ -127,6 +131,15 @@ public:
    */
   void scale_intensity(Complex_2D & c);
 
+  /**
+   * Apply the intensity constraint. The estimate is padded (see
+   * expand_wl()) before it is propagated to the detector, and the
+   * padding is removed again afterwards.
+   *
+   * @param c The complex field to apply the intensity constraint on
+   */
+  void project_intensity(Complex_2D & c);
+
   /* expand wavelengths from central wavelength 
      */
   void expand_wl(Complex_2D & c);
@@ -0,0 +1,167 @@
+// Copyright 2011 Nadia Davidson for The ARC Centre of Excellence in
+// Coherent X-ray Science. This program is distributed under the GNU
+// General Public License. We also ask that you cite this software in
+// publications where you made use of it for any part of the data
+// analysis.
+
+/**
+ * @file Profiler.h
+ * @class Profiler
+ *
+ * @brief Times and counts the stages of an iteration.
+ *
+ * Each reconstruction (BaseCDI) keeps a Profiler, which can be read
+ * with BaseCDI::get_profile(). For each stage of an iteration it
+ * holds the number of times the stage was run and the total time it
+ * took. The stages are:
+ * <ul>
+ * <li>PROPAGATE_TO_DETECTOR - propagate_to_detector()</li>
+ * <li>SCALE_INTENSITY - the modulus constraint, scale_intensity()</li>
+ * <li>PROPAGATE_FROM_DETECTOR - propagate_from_detector()</li>
+ * <li>APPLY_SUPPORT - apply_support(), including any transmission
+ * constraint</li>
+ * <li>TRANSMISSION_CONSTRAINT - the transmission (complex)
+ * constraint on its own</li>
+ * <li>UPDATE_N_BEST - keeping the best estimates</li>
+ * <li>COMBINE - combining the projections for the generic
+ * algorithm (HIO etc.)</li>
+ * <li>ITERATE - the whole of iterate()</li>
+ * </ul>
+ * Note that the stages may be inside one another, so the times do
+ * not add up to the ITERATE time.
+ *
+ * The timers are only compiled in when the library is built with
+ * --enable-profiling (which defines NADIA_PROFILING). Otherwise the
+ * NADIA_PROFILE macro is empty, the counters stay at zero and
+ * is_enabled() returns false, so there is no cost to the iterations.
+ *
+ * A stage is timed from a line to the end of the enclosing scope
+ * with:
+ * <br><kbd>NADIA_PROFILE(profile, Profiler::SCALE_INTENSITY);</kbd>
+ */
+
+#ifndef NADIA_PROFILER_H
+#define NADIA_PROFILER_H
+
+#include <iostream>
+
+class Profiler{
+
+ public:
+
+  /** the stages which are timed (see the class description) */
+  enum { PROPAGATE_TO_DETECTOR, SCALE_INTENSITY,
+	 PROPAGATE_FROM_DETECTOR, APPLY_SUPPORT,
+	 TRANSMISSION_CONSTRAINT, UPDATE_N_BEST, COMBINE, ITERATE,
+	 N_STAGES };
+
+ private:
+
+  /** the total time in seconds for each stage */
+  double total_time[N_STAGES];
+
+  /** the number of times each stage was run */
+  long calls[N_STAGES];
+
+ public:
+
+  /**
+   * Constructor. All the counters are zero.
+   */
+  Profiler();
+
+  /**
+   * Set all the counters to zero.
+   */
+  void reset();
+
+  /**
+   * Add a run of a stage.
+   *
+   * @param stage The stage, e.g. Profiler::COMBINE
+   * @param seconds How long it took
+   */
+  void add(int stage, double seconds){
+    total_time[stage] += seconds;
+    calls[stage]++;
+  }
+
+  /**
+   * Get the total time spent in a stage.
+   *
+   * @param stage The stage, e.g. Profiler::COMBINE
+   * @return The time in seconds
+   */
+  double get_time(int stage) const;
+
+  /**
+   * Get the number of times a stage was run.
+   *
+   * @param stage The stage, e.g. Profiler::COMBINE
+   * @return The number of calls
+   */
+  long get_calls(int stage) const;
+
+  /**
+   * Get the name of a stage, e.g. "scale_intensity".
+   *
+   * @param stage The stage, e.g. Profiler::COMBINE
+   * @return The name
+   */
+  static const char * get_name(int stage);
+
+  /**
+   * Print a table of the number of calls, the total time and the
+   * time per call of each stage which was run.
+   *
+   * @param out The stream to print to
+   */
+  void print(std::ostream & out) const;
+
+  /**
+   * Whether the library was built with the timers.
+   *
+   * @return true if NADIA_PROFILING was defined
+   */
+  static bool is_enabled();
+
+  /**
+   * The time in seconds from an arbitrary start.
+   */
+  static double now();
+
+};
+
+/**
+ * Adds the time between its construction and destruction to a stage
+ * of a Profiler. Use it through NADIA_PROFILE.
+ */
+class ProfilerTimer{
+
+  Profiler & profile;
+  int stage;
+  double start;
+
+ public:
+
+  ProfilerTimer(Profiler & profile, int stage)
+    : profile(profile), stage(stage), start(Profiler::now()){};
+
+  ~ProfilerTimer(){
+    profile.add(stage, Profiler::now()-start);
+  };
+
+};
+
+#define NADIA_PROFILE_NAME2(line) nadia_profile_timer_##line
+#define NADIA_PROFILE_NAME(line) NADIA_PROFILE_NAME2(line)
+
+#ifdef NADIA_PROFILING
+/** time "stage" until the end of the scope */
+#define NADIA_PROFILE(profile, stage) \
+  ProfilerTimer NADIA_PROFILE_NAME(__LINE__)(profile, stage)
+#else
+#define NADIA_PROFILE(profile, stage)
+#endif
+
+#endif
@@ -0,0 +1,313 @@
+// Copyright 2011 Nadia Davidson for The ARC Centre of Excellence in
+// Coherent X-ray Science. This program is distributed under the GNU
+// General Public License. We also ask that you cite this software in
+// publications where you made use of it for any part of the data
+// analysis.
+
+/**
+ * @file TiledComplex_2D.h
+ * @class TiledComplex_2D
+ *
+ * @brief A large 2-dimensional array of complex numbers which only
+ * stores the parts which are used.
+ *
+ * The array is split into square tiles of TILE_SIZE x TILE_SIZE
+ * elements. A tile is only allocated when a value different from the
+ * "fill" value is written into it; until then every element of the
+ * tile reads as the fill value. This is used by PhaseDiverseCDI to
+ * hold the 'global' sample function of a scan, where the fill value
+ * is the transmission of empty space (1), and only the area under
+ * the frames needs memory.
+ *
+ * The array can be grown in any direction (see resize()) without
+ * moving the values which are already stored, since only the table
+ * of tiles changes. A dense copy can be made with get_dense().
+ *
+ * Reading is thread-safe. Writing to different elements from
+ * different threads is also safe, as long as the tiles being written
+ * to have been allocated first (with allocate()), as allocating a
+ * tile is not.
+ */
+
+#ifndef TILED_COMPLEX_2D_H
+#define TILED_COMPLEX_2D_H
+
+#include <vector>
+#include <math.h>
+#include <types.h>
+#include <Complex_2D.h>
+
+class TiledComplex_2D{
+
+ public:
+
+  /** log2 of the tile size */
+  enum { TILE_BITS = 6 };
+
+  /** the width and height of a tile */
+  enum { TILE_SIZE = 1 << TILE_BITS };
+
+ private:
+
+  /** nx/ny are number of samplings in x/y */
+  int nx, ny;
+
+  /** the position of element (0,0) in the grid of tiles. This lets
+      the array grow towards negative x and y without moving the
+      tiles. */
+  int offset_x, offset_y;
+
+  /** the number of tiles in x and y in the grid */
+  int tiles_x, tiles_y;
+
+  /** the tiles, indexed by tile_x*tiles_y+tile_y. 0 for tiles
+      which haven't been allocated */
+  std::vector<FFTW_COMPLEX *> tiles;
+
+  /** the value of the elements in tiles which aren't allocated */
+  FFTW_REAL fill_real, fill_imag;
+
+ public:
+
+  /**
+   * Constructor that creates an array with the given dimensions.
+   * No memory is used for the values until they are set.
+   *
+   * @param x_size The number of samples in x
+   * @param y_size The number of samples in y
+   * @param fill_real The real part of the initial value of all the
+   * elements. By default this is 1.
+   * @param fill_imag The imaginary part of the initial value of all
+   * the elements. By default this is 0.
+   */
+  TiledComplex_2D(int x_size, int y_size,
+		  double fill_real=1, double fill_imag=0);
+
+  /**
+   * Copy constructor. The allocated tiles are copied.
+   */
+  TiledComplex_2D(const TiledComplex_2D & object);
+
+  /**
+   * Assignment operator. The allocated tiles are copied.
+   */
+  TiledComplex_2D & operator=(const TiledComplex_2D & rhs);
+
+  /**
+   * Destructor
+   */
+  ~TiledComplex_2D();
+
+  /**
+   * Set the real component at the position (x,y). Setting an
+   * element outside the array does nothing. If the tile holding
+   * (x,y) isn't allocated and "value" is the fill value, no memory
+   * is allocated.
+   *
+   * @param x The x position
+   * @param y The y position
+   * @param value The value which will be set
+   */
+  inline void set_real(int x, int y, FFTW_REAL value){
+    FFTW_COMPLEX * element = get_element(x, y, value==fill_real);
+    if(element)
+      (*element)[REAL] = value;
+  }
+
+  /**
+   * Set the imaginary component at the position (x,y). See
+   * set_real().
+   *
+   * @param x The x position
+   * @param y The y position
+   * @param value The value which will be set
+   */
+  inline void set_imag(int x, int y, FFTW_REAL value){
+    FFTW_COMPLEX * element = get_element(x, y, value==fill_imag);
+    if(element)
+      (*element)[IMAG] = value;
+  }
+
+  /**
+   * Get the real component at the position (x,y). Elements outside
+   * the array, or in tiles which aren't allocated, return the fill
+   * value.
+   *
+   * @param x The x position
+   * @param y The y position
+   * @return The real value
+   */
+  inline FFTW_REAL get_real(int x, int y) const{
+    const FFTW_COMPLEX * element = find_element(x, y);
+    return element ? (*element)[REAL] : fill_real;
+  }
+
+  /**
+   * Get the imaginary component at the position (x,y). See
+   * get_real().
+   *
+   * @param x The x position
+   * @param y The y position
+   * @return The imaginary value
+   */
+  inline FFTW_REAL get_imag(int x, int y) const{
+    const FFTW_COMPLEX * element = find_element(x, y);
+    return element ? (*element)[IMAG] : fill_imag;
+  }
+
+  /**
+   * Get the magnitude at the position (x,y).
+   *
+   * @param x The x position
+   * @param y The y position
+   * @return The magnitude
+   */
+  inline FFTW_REAL get_mag(int x, int y) const{
+    FFTW_REAL r = get_real(x, y);
+    FFTW_REAL i = get_imag(x, y);
+    return sqrt(r*r + i*i);
+  }
+
+  /**
+   * Get the size in x.
+   *
+   * @return The number of samples in x
+   */
+  inline int get_size_x() const{
+    return nx;
+  }
+
+  /**
+   * Get the size in y.
+   *
+   * @return The number of samples in y
+   */
+  inline int get_size_y() const{
+    return ny;
+  }
+
+  /**
+   * Change the size of the array. The values already stored are
+   * kept (none are moved in memory), and the new elements have the
+   * fill value. Tiles which end up entirely outside the array are
+   * freed.
+   *
+   * @param x_size The new number of samples in x
+   * @param y_size The new number of samples in y
+   * @param shift_x The old element (x,y) becomes the new element
+   * (x+shift_x,y+shift_y). This is used to grow the array towards
+   * negative x.
+   * @param shift_y See shift_x
+   */
+  void resize(int x_size, int y_size, int shift_x=0, int shift_y=0);
+
+  /**
+   * Allocate the tiles which cover the elements from (x_min,y_min)
+   * to (x_max-1,y_max-1), so that they can be written to by several
+   * threads at once. The region is clipped to the array.
+   */
+  void allocate(int x_min, int x_max, int y_min, int y_max);
+
+  /**
+   * Set every element back to the fill value. The tiles stay
+   * allocated, so they can still be written to by several threads.
+   */
+  void clear();
+
+  /**
+   * Copy the values from another array of the same size.
+   *
+   * @param c The array to copy
+   */
+  void copy(const TiledComplex_2D & c);
+
+  /**
+   * Copy the values from a dense array of the same size. Only the
+   * tiles with a value different from the fill value are allocated.
+   *
+   * @param c The array to copy
+   */
+  void copy(const Complex_2D & c);
+
+  /**
+   * Copy all the values into a dense array of the same size.
+   *
+   * @param result The array to fill.
+   */
+  void get_dense(Complex_2D & result) const;
+
+  /**
+   * Get the number of tiles which have been allocated.
+   *
+   * @return The number of tiles
+   */
+  int get_allocated_tiles() const;
+
+  /**
+   * Get the position of the first element of each allocated tile.
+   * Tiles at the edges can reach outside the array, so the positions
+   * may be negative, and the elements of a tile must be clipped to
+   * the array before they are used.
+   *
+   * @param x Filled with the x positions
+   * @param y Filled with the y positions
+   */
+  void get_tile_origins(std::vector<int> & x, std::vector<int> & y) const;
+
+  /**
+   * Get the x position of the first element of the tile holding
+   * column x. This lets other tiled data be laid out on the same
+   * tiles as this array.
+   *
+   * @param x The x position
+   * @return The x position of the tile
+   */
+  inline int get_tile_origin_x(int x) const{
+    return (((x + offset_x) >> TILE_BITS) << TILE_BITS) - offset_x;
+  }
+
+  /**
+   * As get_tile_origin_x(), for y.
+   *
+   * @param y The y position
+   * @return The y position of the tile
+   */
+  inline int get_tile_origin_y(int y) const{
+    return (((y + offset_y) >> TILE_BITS) << TILE_BITS) - offset_y;
+  }
+
+ private:
+
+  /** free all the tiles and empty the grid */
+  void free_tiles();
+
+  /** the element at (x,y), or 0 if it isn't stored */
+  inline const FFTW_COMPLEX * find_element(int x, int y) const{
+    if(x < 0 || y < 0 || x >= nx || y >= ny)
+      return 0;
+    int gx = x + offset_x;
+    int gy = y + offset_y;
+    const FFTW_COMPLEX * tile =
+      tiles[(gx >> TILE_BITS)*tiles_y + (gy >> TILE_BITS)];
+    if(!tile)
+      return 0;
+    return tile + (((gx & (TILE_SIZE-1)) << TILE_BITS)
+		   | (gy & (TILE_SIZE-1)));
+  }
+
+  /** the element at (x,y) for writing. The tile is allocated if
+      needed, unless "fill_value" is true. 0 is returned if nothing
+      should be written. */
+  inline FFTW_COMPLEX * get_element(int x, int y, bool fill_value){
+    FFTW_COMPLEX * element = (FFTW_COMPLEX *) find_element(x, y);
+    if(element || fill_value || x < 0 || y < 0 || x >= nx || y >= ny)
+      return element;
+    return allocate_element(x, y);
+  }
+
+  /** allocate the tile holding (x,y) and return the element */
+  FFTW_COMPLEX * allocate_element(int x, int y);
+
+};
+
+#endif
@@ -5,10 +5,16 @@
 #ifndef DOUBLE_PRECISION
 #define FFTW_PLAN fftwf_plan
 #define FFTW_COMPLEX fftwf_complex
+#define FFTW_REAL float
 #define FFTW_EXECUTE fftwf_execute
+#define FFTW_EXECUTE_DFT fftwf_execute_dft
+#define FFTW_EXECUTE_DFT_R2C fftwf_execute_dft_r2c
+#define FFTW_EXECUTE_DFT_C2R fftwf_execute_dft_c2r
+#define FFTW_ALIGNMENT_OF(x) fftwf_alignment_of((float*)(x))
 #define FFTW_PLAN_WITH_NTHREADS fftwf_plan_with_nthreads
 #define FFTW_INIT_THREADS fftwf_init_threads
 #define FFTW_PLAN_DFT_2D fftwf_plan_dft_2d
+#define FFTW_PLAN_MANY_DFT fftwf_plan_many_dft
 #define FFTW_PLAN_DFT_R2C_2D fftwf_plan_dft_r2c_2d
 #define FFTW_PLAN_DFT_C2R_2D fftwf_plan_dft_c2r_2d
 #define FFTW_MPI_INIT fftwf_mpi_init
@@ -17,15 +23,23 @@
 #define FFTW_MPI_EXECUTE_DFT fftwf_mpi_execute_dft
 #define FFTW_DESTROY_PLAN fftwf_destroy_plan
 #define FFTW_MALLOC fftwf_malloc
+#define FFTW_IMPORT_WISDOM_FROM_FILENAME fftwf_import_wisdom_from_filename
+#define FFTW_EXPORT_WISDOM_TO_FILENAME fftwf_export_wisdom_to_filename
 #define FFTW_FREE fftwf_free
 #define MPI_MYREAL MPI_FLOAT
 #else //DOUBLE
 #define FFTW_PLAN fftw_plan
 #define FFTW_COMPLEX fftw_complex
+#define FFTW_REAL double
 #define FFTW_EXECUTE fftw_execute
-#define FFTW_PLAN_WITH_NTHREADs fftw_plan_with_nthreads
+#define FFTW_EXECUTE_DFT fftw_execute_dft
+#define FFTW_EXECUTE_DFT_R2C fftw_execute_dft_r2c
+#define FFTW_EXECUTE_DFT_C2R fftw_execute_dft_c2r
+#define FFTW_ALIGNMENT_OF(x) fftw_alignment_of((double*)(x))
+#define FFTW_PLAN_WITH_NTHREADS fftw_plan_with_nthreads
 #define FFTW_INIT_THREADS fftw_init_threads
 #define FFTW_PLAN_DFT_2D fftw_plan_dft_2d
+#define FFTW_PLAN_MANY_DFT fftw_plan_many_dft
 #define FFTW_PLAN_DFT_R2C_2D fftw_plan_dft_r2c_2d
 #define FFTW_PLAN_DFT_C2R_2D fftw_plan_dft_c2r_2d
 #define FFTW_MPI_INIT fftw_mpi_init
@@ -34,6 +48,8 @@
 #define FFTW_MPI_EXECUTE_DFT fftw_mpi_execute_dft
 #define FFTW_DESTROY_PLAN fftw_destroy_plan
 #define FFTW_MALLOC fftw_malloc
+#define FFTW_IMPORT_WISDOM_FROM_FILENAME fftw_import_wisdom_from_filename
+#define FFTW_EXPORT_WISDOM_TO_FILENAME fftw_export_wisdom_to_filename
 #define FFTW_FREE fftw_free
 #define MPI_MYREAL MPI_DOUBLE
 #endif //DOUBLE_PRECISION
@@ -1053,7 +1053,7 @@ void check_pd_trans(){
 
   check_pd();
 
-  if(phaseDiv && phaseDiv->get_transmission()==0){
+  if(phaseDiv && !phaseDiv->has_transmission()){
     IDL_Message(IDL_M_GENERIC, IDL_MSG_INFO,
 	"ERROR: trying to use phase diverse functions before adding frames.");
     exit(0);
@@ -1153,12 +1153,12 @@ extern "C" void IDL_phase_diverse_iterate(int argc, void * argv[]){
 //Allows the dimensions of the image to be passed back to the IDL code
 extern "C" IDL_LONG IDL_get_phase_diverse_array_x_size(int argc, void *argv[]){
   check_pd_trans();
-  return phaseDiv->get_transmission()->get_size_x();
+  return phaseDiv->get_size_x();
 }
 
 extern "C" IDL_LONG IDL_get_phase_diverse_array_y_size(int argc, void *argv[]){
   check_pd_trans();
-  return phaseDiv->get_transmission()->get_size_y();
+  return phaseDiv->get_size_y();
 }
 
 
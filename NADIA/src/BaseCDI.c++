@@ -7,6 +7,8 @@
 #include "TransmissionConstraint.h"
 #include "io.h" 
 #include "types.h"
+#include "Parallel.h"
+#include "GaussianFilter.h"
 
 using namespace std;
 
@@ -52,6 +54,10 @@ BaseCDI::BaseCDI(Complex_2D & initial_guess, unsigned int n_best)
   //initialize the beam-stop mask to null (not in use)
   beam_stop=0;
 
+  intensity_sqrt_fft_order=0;
+  beam_stop_fft_order=0;
+  fft_order_valid=false;
+
   temp_complex_PFS = 0;
   temp_complex_PF = 0;
   temp_complex_PS = 0;
@@ -77,6 +83,43 @@ BaseCDI::~BaseCDI(){
   for(int n=0; n < NTERMS; n++)
     algorithm_structure[n]=0;
   reallocate_temp_complex_memory();
+
+  if(beam_stop)
+    delete beam_stop;
+  if(intensity_sqrt_fft_order)
+    delete intensity_sqrt_fft_order;
+  if(beam_stop_fft_order)
+    delete beam_stop_fft_order;
+}
+
+void BaseCDI::get_state_arrays(vector<Complex_2D*> & complex_arrays,
+			       vector<Double_2D*> & real_arrays){
+
+  complex_arrays.push_back(&complex);
+  for(int i=0; i<n_best; i++)
+    complex_arrays.push_back(best_array[i]);
+
+  real_arrays.push_back(&support);
+  real_arrays.push_back(&intensity_sqrt);
+  if(beam_stop)
+    real_arrays.push_back(beam_stop);
+  if(intensity_sqrt_fft_order)
+    real_arrays.push_back(intensity_sqrt_fft_order);
+  if(beam_stop_fft_order)
+    real_arrays.push_back(beam_stop_fft_order);
+}
+
+void BaseCDI::release_workspace(){
+  Complex_2D ** temp_array[NTERMS-1] = {&temp_complex_PSF, 
+					&temp_complex_PFS, 
+					&temp_complex_PS, 
+					&temp_complex_PF};
+  for(int n=0; n < NTERMS-1; n++){
+    if(*(temp_array[n])){
+      delete *(temp_array[n]);
+      *(temp_array[n])=0;
+    }
+  }
 }
 
 Complex_2D * BaseCDI::get_best_result(double & error, int index){
@@ -112,7 +155,13 @@ void BaseCDI::set_support(const Double_2D & object_support, bool soften){
 void BaseCDI::set_beam_stop(const Double_2D & beam_stop_region){
   if(beam_stop==0)
     beam_stop = new Double_2D(nx, ny);
-  beam_stop->copy(beam_stop_region);
+  //store the mask as 0s and 1s so it can be used without branching.
+  for(int i=0; i< nx; i++){
+    for(int j=0; j< ny; j++){
+      beam_stop->set(i,j,beam_stop_region.get(i,j)>0 ? 1 : 0);
+    }
+  }
+  fft_order_valid=false;
 }
 
 void BaseCDI::set_intensity(const Double_2D &detector_intensity){
@@ -121,6 +170,7 @@ void BaseCDI::set_intensity(const Double_2D &detector_intensity){
       intensity_sqrt.set(i,j,sqrt(detector_intensity.get(i,j)));
     }
   }
+  fft_order_valid=false;
 }
 
 double BaseCDI::get_error(){
@@ -128,34 +178,51 @@ double BaseCDI::get_error(){
 }
 
 void BaseCDI::apply_support(Complex_2D & c){
+  NADIA_PROFILE(profile, Profiler::APPLY_SUPPORT);
   support_constraint(c);
-  if(transmission_constraint)
+  if(transmission_constraint){
+    NADIA_PROFILE(profile, Profiler::TRANSMISSION_CONSTRAINT);
     transmission_constraint->apply_constraint(c);
+  }
 }
 
-void BaseCDI::support_constraint(Complex_2D & c){
-  double support_value;
+bool BaseCDI::support_is_mask(){
+  return transmission_constraint==0;
+}
 
-  for(int i=0; i< nx; i++){
-    for(int j=0; j< ny; j++){
+void BaseCDI::support_constraint(Complex_2D & c){
+  support_constraint(c, support);
+}
 
-      support_value = support.get(i,j);
-      if(support_value == 0){
-	c.set_real(i,j,0);
-	c.set_imag(i,j,0);
-      }
-      else if(support_value < 1){
-	c.set_real(i,j,c.get_real(i,j) * support_value);
-	c.set_imag(i,j,c.get_imag(i,j) * support_value);
-      }
-    }
+void BaseCDI::support_constraint(Complex_2D & c, const Double_2D & mask){
+
+  //points outside the support are set to zero and points where the
+  //support is soft (between 0 and 1) are scaled down. The support
+  //value is clamped to 1 rather than branching, so the compiler can
+  //vectorise this loop.
+  const int n = nx*ny;
+  FFTW_COMPLEX * values = c.get_array();
+  const Double_2D::value_type * support_values = mask.get_array();
+  NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(n,c.get_num_threads()))
+  for(int k=0; k < n; ++k){
+    Double_2D::value_type factor =
+      support_values[k] < 1 ? support_values[k] : 1;
+    values[k][REAL] *= factor;
+    values[k][IMAG] *= factor;
   }
 
 }
 
 void BaseCDI::project_intensity(Complex_2D & c){
-  propagate_to_detector(c);
-  scale_intensity(c);
+  {
+    NADIA_PROFILE(profile, Profiler::PROPAGATE_TO_DETECTOR);
+    propagate_to_detector(c);
+  }
+  {
+    NADIA_PROFILE(profile, Profiler::SCALE_INTENSITY);
+    scale_intensity(c);
+  }
+  NADIA_PROFILE(profile, Profiler::PROPAGATE_FROM_DETECTOR);
   propagate_from_detector(c);
 }
 
@@ -163,29 +230,56 @@ void BaseCDI::project_intensity(Complex_2D & c){
 void BaseCDI::scale_intensity(Complex_2D & c){
   double norm2_mag=0;
   double norm2_diff=0;
-  double current_int_sqrt=0;
-  double current_mag=0;
 
+  c.project_modulus(intensity_sqrt, beam_stop, norm2_mag, norm2_diff);
+
+  current_error = (norm2_diff/norm2_mag);
+  
+}
+
+
+void BaseCDI::update_fft_order_arrays(){
+
+  if(intensity_sqrt_fft_order==0)
+    intensity_sqrt_fft_order = new Double_2D(nx,ny);
+
+  if(beam_stop && beam_stop_fft_order==0)
+    beam_stop_fft_order = new Double_2D(nx,ny);
+
+  //element (i,j) of an uncentred transform is element
+  //(i+nx/2,j+ny/2) of the centred one.
   for(int i=0; i< nx; i++){
+    int i_centred = (i+nx/2)%nx;
     for(int j=0; j< ny; j++){
-
-      //reset the magnitude
-      if(beam_stop==0 || beam_stop->get(i,j)>0){
-	
-	current_int_sqrt=intensity_sqrt.get(i,j);
-	current_mag=c.get_mag(i,j);
-	
-	c.set_mag(i,j,current_int_sqrt);
-      
-	//calculate the error
-	norm2_mag += current_int_sqrt*current_int_sqrt;
-	norm2_diff += (current_mag-current_int_sqrt)
-	  *(current_mag-current_int_sqrt);
-      }
+      int j_centred = (j+ny/2)%ny;
+      intensity_sqrt_fft_order->set(i,j,intensity_sqrt.get(i_centred,
+							    j_centred));
+      if(beam_stop)
+	beam_stop_fft_order->set(i,j,beam_stop->get(i_centred,j_centred));
     }
   }
+
+  fft_order_valid=true;
+}
+
+void BaseCDI::scale_intensity_fft_order(Complex_2D & c){
+
+  if(!fft_order_valid)
+    update_fft_order_arrays();
+
+  //the factor which propagate_to_detector() would have applied.
+  //It is applied again to the result to account for
+  //propagate_from_detector().
+  double scale = 1.0/sqrt((double)nx*ny);
+
+  double norm2_mag=0;
+  double norm2_diff=0;
+
+  c.project_modulus(*intensity_sqrt_fft_order, beam_stop_fft_order,
+		    norm2_mag, norm2_diff, 0, 0, scale, scale);
+
   current_error = (norm2_diff/norm2_mag);
-  
+
 }
 
 
@@ -247,6 +341,12 @@ void BaseCDI::set_custom_algorithm(double m1, double m2, double m3,
   algorithm_structure[PS] = -m3 - m6 - m8 + m10;
   algorithm_structure[PF] = -m2 - m5 + m8 + m9;
   algorithm_structure[PI] = -m4 - m7 - m9 - m10;
+
+  combine_coefficients[0] = 1 + algorithm_structure[PI];
+  combine_coefficients[1] = algorithm_structure[PF];
+  combine_coefficients[2] = algorithm_structure[PFS];
+  combine_coefficients[3] = algorithm_structure[PS];
+  combine_coefficients[4] = algorithm_structure[PSF];
   
   reallocate_temp_complex_memory();
 
@@ -256,6 +356,15 @@ void BaseCDI::set_custom_algorithm(double m1, double m2, double m3,
 
 void BaseCDI::reallocate_temp_complex_memory(){
 
+  //temp_complex_PF is used for both the PF and PSF terms.
+  //temp_complex_PS and temp_complex_PSF are only made when
+  //iterate() needs them, but are freed here if they are not used.
+  bool needed[NTERMS-1];
+  needed[PSF] = false;
+  needed[PFS] = algorithm_structure[PFS]!=0;
+  needed[PS] = false;
+  needed[PF] = algorithm_structure[PF]!=0 || algorithm_structure[PSF]!=0;
+
   Complex_2D ** temp_array[NTERMS-1] = {&temp_complex_PSF, 
 					&temp_complex_PFS, 
 					&temp_complex_PS, 
@@ -263,13 +372,14 @@ void BaseCDI::reallocate_temp_complex_memory(){
     
   for(int n=0; n < NTERMS-1; n++){
     
-    if(algorithm_structure[n]==0 && *(temp_array[n])!=0){
+    if(algorithm_structure[n]==0 && !needed[n] && *(temp_array[n])!=0){
       delete *(temp_array[n]);
       *(temp_array[n])=0;  
     }
 
-    if(algorithm_structure[n]!=0 && *(temp_array[n])==0)
-      *(temp_array[n])=new Complex_2D(nx,ny);
+    //copy "complex" so the fftw and thread settings are the same.
+    if(needed[n] && *(temp_array[n])==0)
+      *(temp_array[n])=new Complex_2D(complex);
   }
 
 }
@@ -296,6 +406,8 @@ void BaseCDI::print_algorithm(){
 
 int BaseCDI::iterate(){
 
+  NADIA_PROFILE(profile, Profiler::ITERATE);
+
   //below is the code for the special case of ER
   //this is faster than using the generic algorithm code
   //further down in this function.
@@ -310,76 +422,57 @@ int BaseCDI::iterate(){
 
   //start of the generic algorithm code
 
+  //the temporary arrays may have been freed by release_workspace()
+  if(!temp_complex_PF && !temp_complex_PFS)
+    reallocate_temp_complex_memory();
+
+  //if the support is just a mask, the Ps and PsPf terms are
+  //formed while the terms are combined, rather than in their own
+  //arrays.
+  bool mask = support_is_mask();
+
   //PFS
   if(algorithm_structure[PFS]!=0){
-    temp_complex_PFS->copy(complex);
-    apply_support(*temp_complex_PFS);
+    if(mask)
+      temp_complex_PFS->copy(complex,support);
+    else{
+      temp_complex_PFS->copy(complex);
+      apply_support(*temp_complex_PFS);
+    }
     project_intensity(*temp_complex_PFS);
   }
 
-  //F
-  if(algorithm_structure[PF]!=0){
+  //F (which is also needed for SF)
+  if(algorithm_structure[PF]!=0 || algorithm_structure[PSF]!=0){
     temp_complex_PF->copy(complex);
     project_intensity(*temp_complex_PF);
   }
-  
-  //S
-  if(algorithm_structure[PS]!=0){
-    temp_complex_PS->copy(complex);
-    apply_support(*temp_complex_PS);
-  } 
-
-  //SF
-  if(algorithm_structure[PSF]!=0){
-    if(algorithm_structure[PF]!=0){
-      temp_complex_PSF->copy(*temp_complex_PF);
-      apply_support(*temp_complex_PSF);
+
+  if(!mask){
+
+    //S
+    if(algorithm_structure[PS]!=0){
+      if(!temp_complex_PS)
+	temp_complex_PS = new Complex_2D(complex);
+      temp_complex_PS->copy(complex);
+      apply_support(*temp_complex_PS);
     }
-    else{
-      temp_complex_PSF->copy(complex);
-      project_intensity(*temp_complex_PSF);
+
+    //SF
+    if(algorithm_structure[PSF]!=0){
+      if(!temp_complex_PSF)
+	temp_complex_PSF = new Complex_2D(complex);
+      temp_complex_PSF->copy(*temp_complex_PF);
       apply_support(*temp_complex_PSF);
     }
   }
 
-
   //combine the result of the seperate operators
-  double value_real, value_imag;
-  for(int i=0; i < nx; ++i){
-    for(int j=0; j < ny; ++j){
- 
-      //Add the identity
-      value_real = (1+algorithm_structure[PI])*complex.get_real(i,j);
-      value_imag = (1+algorithm_structure[PI])*complex.get_imag(i,j);
-
-      //Add the component from the PfPs operator
-      if(algorithm_structure[PFS]!=0){
-	value_real+=algorithm_structure[PFS]*temp_complex_PFS->get_real(i,j);
-	value_imag+=algorithm_structure[PFS]*temp_complex_PFS->get_imag(i,j);
-      }
-
-      //Add the component from the Pf operator
-      if(algorithm_structure[PF]!=0){
-	value_real+=algorithm_structure[PF]*temp_complex_PF->get_real(i,j);
-	value_imag+=algorithm_structure[PF]*temp_complex_PF->get_imag(i,j);
-      }
-
-      //Add the component from the Ps operator
-      if(algorithm_structure[PS]!=0){
-	value_real+=algorithm_structure[PS]*temp_complex_PS->get_real(i,j);
-	value_imag+=algorithm_structure[PS]*temp_complex_PS->get_imag(i,j);
-      }
-      
-      //Add the component from the PsPf operator
-      if(algorithm_structure[PSF]!=0){
-	value_real+=algorithm_structure[PSF]*temp_complex_PSF->get_real(i,j);
-	value_imag+=algorithm_structure[PSF]*temp_complex_PSF->get_imag(i,j);
-      }
-      
-      complex.set_real(i,j,value_real);
-      complex.set_imag(i,j,value_imag);
-      
-    }
+  {
+    NADIA_PROFILE(profile, Profiler::COMBINE);
+    complex.combine(combine_coefficients, temp_complex_PF,
+		    temp_complex_PFS, temp_complex_PS, temp_complex_PSF,
+		    mask ? &support : 0);
   }
 
   update_n_best();
@@ -388,25 +481,31 @@ int BaseCDI::iterate(){
 
 
 void BaseCDI::update_n_best(){
+  update_n_best(complex, current_error);
+}
+
+void BaseCDI::update_n_best(const Complex_2D & estimate, double error){
+
+  NADIA_PROFILE(profile, Profiler::UPDATE_N_BEST);
 
   // check whether this estimate is as good as the current best
   // this is a bit dodgy since we are actually storing the 
   // estimate just after the best one.
   int place = 0;
-  for( ; place < n_best && current_error > best_error_array[place]; place++); 
+  for( ; place < n_best && error > best_error_array[place]; place++); 
   
   //we found a new best estimate
   if(n_best>0 && place < n_best){
 
     Complex_2D * temp_pointer = best_array[n_best-1];
-    temp_pointer->copy(complex);
+    temp_pointer->copy(estimate);
 
     for(int i=n_best-1; i>place; i--){
       best_error_array[i] = best_error_array[i-1];
       best_array[i] = best_array[i-1];
     }
     
-    best_error_array[place] = current_error;
+    best_error_array[place] = error;
     best_array[place] = temp_pointer;      
   }
 
@@ -431,45 +530,19 @@ void BaseCDI::apply_shrinkwrap(double gauss_width, double threshold){
 
 void BaseCDI::convolve(Double_2D & array, double gauss_width, 
 			 int pixel_cut_off){
-    //to speed up computation we only convolve 
-  //up to 4 pixels away from the gaussian peak
-
-  //make a temporary array to hold the smeared image
-  Double_2D temp_array(nx,ny);
-  
-  //make a temporary array to hold the gaussian distribution.
-  Double_2D gauss_dist(pixel_cut_off+1, pixel_cut_off+1);
-  for(int i=0; i <= pixel_cut_off; i++){
-    for(int j=0; j <= pixel_cut_off; j++){
-      double denom = 2.0*gauss_width*gauss_width;
-      gauss_dist.set(i,j,exp(-1*(i*i+j*j)/denom ) );
-    }
-  }      
-
-  //now do the convolution
-  //this is messy. First loop over the elements of
-  //the array which was given as input
-  double new_value;
-  for(int i=0; i < nx; i++){
-    for(int j=0; j < ny; j++){
-      
-      //now loop over the colvoluted array (the one we want to make).
-      //Calculate the contribution to each element in it.
-      
-      new_value = 0;
-      
-      for(int i2=i-pixel_cut_off; i2 <= i+pixel_cut_off; i2++){
-	for(int j2=j-pixel_cut_off; j2 <= j+pixel_cut_off; j2++){
-	  if(i2<nx && i2>=0 && j2>=0 && j2<ny){
-	    new_value += array.get(i2,j2)*gauss_dist.get(fabs(i-i2),fabs(j-j2));
-	  }
-	}
-      }
-      temp_array.set(i,j,new_value); 
-    }
-  }
-
-  array.copy(temp_array);
+  //to speed up computation we only convolve 
+  //up to pixel_cut_off pixels away from the gaussian peak (in x and
+  //in y). The kernel exp(-(i^2+j^2)/(2*gauss_width^2)) is separable,
+  //so GaussianFilter can do it one direction at a time.
+  GaussianFilter::apply(array, array, gauss_width, gauss_width,
+			pixel_cut_off/gauss_width);
+
+  //GaussianFilter normalises the kernel, but this kernel has a peak
+  //of 1.
+  double sum = 0;
+  for(int i=-pixel_cut_off; i <= pixel_cut_off; i++)
+    sum += exp(-1*(i*i)/(2.0*gauss_width*gauss_width));
+  array.scale(sum*sum);
 
 }
 
@@ -491,11 +564,37 @@ void BaseCDI::apply_threshold(Double_2D & array,
   }
 }
 
-void BaseCDI::set_fftw_type(int type){
+void BaseCDI::set_fftw_type(int type, const std::string & wisdom_file){
+  if(wisdom_file!="")
+    FFTWPlanCache::set_wisdom_file(wisdom_file);
   if(temp_complex_PFS)
     temp_complex_PFS->set_fftw_type(type);
   if(temp_complex_PF)
     temp_complex_PF->set_fftw_type(type);
+  if(temp_complex_PS)
+    temp_complex_PS->set_fftw_type(type);
+  if(temp_complex_PSF)
+    temp_complex_PSF->set_fftw_type(type);
   complex.set_fftw_type(type);
 }
 
+void BaseCDI::set_num_threads(int n){
+  //the temporary arrays are copies of "complex", so they pick up the
+  //setting when they are made.
+  Complex_2D * temp_array[NTERMS-1] = {temp_complex_PSF,
+				       temp_complex_PFS,
+				       temp_complex_PS,
+				       temp_complex_PF};
+  for(int i=0; i < NTERMS-1; i++){
+    if(temp_array[i])
+      temp_array[i]->set_num_threads(n);
+  }
+  for(int i=0; i < n_best; i++)
+    best_array[i]->set_num_threads(n);
+  complex.set_num_threads(n);
+}
+
+int BaseCDI::get_num_threads() const{
+  return complex.get_num_threads();
+}
+
@@ -0,0 +1,269 @@
+// Copyright 2011 Nadia Davidson for The ARC Centre of Excellence in
+// Coherent X-ray Science. This program is distributed under the GNU
+// General Public License. We also ask that you cite this software in
+// publications where you made use of it for any part of the data
+// analysis.
+
+#include <iostream>
+#include <cstdlib>
+#include <cmath>
+#include <Complex_2D.h>
+#include <BatchCDI.h>
+#include <FFTWPlanCache.h>
+#include <Parallel.h>
+
+using namespace std;
+
+BatchCDI::BatchCDI(Complex_2D & complex, int n_seeds, unsigned int n_best)
+  :PlanarCDI(complex, n_best),
+   n_seeds(n_seeds),
+   pf_memory(0),
+   pfs_memory(0),
+   seed_support(n_seeds, (Double_2D*) 0),
+   seed_error(n_seeds, 1.0){
+
+  if(n_seeds < 1){
+    cout << "A BatchCDI needs at least one seed. Exiting..." << endl;
+    exit(1);
+  }
+
+  estimate_memory = allocate_block(estimates);
+  for(int s=0; s < n_seeds; s++){
+    for(int i=0; i < nx; i++){
+      for(int j=0; j < ny; j++){
+	estimates[s]->set_real(i,j,0);
+	estimates[s]->set_imag(i,j,0);
+      }
+    }
+  }
+
+}
+
+BatchCDI::~BatchCDI(){
+  free_block(estimate_memory, estimates);
+  free_block(pf_memory, temp_pf);
+  free_block(pfs_memory, temp_pfs);
+  for(int s=0; s < n_seeds; s++){
+    if(seed_support[s])
+      delete seed_support[s];
+  }
+}
+
+FFTW_COMPLEX * BatchCDI::allocate_block(vector<Complex_2D *> & arrays){
+
+  FFTW_COMPLEX * block =
+    (FFTW_COMPLEX*) FFTW_MALLOC(sizeof(FFTW_COMPLEX)*nx*ny*n_seeds);
+
+  //each estimate is worked on by one thread; the threads are shared
+  //between the estimates instead.
+  arrays.resize(n_seeds);
+  for(int s=0; s < n_seeds; s++){
+    arrays[s] = new Complex_2D(nx, ny, block + s*nx*ny);
+    arrays[s]->set_fftw_type(complex.get_fftw_type());
+    arrays[s]->set_num_threads(1);
+  }
+
+  return block;
+}
+
+void BatchCDI::free_block(FFTW_COMPLEX * block,
+			  vector<Complex_2D *> & arrays){
+  for(unsigned int s=0; s < arrays.size(); s++)
+    delete arrays[s];
+  arrays.clear();
+  if(block)
+    FFTW_FREE(block);
+}
+
+void BatchCDI::initialise_estimate(int seed){
+  for(int s=0; s < n_seeds; s++)
+    fill_random_estimate(*estimates[s], seed+s);
+}
+
+void BatchCDI::set_complex_constraint(TransmissionConstraint &){
+  cout << "Transmission constraints can not be used with "
+       << "BatchCDI. Exiting..." << endl;
+  exit(1);
+}
+
+Complex_2D & BatchCDI::get_estimate(int seed){
+  if(seed < 0 || seed >= n_seeds){
+    cout << "seed " << seed << " is out of bounds in "
+	 << "BatchCDI::get_estimate. Exiting..." << endl;
+    exit(1);
+  }
+  return *estimates[seed];
+}
+
+double BatchCDI::get_seed_error(int seed) const{
+  if(seed < 0 || seed >= n_seeds){
+    cout << "seed " << seed << " is out of bounds in "
+	 << "BatchCDI::get_seed_error. Exiting..." << endl;
+    exit(1);
+  }
+  return seed_error[seed];
+}
+
+const Double_2D & BatchCDI::get_seed_support(int seed) const{
+  if(seed >= 0 && seed < n_seeds && seed_support[seed])
+    return *seed_support[seed];
+  return support;
+}
+
+int BatchCDI::get_best_seed() const{
+  int best = 0;
+  for(int s=1; s < n_seeds; s++){
+    if(seed_error[s] < seed_error[best])
+      best = s;
+  }
+  return best;
+}
+
+void BatchCDI::copy_best_estimate(){
+  complex.copy(*estimates[get_best_seed()]);
+}
+
+void BatchCDI::project_intensity_batch(FFTW_COMPLEX * block,
+				       vector<Complex_2D *> & arrays){
+
+  const int threads = get_num_threads();
+
+  //the centring of odd sized arrays can't be folded into the
+  //modulus constraint, so each array is transformed on its own, as
+  //in PlanarCDI. The arrays were given one thread each in
+  //allocate_block(), so the seeds are shared between the threads.
+  if(!fused_projection || nx%2==1 || ny%2==1){
+    {
+      NADIA_PROFILE(profile, Profiler::PROPAGATE_TO_DETECTOR);
+      NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(nx*ny*n_seeds,threads))
+      for(int s=0; s < n_seeds; s++)
+	arrays[s]->perform_forward_fft_centred();
+    }
+    {
+      NADIA_PROFILE(profile, Profiler::SCALE_INTENSITY);
+      NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(nx*ny*n_seeds,threads))
+      for(int s=0; s < n_seeds; s++){
+	double norm2_mag=0;
+	double norm2_diff=0;
+	arrays[s]->project_modulus(intensity_sqrt, beam_stop,
+				   norm2_mag, norm2_diff);
+	seed_error[s] = norm2_diff/norm2_mag;
+      }
+    }
+    NADIA_PROFILE(profile, Profiler::PROPAGATE_FROM_DETECTOR);
+    NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(nx*ny*n_seeds,threads))
+    for(int s=0; s < n_seeds; s++)
+      arrays[s]->perform_backward_fft_centred();
+    return;
+  }
+
+  if(!fft_order_valid)
+    update_fft_order_arrays();
+
+  const int flags = complex.get_fftw_type();
+  const double scale = 1.0/sqrt((double)nx*ny);
+
+  {
+    NADIA_PROFILE(profile, Profiler::PROPAGATE_TO_DETECTOR);
+    FFTW_EXECUTE_DFT(FFTWPlanCache::get_many_plan(nx, ny, n_seeds,
+						  FFTW_FORWARD, flags,
+						  block, threads),
+		     block, block);
+  }
+
+  {
+    NADIA_PROFILE(profile, Profiler::SCALE_INTENSITY);
+    NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(nx*ny*n_seeds,threads))
+    for(int s=0; s < n_seeds; s++){
+      double norm2_mag=0;
+      double norm2_diff=0;
+      arrays[s]->project_modulus(*intensity_sqrt_fft_order,
+				 beam_stop_fft_order,
+				 norm2_mag, norm2_diff, 0, 0, scale, scale);
+      seed_error[s] = norm2_diff/norm2_mag;
+    }
+  }
+
+  NADIA_PROFILE(profile, Profiler::PROPAGATE_FROM_DETECTOR);
+  FFTW_EXECUTE_DFT(FFTWPlanCache::get_many_plan(nx, ny, n_seeds,
+						FFTW_BACKWARD, flags,
+						block, threads),
+		   block, block);
+
+}
+
+int BatchCDI::iterate(){
+
+  NADIA_PROFILE(profile, Profiler::ITERATE);
+
+  //as in BaseCDI::iterate(), but with the support as a mask and
+  //each step done for all the seeds.
+  if(algorithm==ER){
+    project_intensity_batch(estimate_memory, estimates);
+    NADIA_PROFILE(profile, Profiler::APPLY_SUPPORT);
+    NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(nx*ny*n_seeds,get_num_threads()))
+    for(int s=0; s < n_seeds; s++)
+      support_constraint(*estimates[s], get_seed_support(s));
+  }
+  else{
+
+    bool use_pfs = algorithm_structure[PFS]!=0;
+    bool use_pf = algorithm_structure[PF]!=0 || algorithm_structure[PSF]!=0;
+
+    if(use_pfs && !pfs_memory)
+      pfs_memory = allocate_block(temp_pfs);
+    if(use_pf && !pf_memory)
+      pf_memory = allocate_block(temp_pf);
+
+    //PFS
+    if(use_pfs){
+      NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(nx*ny*n_seeds,get_num_threads()))
+      for(int s=0; s < n_seeds; s++)
+	temp_pfs[s]->copy(*estimates[s], get_seed_support(s));
+      project_intensity_batch(pfs_memory, temp_pfs);
+    }
+
+    //F (which is also needed for SF)
+    if(use_pf){
+      NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(nx*ny*n_seeds,get_num_threads()))
+      for(int s=0; s < n_seeds; s++)
+	temp_pf[s]->copy(*estimates[s]);
+      project_intensity_batch(pf_memory, temp_pf);
+    }
+
+    //combine the result of the seperate operators
+    NADIA_PROFILE(profile, Profiler::COMBINE);
+    NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(nx*ny*n_seeds,get_num_threads()))
+    for(int s=0; s < n_seeds; s++)
+      estimates[s]->combine(combine_coefficients,
+			    use_pf ? temp_pf[s] : 0,
+			    use_pfs ? temp_pfs[s] : 0,
+			    0, 0, &get_seed_support(s));
+  }
+
+  current_error = seed_error[get_best_seed()];
+
+  for(int s=0; s < n_seeds; s++)
+    update_n_best(*estimates[s], seed_error[s]);
+
+  return SUCCESS;
+}
+
+void BatchCDI::apply_shrinkwrap(double gauss_width, double threshold){
+
+  Double_2D recon(nx,ny);
+
+  for(int s=0; s < n_seeds; s++){
+
+    estimates[s]->get_2d(MAG,recon);
+    convolve(recon,gauss_width);
+    apply_threshold(recon,threshold);
+
+    //apply_threshold() leaves 0s and 1s, which is already a
+    //normalised support.
+    if(!seed_support[s])
+      seed_support[s] = new Double_2D(nx,ny);
+    seed_support[s]->copy(recon);
+  }
+
+}
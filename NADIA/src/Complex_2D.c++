@@ -10,6 +10,7 @@
 #include <cstring>
 #include <fftw3.h>
 #include <types.h>
+#include <Parallel.h>
 
 using namespace std;
 
@@ -23,12 +24,24 @@ ComplexR_2D<T>::ComplexR_2D(int x_size, int y_size){
   array = (FFTW_COMPLEX*) FFTW_MALLOC(malloc_size);
   //allocate memory for the array
 
+  fftw_type = FFTW_MEASURE;
+  num_threads = 0;
+  owns_array = true;
+}
+
+/*Constructor using memory allocated elsewhere*/
+template<class T>
+ComplexR_2D<T>::ComplexR_2D(int x_size, int y_size,
+			    FFTW_COMPLEX * memory){
+
+  nx = x_size;
+  ny = y_size;
+  malloc_size=sizeof(FFTW_COMPLEX)*nx*ny;
+  array = memory;
 
-  //initalise the fftw plans to null (not created yet. We will
-  //create them when needed to avoid unnecessary time overhead).
-  f_forward = 0;
-  f_backward = 0;
   fftw_type = FFTW_MEASURE;
+  num_threads = 0;
+  owns_array = false;
 }
 
 /*Copy Constructor*/
@@ -39,14 +52,13 @@ ComplexR_2D<T>::ComplexR_2D(const ComplexR_2D & object){
   nx = object.get_size_x();
   ny = object.get_size_y();
 
-  array = (FFTW_COMPLEX*) FFTW_MALLOC(sizeof(FFTW_COMPLEX)*nx*ny);
-  memcpy(array, object.array, sizeof(FFTW_COMPLEX)*nx*ny);
-
-  //initalise the fftw plans to null (not created yet. We will
-  //create them when needed to avoid unnecessary time overhead).
-  f_forward = 0;
-  f_backward = 0;
-  fftw_type = FFTW_MEASURE;
+  malloc_size = sizeof(FFTW_COMPLEX)*nx*ny;
+  array = (FFTW_COMPLEX*) FFTW_MALLOC(malloc_size);
+  memcpy(array, object.array, malloc_size);
+  //the plans are shared, so keep the planner flag of the original.
+  fftw_type = object.fftw_type;
+  num_threads = object.num_threads;
+  owns_array = true;
 
   /*
      for(int i=0; i < object.get_size_x(); i++){
@@ -67,14 +79,12 @@ ComplexR_2D<T>::ComplexR_2D(const Double_2D& object){
   nx = object.get_size_x();
   ny = object.get_size_y();
   
-  array=(FFTW_COMPLEX*) FFTW_MALLOC(sizeof(FFTW_COMPLEX)*nx*ny);
-
+  malloc_size = sizeof(FFTW_COMPLEX)*nx*ny;
+  array=(FFTW_COMPLEX*) FFTW_MALLOC(malloc_size);
 
-  //initalise the fftw plans to null (not created yet. We will
-  //create them when needed to avoid unnecessary time overhead).
-  f_forward = 0;
-  f_backward = 0;
   fftw_type = FFTW_MEASURE;
+  num_threads = 0;
+  owns_array = true;
 
   for(int i=0; i < object.get_size_x(); i++){
     for(int j=0; j < object.get_size_y(); j++){
@@ -89,14 +99,56 @@ ComplexR_2D<T>::ComplexR_2D(const Double_2D& object){
 template<class T>
 ComplexR_2D<T>::~ComplexR_2D(){
 
-FFTW_FREE(array);
-if(f_forward)
-  FFTW_DESTROY_PLAN(f_forward);
-if(f_backward)
-  FFTW_DESTROY_PLAN(f_backward);
+  //"array" is 0 if the memory was moved to another object.
+  if(array && owns_array)
+    FFTW_FREE(array);
 
 }
 
+template<class T>
+void ComplexR_2D<T>::resize(int x_size, int y_size){
+
+  if(!owns_array && (x_size*y_size != nx*ny || !array)){
+    cout << "A Complex_2D which uses memory allocated elsewhere "
+	 << "can not be resized. Exiting..." << endl;
+    exit(1);
+  }
+
+  if(x_size*y_size != nx*ny || !array){
+    if(array)
+      FFTW_FREE(array);
+    malloc_size = sizeof(FFTW_COMPLEX)*x_size*y_size;
+    array = (FFTW_COMPLEX*) FFTW_MALLOC(malloc_size);
+  }
+
+  nx = x_size;
+  ny = y_size;
+}
+
+
+template<class T>
+void ComplexR_2D<T>::move_to(FFTW_COMPLEX * memory){
+
+  if(memory == array)
+    return;
+
+  FFTW_COMPLEX * old_array = array;
+  bool owned = owns_array;
+
+  if(memory){
+    memcpy(memory, old_array, malloc_size);
+    array = memory;
+    owns_array = false;
+  }
+  else{
+    array = (FFTW_COMPLEX*) FFTW_MALLOC(malloc_size);
+    memcpy(array, old_array, malloc_size);
+    owns_array = true;
+  }
+
+  if(owned && old_array)
+    FFTW_FREE(old_array);
+}
 
 //set the value at positions x,y. See Complex_2D.h for more info.
 template<class T>
@@ -155,33 +207,103 @@ T ComplexR_2D<T>::get_value(int x, int y, int type) const {
 }
 
 //like get() but we do it for the entire array not just a single value.
+//the common types get their own loops so there is no switch per
+//element.
 template<class T>
 void ComplexR_2D<T>::get_2d(int type, Double_2D & result) const {
 
-  for(int i=0; i < nx; i++)
-    for(int j=0; j < ny; j++){
-      result.set(i,j,get_value(i,j,type));
-    }
+  const int n = nx*ny;
+  T * r = result.array;
+
+  switch(type){
+  case REAL:
+    NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(n,get_num_threads()))
+    for(int k=0; k < n; ++k)
+      r[k] = array[k][REAL];
+    break;
+  case IMAG:
+    NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(n,get_num_threads()))
+    for(int k=0; k < n; ++k)
+      r[k] = array[k][IMAG];
+    break;
+  case MAG:
+    NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(n,get_num_threads()))
+    for(int k=0; k < n; ++k)
+      r[k] = sqrt(array[k][REAL]*array[k][REAL]+
+		  array[k][IMAG]*array[k][IMAG]);
+    break;
+  case MAG_SQ:
+    NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(n,get_num_threads()))
+    for(int k=0; k < n; ++k)
+      r[k] = array[k][REAL]*array[k][REAL]+
+	array[k][IMAG]*array[k][IMAG];
+    break;
+  default:
+    for(int i=0; i < nx; i++)
+      for(int j=0; j < ny; j++){
+	result.set(i,j,get_value(i,j,type));
+      }
+  }
 }
 
+template<class T>
+void ComplexR_2D<T>::get_split(Real_2D<T> & real, Real_2D<T> & imag) const {
+
+  if(real.nx!=nx || real.ny!=ny || imag.nx!=nx || imag.ny!=ny){
+    cout << "in Complex_2D::get_split, the dimensions of the "
+      "output arrays do not match the dimensions of "
+      "this Complex_2D object" << endl;
+    exit(1);
+  }
+
+  const int n = nx*ny;
+  T * re = real.array;
+  T * im = imag.array;
+  NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(n,get_num_threads()))
+  for(int k=0; k < n; ++k){
+    re[k] = array[k][REAL];
+    im[k] = array[k][IMAG];
+  }
+}
 
-//scale all the values in the array by the given factor.
 template<class T>
-void ComplexR_2D<T>::scale(T scale_factor){
+void ComplexR_2D<T>::set_split(const Real_2D<T> & real,
+			       const Real_2D<T> & imag){
 
-  for(int i=0; i < nx; ++i){
-    for(int j=0; j < ny; ++j){ 
-      array[i*ny + j][REAL]*=scale_factor;
-      array[i*ny + j][IMAG]*=scale_factor;
+  if(real.nx!=nx || real.ny!=ny || imag.nx!=nx || imag.ny!=ny){
+    cout << "in Complex_2D::set_split, the dimensions of the "
+      "input arrays do not match the dimensions of "
+      "this Complex_2D object" << endl;
+    exit(1);
+  }
 
-    }
+  const int n = nx*ny;
+  const T * re = real.array;
+  const T * im = imag.array;
+  NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(n,get_num_threads()))
+  for(int k=0; k < n; ++k){
+    array[k][REAL] = re[k];
+    array[k][IMAG] = im[k];
   }
+}
+
+
+//scale all the values in the array by the given factor.
+template<class T>
+void ComplexR_2D<T>::scale(T scale_factor){
+
+  //the array is treated as a flat list of real numbers
+  const int n = 2*nx*ny;
+  T * values = &array[0][0];
+  NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(n,get_num_threads()))
+  for(int k=0; k < n; ++k)
+    values[k]*=scale_factor;
 
 }
 
 //add another Complex_2D to this one.
 template<class T>
-void ComplexR_2D<T>::add(ComplexR_2D<T> & c2, T scale){
+void ComplexR_2D<T>::add(const ComplexR_2D<T> & c2, T scale){
 
   if(nx!=c2.get_size_x() || ny!=c2.get_size_y()){
     cout << "in Complex_2D::add, the dimensions of the "
@@ -190,17 +312,17 @@ void ComplexR_2D<T>::add(ComplexR_2D<T> & c2, T scale){
     exit(1);
   }
 
-  for(int i=0; i < nx; ++i){
-    for(int j=0; j < ny; ++j){
-      array[i*ny + j][REAL]+=scale*c2.get_real(i,j);
-      array[i*ny + j][IMAG]+=scale*c2.get_imag(i,j);
-    }
-  }
+  const int n = 2*nx*ny;
+  T * values = &array[0][0];
+  const T * other = &c2.array[0][0];
+  NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(n,get_num_threads()))
+  for(int k=0; k < n; ++k)
+    values[k]+=scale*other[k];
 }
 
 //multiply another Complex_2D with this one.
 template<class T>
-void ComplexR_2D<T>::multiply(ComplexR_2D<T> & c2, T scale){
+void ComplexR_2D<T>::multiply(const ComplexR_2D<T> & c2, T scale){
 
   if(nx!=c2.get_size_x() || ny!=c2.get_size_y()){
     cout << "in Complex_2D::multiply, the dimensions of the "
@@ -209,27 +331,26 @@ void ComplexR_2D<T>::multiply(ComplexR_2D<T> & c2, T scale){
     exit(1);
   }
 
-  for(int i=0; i < nx; ++i){
-    for(int j=0; j < ny; ++j){
-      // values are multiplied in the usual way
-      // if c1 = a + ib and c2 = d + ie
-      // then the new c1 is:
-      // c1 = (a*d - b*e) + i(a*e + b*d)
-      T new_real = c2.get_real(i,j)*this->get_real(i,j)
-	- c2.get_imag(i,j)*this->get_imag(i,j);
-      T new_imag = c2.get_real(i,j)*this->get_imag(i,j)
-	+ c2.get_imag(i,j)*this->get_real(i,j);
-
-      //and set the values
-      set_real(i,j,scale*new_real);
-      set_imag(i,j,scale*new_imag);
-    }
+  const int n = nx*ny;
+  const FFTW_COMPLEX * other = c2.array;
+  NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(n,get_num_threads()))
+  for(int k=0; k < n; ++k){
+    // values are multiplied in the usual way
+    // if c1 = a + ib and c2 = d + ie
+    // then the new c1 is:
+    // c1 = (a*d - b*e) + i(a*e + b*d)
+    T a = array[k][REAL];
+    T b = array[k][IMAG];
+    T d = other[k][REAL];
+    T e = other[k][IMAG];
+    array[k][REAL] = scale*(a*d - b*e);
+    array[k][IMAG] = scale*(a*e + b*d);
   }
 }
 
-//multiply another Complex_2D with this one.
+//multiply a Double_2D with this one.
 template<class T>
-void ComplexR_2D<T>::multiply(Double_2D & c2, T scale){
+void ComplexR_2D<T>::multiply(const Double_2D & c2, T scale){
 
   if(nx!=c2.get_size_x() || ny!=c2.get_size_y()){
     cout << "in Complex_2D::multiply, the dimensions of the "
@@ -238,22 +359,162 @@ void ComplexR_2D<T>::multiply(Double_2D & c2, T scale){
     exit(1);
   }
 
-  for(int i=0; i < nx; ++i){
-    for(int j=0; j < ny; ++j){
-      // values are multiplied in the usual way
-      // if c1 = a + ib and c2 = d + ie
-      // then the new c1 is:
-      // c1 = (a*d - b*e) + i(a*e + b*d)
-      T new_real = c2.get(i,j)*this->get_real(i,j);
-      //- c2.get_imag(i,j)*this->get_imag(i,j);
-      T new_imag = c2.get(i,j)*this->get_imag(i,j);
-      //+ c2.get_imag(i,j)*this->get_real(i,j);
-
-      //and set the values
-      set_real(i,j,scale*new_real);
-      set_imag(i,j,scale*new_imag);
+  const int n = nx*ny;
+  const T * other = c2.array;
+  NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(n,get_num_threads()))
+  for(int k=0; k < n; ++k){
+    T factor = scale*other[k];
+    array[k][REAL]*=factor;
+    array[k][IMAG]*=factor;
+  }
+}
+
+//The inner loop of the modulus projection for one row. The options
+//are template parameters so each combination gets a loop without
+//any branches in it.
+template<class T, bool MASK, bool REF, bool OFFSET>
+static void project_modulus_row(FFTW_COMPLEX * c, const T * amplitude,
+				const T * mask, const T * reference,
+				const FFTW_COMPLEX * offset, int n,
+				T input_scale, T output_scale,
+				double & norm2_mag, double & norm2_diff){
+
+  double row_mag = 0;
+  double row_diff = 0;
+
+  for(int j=0; j < n; ++j){
+
+    T re = c[j][REAL];
+    T im = c[j][IMAG];
+    if(OFFSET){
+      re += offset[j][REAL];
+      im += offset[j][IMAG];
+    }
+
+    T mag2 = re*re + im*im;
+    T inv_mag = mag2>0 ? 1/sqrt(mag2) : 0;
+    T a = amplitude[j];
+
+    //the factor to take c to the projected value, and the magnitude
+    //the error is calculated from.
+    T factor, mag;
+    T zero_mag = 0;
+    if(REF){
+      T ref = reference[j];
+      factor = ref>0 ? input_scale*a/ref : 0;
+      mag = ref;
+    }
+    else{
+      factor = a*inv_mag;
+      mag = input_scale*mag2*inv_mag;
+      //fields with no magnitude become real
+      zero_mag = mag2>0 ? 0 : a;
+    }
+
+    T m = MASK ? mask[j] : 1;
+    T keep = (1-m)*input_scale;
+
+    T new_re = output_scale*(m*(re*factor + zero_mag) + keep*re);
+    T new_im = output_scale*(m*(im*factor) + keep*im);
+    if(OFFSET){
+      new_re -= offset[j][REAL];
+      new_im -= offset[j][IMAG];
     }
+    c[j][REAL] = new_re;
+    c[j][IMAG] = new_im;
+
+    row_mag += m*a*a;
+    row_diff += m*(mag-a)*(mag-a);
   }
+
+  norm2_mag += row_mag;
+  norm2_diff += row_diff;
+}
+
+template<class T>
+void ComplexR_2D<T>::project_modulus(const Real_2D<T> & amplitude,
+				     const Real_2D<T> * mask,
+				     double & norm2_mag,
+				     double & norm2_diff,
+				     const Real_2D<T> * reference,
+				     const ComplexR_2D<T> * offset,
+				     T input_scale, T output_scale,
+				     int x_offset, int y_offset){
+
+  int a_nx = amplitude.get_size_x();
+  int a_ny = amplitude.get_size_y();
+
+  if(x_offset < 0 || y_offset < 0 ||
+     x_offset+a_nx > nx || y_offset+a_ny > ny ||
+     (offset && (offset->nx!=nx || offset->ny!=ny))){
+    cout << "in Complex_2D::project_modulus, the dimensions of the "
+      "input arrays do not match the dimensions of "
+      "this Complex_2D object" << endl;
+    exit(1);
+  }
+
+  //the rows are shared between threads, each keeping its own error
+  //sums.
+  double sum_mag = 0;
+  double sum_diff = 0;
+
+  NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(a_nx*a_ny,get_num_threads()) reduction(+:sum_mag,sum_diff))
+  for(int i=0; i < a_nx; ++i){
+
+    FFTW_COMPLEX * c_row = array + (i+x_offset)*ny + y_offset;
+    const T * a_row = amplitude.array + i*a_ny;
+    const T * m_row = mask ? mask->array + i*a_ny : 0;
+    const T * r_row = reference ? reference->array + i*a_ny : 0;
+    const FFTW_COMPLEX * o_row = 
+      offset ? offset->array + (i+x_offset)*ny + y_offset : 0;
+
+    //pick the version of the loop with only the parts we need
+    int options = (mask?1:0) + (reference?2:0) + (offset?4:0);
+    switch(options){
+    case 0:
+      project_modulus_row<T,false,false,false>
+	(c_row,a_row,m_row,r_row,o_row,a_ny,input_scale,output_scale,
+	 sum_mag,sum_diff);
+      break;
+    case 1:
+      project_modulus_row<T,true,false,false>
+	(c_row,a_row,m_row,r_row,o_row,a_ny,input_scale,output_scale,
+	 sum_mag,sum_diff);
+      break;
+    case 2:
+      project_modulus_row<T,false,true,false>
+	(c_row,a_row,m_row,r_row,o_row,a_ny,input_scale,output_scale,
+	 sum_mag,sum_diff);
+      break;
+    case 3:
+      project_modulus_row<T,true,true,false>
+	(c_row,a_row,m_row,r_row,o_row,a_ny,input_scale,output_scale,
+	 sum_mag,sum_diff);
+      break;
+    case 4:
+      project_modulus_row<T,false,false,true>
+	(c_row,a_row,m_row,r_row,o_row,a_ny,input_scale,output_scale,
+	 sum_mag,sum_diff);
+      break;
+    case 5:
+      project_modulus_row<T,true,false,true>
+	(c_row,a_row,m_row,r_row,o_row,a_ny,input_scale,output_scale,
+	 sum_mag,sum_diff);
+      break;
+    case 6:
+      project_modulus_row<T,false,true,true>
+	(c_row,a_row,m_row,r_row,o_row,a_ny,input_scale,output_scale,
+	 sum_mag,sum_diff);
+      break;
+    default:
+      project_modulus_row<T,true,true,true>
+	(c_row,a_row,m_row,r_row,o_row,a_ny,input_scale,output_scale,
+	 sum_mag,sum_diff);
+    }
+  }
+
+  norm2_mag += sum_mag;
+  norm2_diff += sum_diff;
 }
 
 template<class T>
@@ -261,22 +522,22 @@ T ComplexR_2D<T>::get_norm() const {
 
   T norm_squared=0;
 
-  for(int i=0; i < nx; ++i){
-    for(int j=0; j < ny; ++j){
-      norm_squared += pow(get_imag(i,j),2)+pow(get_real(i,j),2);
-    }
-  }
+  const int n = 2*nx*ny;
+  const T * values = &array[0][0];
+  NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(n,get_num_threads()) reduction(+:norm_squared))
+  for(int k=0; k < n; ++k)
+    norm_squared += values[k]*values[k];
+
   return sqrt(norm_squared);
 }
 
 template<class T>
 void ComplexR_2D<T>::conjugate() {
 
-  for(int i=0; i < nx; ++i){
-    for(int j=0; j < ny; ++j){
-      set_imag(i,j,-1*get_imag(i,j));
-    }
-  }
+  const int n = nx*ny;
+  NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(n,get_num_threads()))
+  for(int k=0; k < n; ++k)
+    array[k][IMAG] = -array[k][IMAG];
 
 }
 
@@ -312,6 +573,154 @@ void ComplexR_2D<T>::copy(const ComplexR_2D<T> & c){
 
 }
 
+//copy another array and multiply by a mask in the same pass
+template<class T>
+void ComplexR_2D<T>::copy(const ComplexR_2D<T> & c, const Real_2D<T> & mask){
+
+  if(c.nx!=nx || c.ny!=ny || mask.nx!=nx || mask.ny!=ny){
+    cout << "Trying to copy an array with different dimensions... "
+      << "exiting"<<endl;
+    exit(1);
+  }
+
+  const int n = nx*ny;
+  const T * m = mask.array;
+  NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(n,get_num_threads()))
+  for(int k=0; k < n; ++k){
+    array[k][REAL] = m[k]*c.array[k][REAL];
+    array[k][IMAG] = m[k]*c.array[k][IMAG];
+  }
+
+}
+
+//The loop for Complex_2D::combine. Which of the terms are present
+//(and whether P() is a mask) are template parameters, so each
+//combination of terms gets its own loop with no branches in it.
+template<class T, bool A, bool B, bool PX, bool PA, bool MASK>
+static void combine_loop(FFTW_COMPLEX * x, const FFTW_COMPLEX * a,
+			 const FFTW_COMPLEX * b, const FFTW_COMPLEX * px,
+			 const FFTW_COMPLEX * pa, const T * mask,
+			 const T * c, int n, int threads){
+
+  (void) threads; //only used with OpenMP
+
+  NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(n,threads))
+  for(int k=0; k < n; ++k){
+    T re = c[0]*x[k][REAL];
+    T im = c[0]*x[k][IMAG];
+    if(A){
+      re += c[1]*a[k][REAL];
+      im += c[1]*a[k][IMAG];
+    }
+    if(B){
+      re += c[2]*b[k][REAL];
+      im += c[2]*b[k][IMAG];
+    }
+    if(MASK && (PX || PA)){
+      //gather the terms which are multiplied by the mask
+      T mre = 0;
+      T mim = 0;
+      if(PX){
+	mre += c[3]*x[k][REAL];
+	mim += c[3]*x[k][IMAG];
+      }
+      if(PA){
+	mre += c[4]*a[k][REAL];
+	mim += c[4]*a[k][IMAG];
+      }
+      re += mask[k]*mre;
+      im += mask[k]*mim;
+    }
+    if(!MASK && PX){
+      re += c[3]*px[k][REAL];
+      im += c[3]*px[k][IMAG];
+    }
+    if(!MASK && PA){
+      re += c[4]*pa[k][REAL];
+      im += c[4]*pa[k][IMAG];
+    }
+    x[k][REAL] = re;
+    x[k][IMAG] = im;
+  }
+}
+
+//A table of all 32 versions of combine_loop, indexed by
+//A + 2B + 4PX + 8PA + 16MASK.
+template<class T, int N>
+struct CombineTable{
+  typedef void (*Loop)(FFTW_COMPLEX*, const FFTW_COMPLEX*,
+		       const FFTW_COMPLEX*, const FFTW_COMPLEX*,
+		       const FFTW_COMPLEX*, const T*, const T*, int, int);
+  static void fill(Loop * table){
+    table[N-1] = &combine_loop<T, ((N-1)&1)!=0, ((N-1)&2)!=0,
+			       ((N-1)&4)!=0, ((N-1)&8)!=0,
+			       ((N-1)&16)!=0>;
+    CombineTable<T,N-1>::fill(table);
+  }
+};
+
+template<class T>
+struct CombineTable<T,0>{
+  typedef void (*Loop)(FFTW_COMPLEX*, const FFTW_COMPLEX*,
+		       const FFTW_COMPLEX*, const FFTW_COMPLEX*,
+		       const FFTW_COMPLEX*, const T*, const T*, int, int);
+  static void fill(Loop *){};
+};
+
+template<class T>
+static typename CombineTable<T,32>::Loop * make_combine_table(){
+  static typename CombineTable<T,32>::Loop table[32];
+  CombineTable<T,32>::fill(table);
+  return table;
+}
+
+template<class T>
+void ComplexR_2D<T>::combine(const double coefficients[5],
+			     const ComplexR_2D<T> * a,
+			     const ComplexR_2D<T> * b,
+			     const ComplexR_2D<T> * px,
+			     const ComplexR_2D<T> * pa,
+			     const Real_2D<T> * mask){
+
+  static typename CombineTable<T,32>::Loop * table =
+    make_combine_table<T>();
+
+  T c[5];
+  for(int i=0; i < 5; i++)
+    c[i] = coefficients[i];
+
+  //work out which terms are used
+  int terms = 0;
+  if(c[1]!=0) terms |= 1;
+  if(c[2]!=0) terms |= 2;
+  if(c[3]!=0) terms |= 4;
+  if(c[4]!=0) terms |= 8;
+  if(mask) terms |= 16;
+
+  //check the arrays for those terms
+  const ComplexR_2D<T> * used[4] = { a, b, mask ? this : px, mask ? a : pa };
+  bool bad_size = mask && (mask->nx!=nx || mask->ny!=ny);
+  for(int i=0; i < 4; i++){
+    if(terms & (1<<i))
+      bad_size = bad_size || !used[i] ||
+	used[i]->nx!=nx || used[i]->ny!=ny;
+  }
+  if(bad_size){
+    cout << "in Complex_2D::combine, an array is missing or its "
+      "dimensions do not match the dimensions of "
+      "this Complex_2D object" << endl;
+    exit(1);
+  }
+
+  table[terms](array,
+	       (terms&1 || (mask && terms&8)) ? a->array : 0,
+	       terms&2 ? b->array : 0,
+	       (!mask && terms&4) ? px->array : 0,
+	       (!mask && terms&8) ? pa->array : 0,
+	       mask ? mask->array : 0,
+	       c, nx*ny, get_num_threads());
+}
+
 
 //invert (and scale if we want to).
 template<class T>
@@ -330,6 +739,10 @@ void ComplexR_2D<T>::invert(bool scale){
       << "array after FFT. This will probably cause you issues..."
       << endl;
 
+  //each iteration swaps the first half of row i with the second
+  //half of row i_new, so different iterations never touch the same
+  //elements.
+  NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(nx*ny,get_num_threads()))
   for(int i=0; i < nx; ++i){
     for(int j=0; j < middle_y; ++j){
 
@@ -352,6 +765,32 @@ void ComplexR_2D<T>::invert(bool scale){
 
 }
 
+//multiply by scale*(-1)^(i+j).
+template<class T>
+void ComplexR_2D<T>::checkerboard(T scale){
+
+  NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(nx*ny,get_num_threads()))
+  for(int i=0; i < nx; ++i){
+
+    //the sign of the first element in this row
+    T row_scale = (i%2==0) ? scale : -scale;
+    FFTW_COMPLEX * row = array + i*ny;
+
+    int j=0;
+    for(; j < ny-1; j+=2){
+      row[j][REAL]*=row_scale;
+      row[j][IMAG]*=row_scale;
+      row[j+1][REAL]*=-row_scale;
+      row[j+1][IMAG]*=-row_scale;
+    }
+    if(j < ny){
+      row[j][REAL]*=row_scale;
+      row[j][IMAG]*=row_scale;
+    }
+  }
+
+}
+
 template<class T>
 void ComplexR_2D<T>::mirror(){
 
@@ -400,126 +839,150 @@ int ComplexR_2D<T>::check_bounds(int x, int y) const{
 }
 
 template<class T>
-ComplexR_2D<T> ComplexR_2D<T>::get_padded(int x_add, int y_add){
+ComplexR_2D<T> ComplexR_2D<T>::get_padded(int x_add, int y_add) const{
 
   ComplexR_2D<T> padded(nx+2*x_add, ny+2*y_add);
+  pad_into(padded, x_add, y_add);
+  return padded;
+}
 
-  for(int i=0; i<x_add; i++){
-    for(int j=0; j<ny+2*y_add; j++){
-      padded.set_real(i, j, 0);
-      padded.set_imag(i, j, 0);
-    }
-  }
+template<class T>
+ComplexR_2D<T> ComplexR_2D<T>::get_unpadded(int x_add, int y_add) const{
 
-  for(int i=nx+x_add; i<nx+2*x_add; i++){
-    for(int j=0; j<ny+2*y_add; j++){
-      padded.set_real(i, j, 0);
-      padded.set_imag(i, j, 0);
-    }
-  }
+  ComplexR_2D<T> unpadded(nx-2*x_add, ny-2*y_add);
+  unpad_into(unpadded, x_add, y_add);
+  return unpadded;
+}
 
-  for(int i=x_add; i<nx; i++){
-    for(int j=0; j<y_add; j++){
-      padded.set_real(i, j, 0);
-      padded.set_imag(i, j, 0);
+template<class T>
+void ComplexR_2D<T>::pad_into(ComplexR_2D<T> & result,
+			      int x_add, int y_add) const{
+
+  const int px = nx+2*x_add;
+  const int py = ny+2*y_add;
+
+  result.resize(px, py);
+  result.fftw_type = fftw_type;
+  result.num_threads = num_threads;
+
+  //each row of the result is either all padding, or padding on
+  //either side of a row of this array.
+  NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(px*py,get_num_threads()))
+  for(int i=0; i<px; i++){
+    FFTW_COMPLEX * row = result.array + i*py;
+    if(i<x_add || i>=nx+x_add){
+      memset(row, 0, sizeof(FFTW_COMPLEX)*py);
     }
-  }
-
-  for(int i=x_add; i<nx; i++){
-    for(int j=ny+y_add; j<ny+2*y_add; j++){
-      padded.set_real(i, j, 0);
-      padded.set_imag(i, j, 0);
+    else{
+      memset(row, 0, sizeof(FFTW_COMPLEX)*y_add);
+      memcpy(row+y_add, array+(i-x_add)*ny, sizeof(FFTW_COMPLEX)*ny);
+      memset(row+y_add+ny, 0, sizeof(FFTW_COMPLEX)*y_add);
     }
   }
-
-  for(int i=0; i<nx; i++){
-    for(int j=0; j<ny; j++){
-      padded.set_real(i+x_add, j+y_add, get_real(i, j));
-      padded.set_imag(i+x_add, j+y_add, get_imag(i, j));
-      //std::cout<<i<<", "<<j<<", "<<x_add<<"\n";
-    } 
-  } 
-
-  return padded;
 }
 
 template<class T>
-ComplexR_2D<T> ComplexR_2D<T>::get_unpadded(int x_add, int y_add){
+void ComplexR_2D<T>::unpad_into(ComplexR_2D<T> & result,
+				int x_add, int y_add) const{
 
-  ComplexR_2D<T> unpadded(nx-2*x_add, ny-2*y_add);
+  const int ux = nx-2*x_add;
+  const int uy = ny-2*y_add;
 
-  for(int i=0; i<nx-2*x_add; i++){
-    for(int j=0; j<ny-2*y_add; j++){
-      unpadded.set_real(i, j, get_real(i+x_add, j+y_add));
-      unpadded.set_imag(i, j, get_imag(i+x_add, j+y_add));
-      //      std::cout<<"Goodbye\n";
+  result.resize(ux, uy);
+  result.fftw_type = fftw_type;
+  result.num_threads = num_threads;
 
-    }
-  }
-  return unpadded;
+  NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(ux*uy,get_num_threads()))
+  for(int i=0; i<ux; i++)
+    memcpy(result.array+i*uy, array+(i+x_add)*ny+y_add,
+	   sizeof(FFTW_COMPLEX)*uy);
 }
 
 template<class T>
-void ComplexR_2D<T>::initialise_fft(){
+void ComplexR_2D<T>::perform_forward_fft(){
 
-#if defined(MULTI_THREADED) 		
-  int numthreads=FFTW_INIT_THREADS(); 		
-  FFTW_PLAN_WITH_NTHREADS(NUM_THREADS); 		
-#endif
-  //creating the plan will erase the content of the array
-  //so we need to be a bit tricky here.
-  FFTW_COMPLEX *tmp_array;
-  tmp_array = (FFTW_COMPLEX*) FFTW_MALLOC(sizeof(FFTW_COMPLEX)*nx*ny);
-  //make the plans
-  f_backward = FFTW_PLAN_DFT_2D(nx, ny, tmp_array, tmp_array,
-				FFTW_BACKWARD, fftw_type);
-  f_forward = FFTW_PLAN_DFT_2D(nx, ny,tmp_array,tmp_array,
-			       FFTW_FORWARD, fftw_type);
-  std::memcpy(tmp_array,array,sizeof(FFTW_COMPLEX)*nx*ny);
-  FFTW_FREE(array);
+  //the plan is only created the first time this size is transformed.
+  FFTW_EXECUTE_DFT(FFTWPlanCache::get_plan(nx, ny, FFTW_FORWARD,
+					   fftw_type, array,
+					   get_num_threads()),
+		   array, array);
 
+}
 
-  array = tmp_array;
+template<class T>
+void ComplexR_2D<T>::perform_backward_fft(){
 
+  FFTW_EXECUTE_DFT(FFTWPlanCache::get_plan(nx, ny, FFTW_BACKWARD,
+					   fftw_type, array,
+					   get_num_threads()),
+		   array, array);
 }
 
+
 template<class T>
-void ComplexR_2D<T>::perform_forward_fft(){
+void ComplexR_2D<T>::perform_forward_fft_centred(){
 
-  //make a new forward fft plan if we haven't made one already.
-  if(f_forward==0 )
-    initialise_fft();  
-  FFTW_EXECUTE(f_forward);
+  //the checkerboard trick only works for even dimensions
+  if(nx%2==1 || ny%2==1){
+    perform_forward_fft();
+    invert(true);
+    return;
+  }
 
+  checkerboard(1.0/sqrt((double)nx*ny));
+  perform_forward_fft();
 }
 
 template<class T>
-void ComplexR_2D<T>::perform_backward_fft(){
+void ComplexR_2D<T>::perform_backward_fft_centred(){
 
-  //make a new backward fft plan if we haven't made one already.
-  if(f_backward==0)
-    initialise_fft();
-  FFTW_EXECUTE(f_backward);
-}
+  if(nx%2==1 || ny%2==1){
+    invert(true);
+    perform_backward_fft();
+    return;
+  }
 
+  perform_backward_fft();
+  checkerboard(1.0/sqrt((double)nx*ny));
+}
 
-//this object is fourier transformed and the result placed in 'result'
+//this object (a half spectrum) is fourier transformed and the result
+//placed in 'result'
 template<class T>
 void ComplexR_2D<T>::perform_backward_fft_real(Double_2D & result){
- 
-  FFTW_PLAN fftw;
-  fftw=FFTW_PLAN_DFT_C2R_2D(nx,ny,array,result.array,FFTW_ESTIMATE);
-  FFTW_EXECUTE(fftw);
-  FFTW_DESTROY_PLAN(fftw);
+
+  const int rx = result.get_size_x();
+  const int ry = result.get_size_y();
+
+  if(nx!=rx || ny!=ry/2+1){
+    cout << "The complex array (" << nx << "x" << ny << ") is not the "
+	 << "half spectrum of a " << rx << "x" << ry << " real array "
+	 << "in perform_backward_fft_real. Exiting..." << endl;
+    exit(1);
+  }
+
+  FFTW_EXECUTE_DFT_C2R(FFTWPlanCache::get_real_plan(rx, ry, FFTW_BACKWARD,
+						     fftw_type,
+						     result.array, array,
+						     get_num_threads()),
+		       array, result.array);
 }
 
-//'result' is fourier transformed and the result placed in this object
+//'input' is fourier transformed and the half spectrum placed in this
+//object
 template<class T>
-void  ComplexR_2D<T>::perform_forward_fft_real(Double_2D & input){
-  FFTW_PLAN fftw;
-  fftw=FFTW_PLAN_DFT_R2C_2D(nx,ny,input.array,array,FFTW_ESTIMATE);
-  FFTW_EXECUTE(fftw);
-  FFTW_DESTROY_PLAN(fftw);
+void  ComplexR_2D<T>::perform_forward_fft_real(const Double_2D & input){
+
+  const int rx = input.get_size_x();
+  const int ry = input.get_size_y();
+
+  resize(rx, ry/2+1);
+
+  FFTW_EXECUTE_DFT_R2C(FFTWPlanCache::get_real_plan(rx, ry, FFTW_FORWARD,
+						     fftw_type,
+						     input.array, array,
+						     get_num_threads()),
+		       input.array, array);
 }
 
 #ifdef DOUBLE_PRECISION
@@ -0,0 +1,307 @@
+// Copyright 2011 Nadia Davidson for The ARC Centre of Excellence in
+// Coherent X-ray Science. This program is distributed under the GNU
+// General Public License. We also ask that you cite this software in
+// publications where you made use of it for any part of the data
+// analysis.
+
+#include <iostream>
+#include <cstdlib>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+#include <FFTWPlanCache.h>
+
+using namespace std;
+
+map<FFTWPlanCache::PlanKey,FFTW_PLAN> FFTWPlanCache::plans;
+pthread_mutex_t FFTWPlanCache::mutex = PTHREAD_MUTEX_INITIALIZER;
+string FFTWPlanCache::wisdom_file = "";
+bool FFTWPlanCache::wisdom_initialised = false;
+bool FFTWPlanCache::wisdom_changed = false;
+
+//registered with atexit() once a wisdom file is set
+static void save_wisdom_at_exit(){
+  FFTWPlanCache::save_wisdom();
+}
+
+void FFTWPlanCache::use_wisdom_file(const string & file_name){
+
+  static bool save_at_exit = false;
+
+  wisdom_file = file_name;
+  if(wisdom_file!="" && !save_at_exit){
+    atexit(save_wisdom_at_exit);
+    save_at_exit = true;
+  }
+}
+
+int FFTWPlanCache::write_wisdom(const string & file_name){
+
+  //write the wisdom beside the file and then move it into place, so
+  //another program reading (or writing) the file never sees it half
+  //written.
+  ostringstream temp;
+  temp << file_name << "." << getpid() << ".tmp";
+
+  pthread_mutex_lock(&mutex);
+  int status = FFTW_EXPORT_WISDOM_TO_FILENAME(temp.str().c_str());
+  pthread_mutex_unlock(&mutex);
+
+  if(!status || rename(temp.str().c_str(), file_name.c_str())!=0){
+    remove(temp.str().c_str());
+    return FAILURE;
+  }
+  return SUCCESS;
+}
+
+void FFTWPlanCache::initialise_wisdom(){
+
+  if(wisdom_initialised)
+    return;
+  wisdom_initialised = true;
+
+  const char * env_file = getenv("NADIA_FFTW_WISDOM");
+  if(env_file==0 || env_file[0]=='\0')
+    return;
+
+  use_wisdom_file(env_file);
+  ifstream test(env_file);
+  if(test.good() && !FFTW_IMPORT_WISDOM_FROM_FILENAME(env_file))
+    cout << "WARNING: Could not read the fftw wisdom file "
+	 << env_file << endl;
+}
+
+FFTW_PLAN FFTWPlanCache::get_plan(int nx, int ny, int direction,
+				  int flags, FFTW_COMPLEX * array,
+				  int threads){
+
+  //plans made for aligned arrays can't be used on unaligned ones.
+  if(array && FFTW_ALIGNMENT_OF(array)!=0)
+    flags |= FFTW_UNALIGNED;
+
+  PlanKey key;
+  key.nx = nx;
+  key.ny = ny;
+  key.direction = direction;
+  key.flags = flags;
+  key.howmany = 1;
+  key.real = false;
+
+  return find_or_make_plan(key, threads);
+}
+
+FFTW_PLAN FFTWPlanCache::get_many_plan(int nx, int ny, int howmany,
+				       int direction, int flags,
+				       FFTW_COMPLEX * array, int threads){
+
+  if(array && FFTW_ALIGNMENT_OF(array)!=0)
+    flags |= FFTW_UNALIGNED;
+
+  PlanKey key;
+  key.nx = nx;
+  key.ny = ny;
+  key.direction = direction;
+  key.flags = flags;
+  key.howmany = howmany;
+  key.real = false;
+
+  return find_or_make_plan(key, threads);
+}
+
+FFTW_PLAN FFTWPlanCache::get_real_plan(int nx, int ny, int direction,
+				       int flags, FFTW_REAL * real,
+				       FFTW_COMPLEX * complex,
+				       int threads){
+
+  if((real && FFTW_ALIGNMENT_OF(real)!=0) ||
+     (complex && FFTW_ALIGNMENT_OF(complex)!=0))
+    flags |= FFTW_UNALIGNED;
+
+  PlanKey key;
+  key.nx = nx;
+  key.ny = ny;
+  key.direction = direction;
+  key.flags = flags;
+  key.howmany = 1;
+  key.real = true;
+
+  return find_or_make_plan(key, threads);
+}
+
+FFTW_PLAN FFTWPlanCache::find_or_make_plan(PlanKey & key, int threads){
+
+#if defined(MULTI_THREADED)
+  key.threads = threads < 1 ? 1 : threads;
+#else
+  (void) threads;
+  key.threads = 1;
+#endif
+
+  pthread_mutex_lock(&mutex);
+
+  map<PlanKey,FFTW_PLAN>::iterator it = plans.find(key);
+  if(it!=plans.end()){
+    FFTW_PLAN plan = it->second;
+    pthread_mutex_unlock(&mutex);
+    return plan;
+  }
+
+  initialise_wisdom();
+
+#if defined(MULTI_THREADED)
+  static bool threads_initialised = false;
+  if(!threads_initialised){
+    FFTW_INIT_THREADS();
+    threads_initialised = true;
+  }
+  FFTW_PLAN_WITH_NTHREADS(key.threads);
+#endif
+
+  FFTW_PLAN plan = make_plan(key);
+
+  if(plan==0){
+    pthread_mutex_unlock(&mutex);
+    cout << "fftw failed to create a plan for an array of size "
+	 << key.nx << "x" << key.ny << ". Exiting..." << endl;
+    exit(1);
+  }
+
+  plans[key] = plan;
+
+  //the new plan is saved by save_wisdom(), so the next run doesn't
+  //have to make it.
+  if(wisdom_file!="")
+    wisdom_changed = true;
+
+  pthread_mutex_unlock(&mutex);
+  return plan;
+}
+
+FFTW_PLAN FFTWPlanCache::make_plan(const PlanKey & key){
+
+  const int nx = key.nx;
+  const int ny = key.ny;
+
+  //creating the plan will erase the content of the arrays it is
+  //made with, so plan on scratch arrays instead.
+  if(!key.real && key.howmany==1){
+    FFTW_COMPLEX * scratch;
+    scratch = (FFTW_COMPLEX*) FFTW_MALLOC(sizeof(FFTW_COMPLEX)*nx*ny);
+    FFTW_PLAN plan = FFTW_PLAN_DFT_2D(nx, ny, scratch, scratch,
+				      key.direction, key.flags);
+    FFTW_FREE(scratch);
+    return plan;
+  }
+
+  if(!key.real){
+    int size[2] = {nx, ny};
+    FFTW_COMPLEX * scratch;
+    scratch = (FFTW_COMPLEX*) FFTW_MALLOC(sizeof(FFTW_COMPLEX)*nx*ny*
+					  key.howmany);
+    FFTW_PLAN plan = FFTW_PLAN_MANY_DFT(2, size, key.howmany,
+					scratch, 0, 1, nx*ny,
+					scratch, 0, 1, nx*ny,
+					key.direction, key.flags);
+    FFTW_FREE(scratch);
+    return plan;
+  }
+
+  FFTW_REAL * real_scratch;
+  FFTW_COMPLEX * complex_scratch;
+  real_scratch = (FFTW_REAL*) FFTW_MALLOC(sizeof(FFTW_REAL)*nx*ny);
+  complex_scratch = (FFTW_COMPLEX*) FFTW_MALLOC(sizeof(FFTW_COMPLEX)*
+						nx*(ny/2+1));
+  FFTW_PLAN plan;
+  if(key.direction==FFTW_FORWARD)
+    plan = FFTW_PLAN_DFT_R2C_2D(nx, ny, real_scratch, complex_scratch,
+				key.flags);
+  else
+    plan = FFTW_PLAN_DFT_C2R_2D(nx, ny, complex_scratch, real_scratch,
+				key.flags);
+  FFTW_FREE(real_scratch);
+  FFTW_FREE(complex_scratch);
+  return plan;
+}
+
+int FFTWPlanCache::set_wisdom_file(const string & file_name){
+
+  int status = SUCCESS;
+
+  pthread_mutex_lock(&mutex);
+  wisdom_initialised = true;
+  use_wisdom_file(file_name);
+  if(wisdom_file!=""){
+    ifstream test(wisdom_file.c_str());
+    if(test.good() && 
+       !FFTW_IMPORT_WISDOM_FROM_FILENAME(wisdom_file.c_str())){
+      cout << "WARNING: Could not read the fftw wisdom file "
+	   << wisdom_file << endl;
+      status = FAILURE;
+    }
+  }
+  pthread_mutex_unlock(&mutex);
+
+  return status;
+}
+
+string FFTWPlanCache::get_wisdom_file(){
+  pthread_mutex_lock(&mutex);
+  string file_name = wisdom_file;
+  pthread_mutex_unlock(&mutex);
+  return file_name;
+}
+
+int FFTWPlanCache::import_wisdom(const string & file_name){
+  pthread_mutex_lock(&mutex);
+  int status = FFTW_IMPORT_WISDOM_FROM_FILENAME(file_name.c_str());
+  pthread_mutex_unlock(&mutex);
+  return status ? SUCCESS : FAILURE;
+}
+
+int FFTWPlanCache::export_wisdom(const string & file_name){
+  return write_wisdom(file_name);
+}
+
+int FFTWPlanCache::save_wisdom(){
+
+  pthread_mutex_lock(&mutex);
+  string file_name = wisdom_file;
+  bool changed = wisdom_changed;
+  wisdom_changed = false;
+
+  //other programs may have added to the file since it was read, so
+  //their wisdom is merged in rather than written over.
+  if(file_name!="" && changed){
+    ifstream test(file_name.c_str());
+    if(test.good())
+      FFTW_IMPORT_WISDOM_FROM_FILENAME(file_name.c_str());
+  }
+  pthread_mutex_unlock(&mutex);
+
+  if(file_name=="" || !changed)
+    return SUCCESS;
+
+  if(write_wisdom(file_name)==FAILURE){
+    cout << "WARNING: Could not write the fftw wisdom file "
+	 << file_name << endl;
+    return FAILURE;
+  }
+  return SUCCESS;
+}
+
+int FFTWPlanCache::get_size(){
+  pthread_mutex_lock(&mutex);
+  int size = plans.size();
+  pthread_mutex_unlock(&mutex);
+  return size;
+}
+
+void FFTWPlanCache::clear(){
+  pthread_mutex_lock(&mutex);
+  map<PlanKey,FFTW_PLAN>::iterator it;
+  for(it=plans.begin(); it!=plans.end(); ++it)
+    FFTW_DESTROY_PLAN(it->second);
+  plans.clear();
+  pthread_mutex_unlock(&mutex);
+}
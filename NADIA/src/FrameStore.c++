@@ -0,0 +1,207 @@
+// Copyright 2011 Nadia Davidson for The ARC Centre of Excellence in
+// Coherent X-ray Science. This program is distributed under the GNU
+// General Public License. We also ask that you cite this software in
+// publications where you made use of it for any part of the data
+// analysis.
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <FrameStore.h>
+
+using namespace std;
+
+//each array in a region starts on a cache line, which is enough for
+//the SIMD alignment fftw and Double_2D want.
+static size_t align_size(size_t bytes){
+  return (bytes + REAL_2D_ALIGNMENT - 1) & ~(size_t)(REAL_2D_ALIGNMENT - 1);
+}
+
+FrameStore::FrameStore(const char * directory)
+  : fd(-1), file_size(0), prefetch_frame(-1){
+
+  if(!directory)
+    directory = getenv("TMPDIR");
+  if(!directory || !*directory)
+    directory = "/tmp";
+
+  string name = string(directory) + "/nadia_frames_XXXXXX";
+  vector<char> buff(name.begin(), name.end());
+  buff.push_back('\0');
+
+  fd = mkstemp(&buff[0]);
+  if(fd < 0){
+    cout << "Could not make the scratch file " << &buff[0]
+	 << " for the frames. Exiting..." << endl;
+    exit(1);
+  }
+
+  //nothing else needs the name, and this way the file is removed
+  //however the program ends.
+  unlink(&buff[0]);
+}
+
+FrameStore::~FrameStore(){
+  wait();
+  for(unsigned int f=0; f < region_start.size(); f++){
+    for(unsigned int r=0; r < region_start[f].size(); r++)
+      munmap(region_start[f][r], region_size[f][r]);
+  }
+  if(fd >= 0)
+    close(fd);
+}
+
+void FrameStore::add_arrays(int frame,
+			    const vector<Complex_2D*> & complex_arrays,
+			    const vector<Double_2D*> & real_arrays){
+
+  if(frame < 0 || frame > (int) region_start.size()){
+    cout << "In FrameStore::add_arrays, there is no frame "
+	 << frame << ". Exiting..." << endl;
+    exit(1);
+  }
+
+  //the table of regions is about to change under the prefetch thread
+  wait();
+
+  //the arrays which need to be moved, and the size of the region
+  vector<Complex_2D*> new_complex;
+  vector<Double_2D*> new_real;
+  size_t bytes = 0;
+
+  for(unsigned int a=0; a < complex_arrays.size(); a++){
+    Complex_2D * c = complex_arrays[a];
+    if(!c || (frame < (int) region_start.size() 
+	      && contains(frame, c->get_array())))
+      continue;
+    new_complex.push_back(c);
+    bytes += align_size(sizeof(FFTW_COMPLEX)*c->get_size_x()*c->get_size_y());
+  }
+  for(unsigned int a=0; a < real_arrays.size(); a++){
+    Double_2D * r = real_arrays[a];
+    if(!r || (frame < (int) region_start.size()
+	      && contains(frame, r->get_array())))
+      continue;
+    new_real.push_back(r);
+    bytes += align_size(sizeof(Double_2D::value_type)
+			*r->get_size_x()*r->get_size_y());
+  }
+
+  if(frame == (int) region_start.size()){
+    region_start.push_back(vector<char *>());
+    region_size.push_back(vector<size_t>());
+  }
+
+  if(bytes == 0)
+    return;
+
+  //regions start on a page, as mmap needs
+  size_t page = sysconf(_SC_PAGESIZE);
+  bytes = (bytes + page - 1)/page*page;
+
+  if(ftruncate(fd, file_size + bytes)!=0){
+    cout << "Could not extend the scratch file for the frames to "
+	 << file_size + bytes << " bytes. Exiting..." << endl;
+    exit(1);
+  }
+
+  void * memory = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_SHARED,
+		       fd, file_size);
+  if(memory == MAP_FAILED){
+    cout << "Could not map the scratch file for the frames. "
+	 << "Exiting..." << endl;
+    exit(1);
+  }
+
+  file_size += bytes;
+  region_start[frame].push_back((char *) memory);
+  region_size[frame].push_back(bytes);
+
+  //move the arrays in
+  char * next = (char *) memory;
+  for(unsigned int a=0; a < new_complex.size(); a++){
+    Complex_2D * c = new_complex[a];
+    c->move_to((FFTW_COMPLEX *) next);
+    next += align_size(sizeof(FFTW_COMPLEX)*c->get_size_x()*c->get_size_y());
+  }
+  for(unsigned int a=0; a < new_real.size(); a++){
+    Double_2D * r = new_real[a];
+    r->move_to((Double_2D::value_type *) next);
+    next += align_size(sizeof(Double_2D::value_type)
+		       *r->get_size_x()*r->get_size_y());
+  }
+
+}
+
+bool FrameStore::contains(int frame, const void * memory) const{
+  if(frame < 0 || frame >= (int) region_start.size())
+    return false;
+  const char * m = (const char *) memory;
+  for(unsigned int r=0; r < region_start[frame].size(); r++){
+    if(m >= region_start[frame][r]
+       && m < region_start[frame][r] + region_size[frame][r])
+      return true;
+  }
+  return false;
+}
+
+void * FrameStore::read_frame(void * store){
+
+  FrameStore * s = (FrameStore *) store;
+  const vector<char *> & start = s->region_start[s->prefetch_frame];
+  const vector<size_t> & size = s->region_size[s->prefetch_frame];
+  size_t page = sysconf(_SC_PAGESIZE);
+
+  for(unsigned int r=0; r < start.size(); r++){
+#ifdef MADV_WILLNEED
+    madvise(start[r], size[r], MADV_WILLNEED);
+#endif
+    //touching a byte of each page brings it in, even when the
+    //read-ahead above is ignored.
+    volatile char sum = 0;
+    for(size_t b=0; b < size[r]; b+=page)
+      sum += start[r][b];
+  }
+
+  return 0;
+}
+
+void FrameStore::prefetch(int frame){
+
+  wait();
+
+  if(frame < 0 || frame >= (int) region_start.size())
+    return;
+
+  prefetch_frame = frame;
+  if(pthread_create(&prefetch_thread, 0, read_frame, this)!=0){
+    //not being able to read ahead only costs time.
+    prefetch_frame = -1;
+  }
+}
+
+void FrameStore::wait(){
+  if(prefetch_frame < 0)
+    return;
+  pthread_join(prefetch_thread, 0);
+  prefetch_frame = -1;
+}
+
+void FrameStore::release(int frame){
+
+  if(frame < 0 || frame >= (int) region_start.size())
+    return;
+
+  //a frame being read in the background is about to be used.
+  if(frame == prefetch_frame)
+    return;
+
+  //the mapping is shared with the file, so the values aren't lost:
+  //changed pages are written back and read again when next used.
+#ifdef MADV_DONTNEED
+  for(unsigned int r=0; r < region_start[frame].size(); r++)
+    madvise(region_start[frame][r], region_size[frame][r], MADV_DONTNEED);
+#endif
+}
@@ -11,6 +11,7 @@
 #include <io.h> //
 #include <sstream>
 #include <utils.h>
+#include <Parallel.h>
 
 using namespace std;
 
@@ -100,21 +101,22 @@ void FresnelCDI::multiply_factors(Complex_2D & c, int direction){
   double x_mid = (nx-1)/2.0;
   double y_mid = (ny-1)/2.0;
 
-  double old_real, old_imag;
-  double coef_real, coef_imag;
-  int i_, j_;
-
+  //the coefficients are symmetric about the centre, so only one
+  //quadrant of them is used.
+  NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(nx*ny,c.get_num_threads()))
   for(int i=0; i<nx; i++){
+
+    int i_ = x_mid - fabs(x_mid - i);
+
     for(int j=0; j<ny; j++){
 
-      old_real = c.get_real(i,j);
-      old_imag = c.get_imag(i,j);
+      double old_real = c.get_real(i,j);
+      double old_imag = c.get_imag(i,j);
 
-      int i_ = x_mid - fabs(x_mid - i);
       int j_ = y_mid - fabs(y_mid - j);
 
-      coef_real = coefficient.get_real(i_,j_);
-      coef_imag = direction*coefficient.get_imag(i_,j_);
+      double coef_real = coefficient.get_real(i_,j_);
+      double coef_imag = direction*coefficient.get_imag(i_,j_);
 
       c.set_real(i,j,old_real*coef_real - old_imag*coef_imag);
       c.set_imag(i,j,old_imag*coef_real + old_real*coef_imag);
@@ -200,11 +202,35 @@ void FresnelCDI::initialise_estimate(int seed){
   
 }
 
+void FresnelCDI::get_state_arrays(vector<Complex_2D*> & complex_arrays,
+				  vector<Double_2D*> & real_arrays){
+
+  BaseCDI::get_state_arrays(complex_arrays, real_arrays);
+
+  complex_arrays.push_back(&illumination);
+  complex_arrays.push_back(&coefficient);
+  if(illumination_at_sample)
+    complex_arrays.push_back(illumination_at_sample);
+}
+
+void FresnelCDI::release_workspace(){
+
+  BaseCDI::release_workspace();
+
+  if(transmission){
+    delete transmission;
+    transmission = 0;
+  }
+}
+
 void FresnelCDI::apply_support(Complex_2D & c){
+
+  NADIA_PROFILE(profile, Profiler::APPLY_SUPPORT);
   
   support_constraint(c);
   
   if(transmission_constraint){
+    NADIA_PROFILE(profile, Profiler::TRANSMISSION_CONSTRAINT);
     if(!transmission)
       transmission = new Complex_2D(nx,ny);
 
@@ -223,15 +249,15 @@ void FresnelCDI::scale_intensity(Complex_2D & c){
   //c.get_2d(PHASE,result);
   //write_image("before_p.tiff",result);
   
-  c.add(illumination); //add the white field
+  //the white field is added before scaling and subtracted
+  //afterwards, in the same pass.
+  double norm2_mag=0;
+  double norm2_diff=0;
 
-  //c.get_2d(REAL,result);
-  //write_image("after_r.tiff",result);
-  //c.get_2d(MAG_SQ,result);
-  //write_image("after_mag.tiff",result);
-  BaseCDI::scale_intensity(c);
+  c.project_modulus(intensity_sqrt, beam_stop, norm2_mag, norm2_diff,
+		    0, &illumination);
 
-  c.add(illumination,-1.0);//subtract the white field
+  current_error = (norm2_diff/norm2_mag);
 
 }
 
@@ -262,17 +288,13 @@ void FresnelCDI::set_transmission_function(Complex_2D & transmission,
     propagate_from_detector(*illumination_at_sample);
     }**/
 
-  double ill_r;
-  double trans_r;
-  double ill_i;
-  double trans_i;
-  
+  NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(nx*ny,esw->get_num_threads()))
   for(int i=0; i<nx; i++){
-    for(int j=0; j<nx; j++){
-      ill_r = illumination_at_sample->get_real(i,j);
-      trans_r = transmission.get_real(i,j);
-      ill_i = illumination_at_sample->get_imag(i,j);
-      trans_i = transmission.get_imag(i,j);
+    for(int j=0; j<ny; j++){
+      double ill_r = illumination_at_sample->get_real(i,j);
+      double trans_r = transmission.get_real(i,j);
+      double ill_i = illumination_at_sample->get_imag(i,j);
+      double trans_i = transmission.get_imag(i,j);
    
       // ESW = TL - L
       // T - transmission function, L - illumination
@@ -308,31 +330,20 @@ void FresnelCDI::get_transmission_function(Complex_2D & result,
     esw=&complex;
   check_illumination_at_sample();
 
-  double ill_r;
-  double esw_r;
-  double ill_i;
-  double esw_i;
-  
-  //  double combined_r;
-  //double combined_i;
-
-  double real_numerator;
-  double imag_numerator;
-  double denom;
-
+  NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(nx*ny,esw->get_num_threads()))
   for(int i=0; i<nx; i++){
     for(int j=0; j<ny; j++){
    
-      ill_r = illumination_at_sample->get_real(i,j);
-      ill_i = illumination_at_sample->get_imag(i,j);
-      denom = ill_r*ill_r + ill_i*ill_i;
+      double ill_r = illumination_at_sample->get_real(i,j);
+      double ill_i = illumination_at_sample->get_imag(i,j);
+      double denom = ill_r*ill_r + ill_i*ill_i;
       if(denom!=0){
   
-	esw_r = esw->get_real(i,j);
-	esw_i = esw->get_imag(i,j);
+	double esw_r = esw->get_real(i,j);
+	double esw_i = esw->get_imag(i,j);
 
-	real_numerator = ill_r*(esw_r+ill_r) + ill_i*(esw_i+ill_i);
-	imag_numerator = ill_r*(esw_i+ill_i) - ill_i*(esw_r+ill_r);
+	double real_numerator = ill_r*(esw_r+ill_r) + ill_i*(esw_i+ill_i);
+	double imag_numerator = ill_r*(esw_i+ill_i) - ill_i*(esw_r+ill_r);
 
 	result.set_real(i,j,real_numerator/denom);
 	result.set_imag(i,j,imag_numerator/denom);
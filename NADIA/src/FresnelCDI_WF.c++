@@ -121,12 +121,17 @@ void FresnelCDI_WF::initialise_estimate(int seed){
 
 int FresnelCDI_WF::iterate(){
 
+  NADIA_PROFILE(profile, Profiler::ITERATE);
+
   //Double_2D result(nx,ny);
   
   // complex.get_2d(PHASE,result);
   // write_ppm("b0.ppm",result);
 
-  propagate_from_detector(complex);
+  {
+    NADIA_PROFILE(profile, Profiler::PROPAGATE_FROM_DETECTOR);
+    propagate_from_detector(complex);
+  }
 
   // complex.get_2d(PHASE,result);
   // write_ppm("b1.ppm",result);
@@ -136,11 +141,15 @@ int FresnelCDI_WF::iterate(){
   //  complex.get_2d(PHASE,result);
   // write_ppm("b3.ppm",result);
   
-  propagate_to_detector(complex);
+  {
+    NADIA_PROFILE(profile, Profiler::PROPAGATE_TO_DETECTOR);
+    propagate_to_detector(complex);
+  }
 
   //  complex.get_2d(PHASE,result);
   // write_ppm("b4.ppm",result);
   
+  NADIA_PROFILE(profile, Profiler::SCALE_INTENSITY);
   scale_intensity(complex);
 
   //  complex.get_2d(PHASE,result);
@@ -0,0 +1,234 @@
+// Copyright 2012 T'Mir Julius for The ARC Centre of Excellence in
+// Coherent X-ray Science. This program is distributed under the GNU
+// General Public License. We also ask that you cite this software in
+// publications where you made use of it for any part of the data
+// analysis.
+
+#include <iostream>
+#include <types.h>
+#include <GEPSolver.h>
+
+using namespace std;
+
+extern"C" {
+
+  void zhegv_(int *itype, char *jobz, char *uplo, int *n,
+	      double *a, int *lda, double *b, int *ldb,
+	      double *w, double *work, int *lwork, double *rwork,
+	      int *info);
+
+  void zhegvd_(int *itype, char *jobz, char *uplo, int *n,
+	       double *a, int *lda, double *b, int *ldb,
+	       double *w, double *work, int *lwork, double *rwork,
+	       int *lrwork, int *iwork, int *liwork, int *info);
+
+}
+
+map<GEPSolver::SolutionKey,GEPSolver::Solution> GEPSolver::solutions;
+list<GEPSolver::SolutionKey> GEPSolver::solution_order;
+unsigned int GEPSolver::max_solutions = 16;
+int GEPSolver::divide_and_conquer_size = 100;
+pthread_mutex_t GEPSolver::mutex = PTHREAD_MUTEX_INITIALIZER;
+
+//copy between a Complex_2D and a fortran (column major) complex
+//matrix. Element (j,i) of c is row j, column i.
+static void to_fortran(const Complex_2D & c, double * fort){
+  int n = c.get_size_x();
+  for(int i=0; i<n; i++){
+    for(int j=0; j<n; j++){
+      fort[2*(j+n*i)]=c.get_real(j,i);
+      fort[2*(j+n*i)+1]=c.get_imag(j,i);
+    }
+  }
+}
+
+static void from_fortran(const double * fort, Complex_2D & c){
+  int n = c.get_size_x();
+  for(int i=0; i<n; i++){
+    for(int j=0; j<n; j++){
+      c.set_real(j,i, fort[2*(j+n*i)]);
+      c.set_imag(j,i, fort[2*(j+n*i)+1]);
+    }
+  }
+}
+
+int GEPSolver::solve(Complex_2D & A, Complex_2D & B,
+		     vector<double> & eigen){
+
+  if(A.get_size_x()!=B.get_size_x()||A.get_size_y()!=B.get_size_y()
+     ||A.get_size_x()!=A.get_size_y()){
+    cout << "The matrices are the wrong size to solve. "
+	 << "Something is amiss." << endl;
+    return FAILURE;
+  }
+
+  int ITYPE=1;
+  char UPLO='L';
+  char JOB='V';
+  int N=A.get_size_x();
+  int LDA=N;
+  int LDB=N;
+  int INFO=0;
+
+  vector<double> Afort(2*N*N);
+  vector<double> Bfort(2*N*N);
+  vector<double> eigenfort(N);
+
+  to_fortran(A, &Afort[0]);
+  to_fortran(B, &Bfort[0]);
+
+  pthread_mutex_lock(&mutex);
+  bool divide_and_conquer = N >= divide_and_conquer_size;
+  pthread_mutex_unlock(&mutex);
+
+  //ask LAPACK how much workspace it wants (LWORK=-1), then solve.
+  //The work array is complex, so it has two doubles per element.
+  int LWORK=-1;
+  double work_size[2];
+
+  if(divide_and_conquer){
+    int LRWORK=-1;
+    int LIWORK=-1;
+    double rwork_size;
+    int iwork_size;
+
+    zhegvd_(&ITYPE, &JOB, &UPLO, &N, &Afort[0], &LDA, &Bfort[0], &LDB,
+	    &eigenfort[0], work_size, &LWORK, &rwork_size, &LRWORK,
+	    &iwork_size, &LIWORK, &INFO);
+
+    if(INFO==0){
+      LWORK = (int) work_size[0];
+      LRWORK = (int) rwork_size;
+      LIWORK = iwork_size;
+      vector<double> WORK(2*LWORK);
+      vector<double> RWORK(LRWORK);
+      vector<int> IWORK(LIWORK);
+
+      zhegvd_(&ITYPE, &JOB, &UPLO, &N, &Afort[0], &LDA, &Bfort[0], &LDB,
+	      &eigenfort[0], &WORK[0], &LWORK, &RWORK[0], &LRWORK,
+	      &IWORK[0], &LIWORK, &INFO);
+    }
+  }
+  else{
+    vector<double> RWORK(N>1 ? 3*N-2 : 1);
+
+    zhegv_(&ITYPE, &JOB, &UPLO, &N, &Afort[0], &LDA, &Bfort[0], &LDB,
+	   &eigenfort[0], work_size, &LWORK, &RWORK[0], &INFO);
+
+    if(INFO==0){
+      LWORK = (int) work_size[0];
+      vector<double> WORK(2*LWORK);
+
+      zhegv_(&ITYPE, &JOB, &UPLO, &N, &Afort[0], &LDA, &Bfort[0], &LDB,
+	     &eigenfort[0], &WORK[0], &LWORK, &RWORK[0], &INFO);
+    }
+  }
+
+  if(INFO!=0){
+    cout << "LAPACK could not solve the eigenproblem (info="
+	 << INFO << ")";
+    if(INFO > N)
+      cout << ", the S matrix is not positive definite";
+    cout << "." << endl;
+    return FAILURE;
+  }
+
+  eigen.insert(eigen.end(), eigenfort.begin(), eigenfort.end());
+  from_fortran(&Afort[0], A);
+  from_fortran(&Bfort[0], B);
+
+  return SUCCESS;
+}
+
+bool GEPSolver::find_solution(int nleg, int nmode, double lcx, double lcy,
+			      Complex_2D & vectors, vector<double> & eigen){
+
+  SolutionKey key;
+  key.nleg = nleg;
+  key.nmode = nmode;
+  key.lcx = lcx;
+  key.lcy = lcy;
+
+  pthread_mutex_lock(&mutex);
+
+  map<SolutionKey,Solution>::const_iterator it = solutions.find(key);
+  bool found = it!=solutions.end()
+    && it->second.size==vectors.get_size_x()
+    && it->second.size==vectors.get_size_y();
+
+  if(found){
+    from_fortran(&it->second.vectors[0], vectors);
+    eigen.insert(eigen.end(), it->second.eigen.begin(),
+		 it->second.eigen.end());
+  }
+
+  pthread_mutex_unlock(&mutex);
+
+  return found;
+}
+
+void GEPSolver::add_solution(int nleg, int nmode, double lcx, double lcy,
+			     const Complex_2D & vectors,
+			     const vector<double> & eigen){
+
+  SolutionKey key;
+  key.nleg = nleg;
+  key.nmode = nmode;
+  key.lcx = lcx;
+  key.lcy = lcy;
+
+  int n = vectors.get_size_x();
+
+  pthread_mutex_lock(&mutex);
+
+  if(max_solutions==0){
+    pthread_mutex_unlock(&mutex);
+    return;
+  }
+
+  if(solutions.find(key)==solutions.end()){
+    while(solutions.size() >= max_solutions){
+      solutions.erase(solution_order.front());
+      solution_order.pop_front();
+    }
+    solution_order.push_back(key);
+  }
+
+  Solution & solution = solutions[key];
+  solution.size = n;
+  solution.vectors.resize(2*n*n);
+  to_fortran(vectors, &solution.vectors[0]);
+  solution.eigen = eigen;
+
+  pthread_mutex_unlock(&mutex);
+}
+
+void GEPSolver::set_divide_and_conquer_size(int size){
+  pthread_mutex_lock(&mutex);
+  divide_and_conquer_size = size;
+  pthread_mutex_unlock(&mutex);
+}
+
+void GEPSolver::set_max_solutions(unsigned int n){
+  pthread_mutex_lock(&mutex);
+  max_solutions = n;
+  while(solutions.size() > max_solutions){
+    solutions.erase(solution_order.front());
+    solution_order.pop_front();
+  }
+  pthread_mutex_unlock(&mutex);
+}
+
+int GEPSolver::get_size(){
+  pthread_mutex_lock(&mutex);
+  int size = solutions.size();
+  pthread_mutex_unlock(&mutex);
+  return size;
+}
+
+void GEPSolver::clear(){
+  pthread_mutex_lock(&mutex);
+  solutions.clear();
+  solution_order.clear();
+  pthread_mutex_unlock(&mutex);
+}
@@ -0,0 +1,415 @@
+// Copyright 2011 Nadia Davidson for The ARC Centre of Excellence in
+// Coherent X-ray Science. This program is distributed under the GNU
+// General Public License. We also ask that you cite this software in
+// publications where you made use of it for any part of the data
+// analysis.
+
+#include <iostream>
+#include <cstdlib>
+#include <cmath>
+#include <Complex_2D.h>
+#include <GaussianFilter.h>
+
+using namespace std;
+
+map<GaussianFilter::KernelKey, vector<double> > GaussianFilter::kernels;
+pthread_mutex_t GaussianFilter::mutex = PTHREAD_MUTEX_INITIALIZER;
+
+int GaussianFilter::get_radius(double sigma, double kernel_size_in_std_dev){
+  sigma = fabs(sigma);
+  if(sigma==0)
+    return 0;
+  //the small offset stops rounding errors adding a point when
+  //sigma*kernel_size_in_std_dev is a whole number.
+  return (int) ceil(sigma*fabs(kernel_size_in_std_dev) - 1e-9);
+}
+
+vector<double> GaussianFilter::get_kernel(double sigma, int radius){
+
+  vector<double> kernel(2*radius+1);
+
+  double sum = 0;
+  for(int t=-radius; t<=radius; t++){
+    kernel[t+radius] = exp(-0.5*(t/sigma)*(t/sigma));
+    sum += kernel[t+radius];
+  }
+  for(int t=0; t<2*radius+1; t++)
+    kernel[t] /= sum;
+
+  return kernel;
+}
+
+int GaussianFilter::choose_method(int nx, int ny, double sigma_x,
+				  double sigma_y,
+				  double kernel_size_in_std_dev){
+
+  int radius_x = get_radius(sigma_x, kernel_size_in_std_dev);
+  int radius_y = get_radius(sigma_y, kernel_size_in_std_dev);
+
+  if(2*radius_x+1 <= GAUSSIAN_DIRECT_MAX_TAPS &&
+     2*radius_y+1 <= GAUSSIAN_DIRECT_MAX_TAPS)
+    return DIRECT;
+
+  //when the kernel is wider than the array, the padding would make
+  //the fourier transforms more than twice the size of the array.
+  //The recursive filter doesn't need any, but is only accurate when
+  //the kernel isn't truncated and isn't too narrow.
+  bool wider_than_array = radius_x > nx || radius_y > ny;
+
+  bool recursive_ok = fabs(kernel_size_in_std_dev) >=
+    GAUSSIAN_RECURSIVE_MIN_SIZE;
+  if(radius_x > 0 && fabs(sigma_x) < GAUSSIAN_RECURSIVE_MIN_SIGMA)
+    recursive_ok = false;
+  if(radius_y > 0 && fabs(sigma_y) < GAUSSIAN_RECURSIVE_MIN_SIGMA)
+    recursive_ok = false;
+
+  if(wider_than_array && recursive_ok)
+    return RECURSIVE;
+
+  return FOURIER;
+}
+
+void GaussianFilter::apply(const Double_2D & input, Double_2D & result,
+			   double sigma_x, double sigma_y,
+			   double kernel_size_in_std_dev, int type){
+
+  if(input.get_size_x()!=result.get_size_x() ||
+     input.get_size_y()!=result.get_size_y()){
+    cout << "The input and result of GaussianFilter::apply "
+	 << "must be the same size. Exiting..." << endl;
+    exit(1);
+  }
+
+  sigma_x = fabs(sigma_x);
+  sigma_y = fabs(sigma_y);
+
+  if(&input!=&result)
+    result.copy(input);
+
+  int radius_x = get_radius(sigma_x, kernel_size_in_std_dev);
+  int radius_y = get_radius(sigma_y, kernel_size_in_std_dev);
+
+  //nothing to do for a delta function.
+  if(radius_x==0 && radius_y==0)
+    return;
+
+  if(type==AUTO)
+    type = choose_method(input.get_size_x(), input.get_size_y(),
+			 sigma_x, sigma_y, kernel_size_in_std_dev);
+
+  switch(type){
+  case DIRECT:
+    apply_direct(result, sigma_x, sigma_y, radius_x, radius_y);
+    break;
+  case RECURSIVE:
+    apply_recursive(result, radius_x ? sigma_x : 0,
+		    radius_y ? sigma_y : 0);
+    break;
+  case FOURIER:
+    apply_fourier(result, sigma_x, sigma_y, radius_x, radius_y);
+    break;
+  default:
+    cout << "Unknown method " << type << " given to "
+	 << "GaussianFilter::apply. Exiting..." << endl;
+    exit(1);
+  }
+}
+
+void GaussianFilter::apply_direct(Double_2D & array, double sigma_x,
+				  double sigma_y, int radius_x,
+				  int radius_y){
+
+  typedef Double_2D::value_type T;
+
+  const int nx = array.get_size_x();
+  const int ny = array.get_size_y();
+  T * values = array.get_array();
+
+  Double_2D temp(nx,ny);
+  T * temp_values = temp.get_array();
+
+  //along y. Each row is convolved separately.
+  if(radius_y > 0){
+    vector<double> kernel = get_kernel(sigma_y, radius_y);
+    const double * w = &kernel[0] + radius_y;
+
+    NADIA_OMP(parallel for NADIA_OMP_CLAUSES(nx*ny))
+    for(int i=0; i<nx; i++){
+      const T * in = values + i*ny;
+      T * out = temp_values + i*ny;
+      for(int j=0; j<ny; j++){
+	int t_min = j-radius_y < 0 ? -j : -radius_y;
+	int t_max = j+radius_y >= ny ? ny-1-j : radius_y;
+	double sum = 0;
+	for(int t=t_min; t<=t_max; t++)
+	  sum += w[t]*in[j+t];
+	out[j] = sum;
+      }
+    }
+    array.copy(temp);
+  }
+
+  //along x. Whole rows are added together, so the inner loop runs
+  //over contiguous memory.
+  if(radius_x > 0){
+    vector<double> kernel = get_kernel(sigma_x, radius_x);
+    const double * w = &kernel[0] + radius_x;
+
+    NADIA_OMP(parallel for NADIA_OMP_CLAUSES(nx*ny))
+    for(int i=0; i<nx; i++){
+      int t_min = i-radius_x < 0 ? -i : -radius_x;
+      int t_max = i+radius_x >= nx ? nx-1-i : radius_x;
+      T * out = temp_values + i*ny;
+      for(int j=0; j<ny; j++)
+	out[j] = 0;
+      for(int t=t_min; t<=t_max; t++){
+	const T * in = values + (i+t)*ny;
+	const T weight = w[t];
+	for(int j=0; j<ny; j++)
+	  out[j] += weight*in[j];
+      }
+    }
+    array.copy(temp);
+  }
+}
+
+//The coefficients of the Young and van Vliet recursive Gaussian
+//filter for a given standard deviation.
+static void recursive_coefficients(double sigma, double & B,
+				   double & a1, double & a2, double & a3){
+
+  double q;
+  if(sigma >= 2.5)
+    q = 0.98711*sigma - 0.96330;
+  else
+    q = 3.97156 - 4.14554*sqrt(1 - 0.26891*sigma);
+
+  double q2 = q*q;
+  double q3 = q2*q;
+
+  double b0 = 1.57825 + 2.44413*q + 1.4281*q2 + 0.422205*q3;
+  double b1 = 2.44413*q + 2.85619*q2 + 1.26661*q3;
+  double b2 = -(1.4281*q2 + 1.26661*q3);
+  double b3 = 0.422205*q3;
+
+  a1 = b1/b0;
+  a2 = b2/b0;
+  a3 = b3/b0;
+  B = 1 - (a1 + a2 + a3);
+}
+
+//The number of zeros added after the end of a line, so that the
+//tail of the forward pass is included in the backward pass.
+static int recursive_padding(double sigma){
+  return (int) ceil(4*sigma) + 3;
+}
+
+void GaussianFilter::apply_recursive(Double_2D & array, double sigma_x,
+				     double sigma_y){
+
+  typedef Double_2D::value_type T;
+
+  const int nx = array.get_size_x();
+  const int ny = array.get_size_y();
+  T * values = array.get_array();
+
+  double B, a1, a2, a3;
+
+  //along y. The forward pass starts from zero (the zero padding
+  //before the line) and runs on past the end of the line, so the
+  //backward pass can also start from zero.
+  if(sigma_y > 0){
+    recursive_coefficients(sigma_y, B, a1, a2, a3);
+    const int length = ny + recursive_padding(sigma_y);
+
+    NADIA_OMP(parallel NADIA_OMP_PARALLEL_CLAUSES(nx*ny))
+    {
+      vector<double> line(length+3, 0.0);
+      double * w = &line[3];
+
+      NADIA_OMP(for schedule(static))
+      for(int i=0; i<nx; i++){
+	T * row = values + i*ny;
+
+	for(int j=0; j<length; j++){
+	  double in = j<ny ? row[j] : 0;
+	  w[j] = B*in + a1*w[j-1] + a2*w[j-2] + a3*w[j-3];
+	}
+
+	double o1 = 0, o2 = 0, o3 = 0;
+	for(int j=length-1; j>=0; j--){
+	  double o = B*w[j] + a1*o1 + a2*o2 + a3*o3;
+	  o3 = o2;
+	  o2 = o1;
+	  o1 = o;
+	  if(j<ny)
+	    row[j] = o;
+	}
+      }
+    }
+  }
+
+  //along x. The columns are filtered in blocks, which are copied
+  //into "w" so that the inner loop runs over contiguous memory.
+  if(sigma_x > 0){
+    recursive_coefficients(sigma_x, B, a1, a2, a3);
+    const int length = nx + recursive_padding(sigma_x);
+    const int block = 16;
+    const int n_blocks = (ny+block-1)/block;
+
+    NADIA_OMP(parallel NADIA_OMP_PARALLEL_CLAUSES(nx*ny))
+    {
+      //the forward pass, with three rows of zeros in front.
+      vector<double> forward((length+3)*block, 0.0);
+      double * w = &forward[3*block];
+      double o1[block], o2[block], o3[block];
+
+      NADIA_OMP(for schedule(static))
+      for(int b=0; b<n_blocks; b++){
+	const int j0 = b*block;
+	const int width = j0+block > ny ? ny-j0 : block;
+
+	for(int i=0; i<length; i++){
+	  double * row = w + i*block;
+	  const double * w1 = row - block;
+	  const double * w2 = row - 2*block;
+	  const double * w3 = row - 3*block;
+	  const T * in = i<nx ? values + i*ny + j0 : 0;
+	  for(int j=0; j<width; j++)
+	    row[j] = (in ? B*in[j] : 0) + a1*w1[j] + a2*w2[j] + a3*w3[j];
+	}
+
+	for(int j=0; j<width; j++)
+	  o1[j] = o2[j] = o3[j] = 0;
+
+	for(int i=length-1; i>=0; i--){
+	  const double * row = w + i*block;
+	  T * out = i<nx ? values + i*ny + j0 : 0;
+	  for(int j=0; j<width; j++){
+	    double o = B*row[j] + a1*o1[j] + a2*o2[j] + a3*o3[j];
+	    o3[j] = o2[j];
+	    o2[j] = o1[j];
+	    o1[j] = o;
+	    if(out)
+	      out[j] = o;
+	  }
+	}
+      }
+    }
+  }
+}
+
+vector<double> GaussianFilter::get_kernel_transform(int n, double sigma,
+						    int radius){
+
+  //K(k) = w(0) + 2*sum_t w(t)*cos(2*pi*k*t/n)
+  vector<double> kernel = get_kernel(sigma, radius);
+  vector<double> transform(n);
+  for(int k=0; k<n; k++){
+    double sum = kernel[radius];
+    for(int t=1; t<=radius; t++)
+      sum += 2*kernel[radius+t]*cos(2*M_PI*(((long)k*t) % n)/n);
+    transform[k] = sum;
+  }
+
+  return transform;
+}
+
+vector<double> GaussianFilter::get_cached_kernel_transform(int n,
+							   double sigma,
+							   int radius){
+  KernelKey key;
+  key.n = n;
+  key.radius = radius;
+  key.sigma = sigma;
+
+  pthread_mutex_lock(&mutex);
+
+  map<KernelKey, vector<double> >::iterator it = kernels.find(key);
+  if(it!=kernels.end()){
+    vector<double> transform = it->second;
+    pthread_mutex_unlock(&mutex);
+    return transform;
+  }
+
+  vector<double> transform = get_kernel_transform(n, sigma, radius);
+
+  //don't let the cache grow without limit when many widths are used.
+  if(kernels.size() >= GAUSSIAN_CACHE_SIZE)
+    kernels.clear();
+  kernels[key] = transform;
+
+  pthread_mutex_unlock(&mutex);
+  return transform;
+}
+
+//The smallest number >= n with no prime factors above 7. fftw is
+//much quicker for these sizes.
+static int fft_size(int n){
+  for(;;n++){
+    int m = n;
+    while(m%2==0) m/=2;
+    while(m%3==0) m/=3;
+    while(m%5==0) m/=5;
+    while(m%7==0) m/=7;
+    if(m==1)
+      return n;
+  }
+}
+
+void GaussianFilter::apply_fourier(Double_2D & array, double sigma_x,
+				   double sigma_y, int radius_x,
+				   int radius_y){
+
+  typedef Double_2D::value_type T;
+
+  const int nx = array.get_size_x();
+  const int ny = array.get_size_y();
+
+  //pad with enough zeros that the kernel doesn't wrap around from
+  //one edge to the other.
+  const int px = radius_x ? fft_size(nx + radius_x) : nx;
+  const int py = fft_size(ny + radius_y);
+  const int py_half = py/2+1;
+
+  Double_2D padded(px,py);
+  T * padded_values = padded.get_array();
+  const T * values = array.get_array();
+  for(int i=0; i<nx; i++)
+    memcpy(padded_values + i*py, values + i*ny, sizeof(T)*ny);
+
+  Complex_2D spectrum(px,py_half);
+  spectrum.perform_forward_fft_real(padded);
+
+  vector<double> kx(px,1.0);
+  vector<double> ky(py,1.0);
+  if(radius_x > 0)
+    kx = get_cached_kernel_transform(px, sigma_x, radius_x);
+  if(radius_y > 0)
+    ky = get_cached_kernel_transform(py, sigma_y, radius_y);
+
+  //multiply by the kernel, and undo the scaling of the transforms.
+  const double norm = 1.0/((double)px*py);
+  T * s = (T*) spectrum.get_array();
+
+  NADIA_OMP(parallel for NADIA_OMP_CLAUSES(px*py_half))
+  for(int i=0; i<px; i++){
+    for(int j=0; j<py_half; j++){
+      T factor = norm*kx[i]*ky[j];
+      s[2*(i*py_half+j)] *= factor;
+      s[2*(i*py_half+j)+1] *= factor;
+    }
+  }
+
+  spectrum.perform_backward_fft_real(padded);
+
+  T * out = array.get_array();
+  for(int i=0; i<nx; i++)
+    memcpy(out + i*ny, padded_values + i*py, sizeof(T)*ny);
+}
+
+void GaussianFilter::clear(){
+  pthread_mutex_lock(&mutex);
+  kernels.clear();
+  pthread_mutex_unlock(&mutex);
+}
@@ -0,0 +1,94 @@
+// Copyright 2011 Nadia Davidson for The ARC Centre of Excellence in
+// Coherent X-ray Science. This program is distributed under the GNU
+// General Public License. We also ask that you cite this software in
+// publications where you made use of it for any part of the data
+// analysis.
+
+#include <cstring>
+#include <IterationScheduler.h>
+
+using namespace std;
+
+//whether x is a normal number rather than inf or NaN. The library is
+//built with -ffast-math, which lets the compiler assume that x==x,
+//so the exponent bits are checked directly.
+static bool is_finite(double x){
+  unsigned long long bits;
+  memcpy(&bits, &x, sizeof(bits));
+  return ((bits >> 52) & 0x7ff) != 0x7ff;
+}
+
+IterationScheduler::IterationScheduler()
+  : window(0),
+    tolerance(0.01),
+    divergence_factor(0),
+    target_error(0),
+    plateau_shrinkwraps(0),
+    shrinkwraps(0){
+}
+
+void IterationScheduler::set_plateau(int window, double tolerance){
+  this->window = window < 0 ? 0 : window;
+  this->tolerance = tolerance;
+}
+
+void IterationScheduler::set_divergence_factor(double factor){
+  divergence_factor = factor < 0 ? 0 : factor;
+}
+
+void IterationScheduler::set_target_error(double error){
+  target_error = error < 0 ? 0 : error;
+}
+
+void IterationScheduler::set_plateau_shrinkwraps(int n){
+  plateau_shrinkwraps = n < 0 ? 0 : n;
+}
+
+void IterationScheduler::reset(){
+  lowest_error.clear();
+}
+
+void IterationScheduler::start_algorithm(){
+  reset();
+  shrinkwraps = 0;
+}
+
+int IterationScheduler::update(double error){
+
+  if(target_error > 0 && error <= target_error)
+    return STOP;
+
+  //an inf or NaN error never gets better
+  if(!is_finite(error))
+    return NEXT_ALGORITHM;
+
+  double lowest = lowest_error.empty() ? error : lowest_error.back();
+
+  if(divergence_factor > 0 && error > divergence_factor*lowest)
+    return NEXT_ALGORITHM;
+
+  if(error < lowest)
+    lowest = error;
+  lowest_error.push_back(lowest);
+
+  if(window == 0 || (int) lowest_error.size() <= window)
+    return CONTINUE;
+
+  //only the last window+1 values are needed
+  if((int) lowest_error.size() > window+1)
+    lowest_error.erase(lowest_error.begin());
+
+  //compare with the lowest error "window" iterations ago
+  double before = lowest_error.front();
+  if(lowest < before*(1-tolerance))
+    return CONTINUE;
+
+  //plateau
+  if(shrinkwraps < plateau_shrinkwraps){
+    shrinkwraps++;
+    reset();
+    return APPLY_SHRINKWRAP;
+  }
+
+  return NEXT_ALGORITHM;
+}
@@ -0,0 +1,59 @@
+// Copyright 2011 Nadia Davidson for The ARC Centre of Excellence in
+// Coherent X-ray Science. This program is distributed under the GNU
+// General Public License. We also ask that you cite this software in
+// publications where you made use of it for any part of the data
+// analysis.
+
+#include <iostream>
+#include <cstdlib>
+#include <unistd.h>
+#include <Parallel.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace std;
+
+//the number of threads. 0 means it has not been set yet.
+static int num_threads = 0;
+
+void nadia::set_num_threads(int n){
+  num_threads = n < 1 ? 1 : n;
+}
+
+int nadia::get_num_threads(){
+
+  if(num_threads > 0)
+    return num_threads;
+
+#if defined(MULTI_THREADED) || defined(_OPENMP)
+
+  int n = 0;
+
+  const char * env = getenv("NADIA_NUM_THREADS");
+  if(env && env[0]!='\0'){
+    n = atoi(env);
+    if(n < 1){
+      cout << "WARNING: NADIA_NUM_THREADS should be a positive "
+	   << "number, not \"" << env << "\". Ignoring it." << endl;
+      n = 0;
+    }
+  }
+
+#ifdef _OPENMP
+  if(n < 1)
+    n = omp_get_max_threads();
+#else
+  if(n < 1)
+    n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+  num_threads = n < 1 ? 1 : n;
+
+#else
+  num_threads = 1;
+#endif
+
+  return num_threads;
+}
@@ -17,6 +17,9 @@
 #include <sstream>
 #include <typeinfo>
 #include <utils.h>
+#include <FFTWPlanCache.h>
+#include <Parallel.h>
+#include <GEPSolver.h>
 
 
 using namespace std;
@@ -43,6 +46,18 @@ PartialCDI::PartialCDI(Complex_2D & initial_guess,
   threshold(5.0e-3),
   iterations_per_cycle(1){
 
+    //the mode arrays are made by initialise_matrices()
+    single_memory = 0;
+    pfs_memory = 0;
+    pf_memory = 0;
+    ps_memory = 0;
+    psf_memory = 0;
+    lean_memory = 0;
+    lean = false;
+    jmatrix = 0;
+    hmatrix = 0;
+    smatrix = 0;
+
     x_position.clear();
     y_position.clear();
 
@@ -82,7 +97,15 @@ PartialCDI::PartialCDI(Complex_2D & initial_guess,
 
 //destructor for cleaning up
 PartialCDI::~PartialCDI(){
-
+  free_stack(singleCDI, single_memory);
+  free_stack(temp_modes_PFS, pfs_memory);
+  free_stack(temp_modes_PF, pf_memory);
+  free_stack(temp_modes_PS, ps_memory);
+  free_stack(temp_modes_PSF, psf_memory);
+  free_stack(lean_scratch, lean_memory);
+  delete jmatrix;
+  delete hmatrix;
+  delete smatrix;
 }
 
 //return the transmision function.
@@ -121,6 +144,21 @@ void PartialCDI::set_threshold(double new_theshold){
 }
 
 
+//hold only the dominant mode while iterating
+void PartialCDI::set_lean_modes(bool lean_modes){
+
+  lean = lean_modes;
+
+  //the stacks are made again at the new size
+  free_stack(singleCDI, single_memory);
+  free_stack(temp_modes_PFS, pfs_memory);
+  free_stack(temp_modes_PF, pf_memory);
+  free_stack(temp_modes_PS, ps_memory);
+  free_stack(temp_modes_PSF, psf_memory);
+  free_stack(lean_scratch, lean_memory);
+  reallocate_mode_workspace();
+}
+
 //set the initial guess.
 //fills the transmission function with a random 
 //value between 0 and 1 within the support, and
@@ -162,33 +200,43 @@ void PartialCDI::initialise_estimate(int seed){
   complex=transmission;
 }
 
+//the last mode in a list, or null if the list is empty
+static const Complex_2D * last_or_null(const vector<Complex_2D *> & modes){
+  return modes.empty() ? 0 : modes.back();
+}
+
 //this iterate function overrides that of BaseCDI, 
 //and handles the multiple modes.
 int PartialCDI::iterate(){
 
+  NADIA_PROFILE(profile, Profiler::ITERATE);
+
+  //the mode arrays are reused from the last iteration
+  reallocate_mode_workspace();
+
   //below is the code for the special case of ER
   //this is faster than using the generic algorithm code
   //further down in this function.
 
-  vector<Complex_2D> temp_complex_PFS;
-  vector<Complex_2D> temp_complex_PF;
-  vector<Complex_2D> temp_complex_PS;
-  vector<Complex_2D> temp_complex_PSF;
+  if(algorithm==ER && lean){
+    propagate_modes_lean(*singleCDI.back(), false);
+    scale_intensity(*singleCDI.back(), mode_intensity);
+    propagate_from_detector(*singleCDI.back());
+    apply_support(*singleCDI.back());
 
-  singleCDI.clear();
-  for(unsigned int mode=0; mode<singlemode.size(); mode++){
-    singleCDI.push_back(singlemode.at(mode));
-    apply_transmission(singleCDI.at(mode));
-  }
+    update_transmission();
 
+    return SUCCESS;
+  }
 
   if(algorithm==ER){
-    for(int mode=0; mode<singleCDI.size(); mode++){
-      propagate_to_detector(singleCDI.at(mode));
-    }
+    //the modes are only needed at the detector, so they are centred
+    //for the transform while the transmission is applied.
+    bool centred = transmit_modes(true);
+    propagate_stack_to_detector(singleCDI, single_memory, centred);
     scale_intensity(singleCDI);
-    propagate_from_detector(singleCDI.back());
-    apply_support(singleCDI.back());
+    propagate_from_detector(*singleCDI.back());
+    apply_support(*singleCDI.back());
 
     update_transmission();
 
@@ -197,95 +245,123 @@ int PartialCDI::iterate(){
 
   //start of the generic algorithm code
 
+  if(lean){
+    iterate_lean();
+    update_transmission();
+    update_n_best();
+    return SUCCESS;
+  }
+
+  transmit_modes(false);
+
   //FS
   if(algorithm_structure[PFS]!=0){
     for(int mode=0; mode<singleCDI.size(); mode++){
-      temp_complex_PFS.push_back(singleCDI.at(mode));
-      apply_support(temp_complex_PFS.at(mode));
-      propagate_to_detector(temp_complex_PFS.at(mode));
+      temp_modes_PFS.at(mode)->copy(*singleCDI.at(mode));
+      apply_support(*temp_modes_PFS.at(mode));
     } 
-    scale_intensity(temp_complex_PFS);
-    propagate_from_detector(temp_complex_PFS.back());
+    propagate_stack_to_detector(temp_modes_PFS, pfs_memory);
+    scale_intensity(temp_modes_PFS);
+    propagate_from_detector(*temp_modes_PFS.back());
   }
 
   //F
   if(algorithm_structure[PF]!=0){
 
-    for(int mode=0; mode<singleCDI.size(); mode++){
-      temp_complex_PF.push_back(singleCDI.at(mode));
-      propagate_to_detector(temp_complex_PF.at(mode));
-    }
+    for(int mode=0; mode<singleCDI.size(); mode++)
+      temp_modes_PF.at(mode)->copy(*singleCDI.at(mode));
+    propagate_stack_to_detector(temp_modes_PF, pf_memory);
 
-    scale_intensity(temp_complex_PF);
-    propagate_from_detector(temp_complex_PF.back());
+    scale_intensity(temp_modes_PF);
+    propagate_from_detector(*temp_modes_PF.back());
   }
   //S
   if(algorithm_structure[PS]!=0){
-    temp_complex_PS.push_back(singleCDI.back());
-    apply_support(temp_complex_PS.back());
+    temp_modes_PS.back()->copy(*singleCDI.back());
+    apply_support(*temp_modes_PS.back());
   }
 
   //SF
   if(algorithm_structure[PSF]!=0){
     if(algorithm_structure[PF]!=0){
-      temp_complex_PSF.push_back(temp_complex_PF.back());
-      apply_support(temp_complex_PSF.back());
+      temp_modes_PSF.back()->copy(*temp_modes_PF.back());
+      apply_support(*temp_modes_PSF.back());
     }else{
-      for(int mode=0; mode<singleCDI.size(); mode++){
-	temp_complex_PSF.push_back(singleCDI.at(mode));
-	propagate_to_detector(temp_complex_PSF.at(mode));
-      }           
-      scale_intensity(temp_complex_PSF);
-      propagate_from_detector(temp_complex_PSF.back());
-      apply_support(temp_complex_PSF.back());
+      for(int mode=0; mode<singleCDI.size(); mode++)
+	temp_modes_PSF.at(mode)->copy(*singleCDI.at(mode));
+      propagate_stack_to_detector(temp_modes_PSF, psf_memory);
+      scale_intensity(temp_modes_PSF);
+      propagate_from_detector(*temp_modes_PSF.back());
+      apply_support(*temp_modes_PSF.back());
     }
   }
 
   //combine the result of the separate operators
-  double value_real, value_imag;
-  for(int i=0; i < nx; ++i){
-    for(int j=0; j < ny; ++j){
-
-      //Add the identity
-      value_real = (1+algorithm_structure[PI])*singleCDI.back().get_real(i,j);
-      value_imag = (1+algorithm_structure[PI])*singleCDI.back().get_imag(i,j);
-
-      //Add the component from the PfPs operator
-      if(algorithm_structure[PFS]!=0){
-	value_real+=algorithm_structure[PFS]*temp_complex_PFS.back().get_real(i,j);
-	value_imag+=algorithm_structure[PFS]*temp_complex_PFS.back().get_imag(i,j);
-      }
+  {
+    NADIA_PROFILE(profile, Profiler::COMBINE);
+    singleCDI.back()->combine(combine_coefficients,
+			      last_or_null(temp_modes_PF),
+			      last_or_null(temp_modes_PFS),
+			      last_or_null(temp_modes_PS),
+			      last_or_null(temp_modes_PSF));
+  }
 
-      //Add the component from the Pf operator
-      if(algorithm_structure[PF]!=0){
-	value_real+=algorithm_structure[PF]*temp_complex_PF.back().get_real(i,j);
-	value_imag+=algorithm_structure[PF]*temp_complex_PF.back().get_imag(i,j);
+  //Update the transmission using the dominant mode
+  update_transmission();
+  update_n_best();
+  return SUCCESS;
 
-      }
+}
 
-      //Add the component from the Ps operator
-      if(algorithm_structure[PS]!=0){
-	value_real+=algorithm_structure[PS]*temp_complex_PS.back().get_real(i,j);
-	value_imag+=algorithm_structure[PS]*temp_complex_PS.back().get_imag(i,j);
-      }
+//the generic algorithm for lean mode. This follows iterate(), but
+//each term only has the dominant mode, and the others are made and
+//propagated one at a time.
+void PartialCDI::iterate_lean(){
 
-      //Add the component from the PsPf operator
-      if(algorithm_structure[PSF]!=0){
-	value_real+=algorithm_structure[PSF]*temp_complex_PSF.back().get_real(i,j);
-	value_imag+=algorithm_structure[PSF]*temp_complex_PSF.back().get_imag(i,j);
-      }
+  //the dominant mode at the sample
+  transmit_mode(singlemode.size()-1, *singleCDI.back(), false);
 
-      singleCDI.back().set_real(i,j,value_real);
-      singleCDI.back().set_imag(i,j,value_imag);
+  //FS
+  if(algorithm_structure[PFS]!=0){
+    propagate_modes_lean(*temp_modes_PFS.back(), true);
+    scale_intensity(*temp_modes_PFS.back(), mode_intensity);
+    propagate_from_detector(*temp_modes_PFS.back());
+  }
 
-    }
+  //F
+  if(algorithm_structure[PF]!=0){
+    propagate_modes_lean(*temp_modes_PF.back(), false);
+    scale_intensity(*temp_modes_PF.back(), mode_intensity);
+    propagate_from_detector(*temp_modes_PF.back());
   }
 
-  //Update the transmission using the dominant mode
-  update_transmission();
-  update_n_best();
-  return SUCCESS;
+  //S
+  if(algorithm_structure[PS]!=0){
+    temp_modes_PS.back()->copy(*singleCDI.back());
+    apply_support(*temp_modes_PS.back());
+  }
+
+  //SF
+  if(algorithm_structure[PSF]!=0){
+    if(algorithm_structure[PF]!=0){
+      temp_modes_PSF.back()->copy(*temp_modes_PF.back());
+    }else{
+      propagate_modes_lean(*temp_modes_PSF.back(), false);
+      scale_intensity(*temp_modes_PSF.back(), mode_intensity);
+      propagate_from_detector(*temp_modes_PSF.back());
+    }
+    apply_support(*temp_modes_PSF.back());
+  }
 
+  //combine the result of the separate operators
+  {
+    NADIA_PROFILE(profile, Profiler::COMBINE);
+    singleCDI.back()->combine(combine_coefficients,
+			      last_or_null(temp_modes_PF),
+			      last_or_null(temp_modes_PFS),
+			      last_or_null(temp_modes_PS),
+			      last_or_null(temp_modes_PSF));
+  }
 }
 
 //uses the complex_2d multiply function to apply 
@@ -297,14 +373,19 @@ void PartialCDI::apply_transmission(Complex_2D & c){
 //scale the highest occupancy mode 
 //this overwrites the function of the same
 //name in BaseCDI
-void PartialCDI::scale_intensity(vector<Complex_2D> & c){
+void PartialCDI::scale_intensity(vector<Complex_2D *> & c){
+
+  scale_intensity(*c.back(), sum_intensity(c));
+}
+
+//scale the dominant mode by the ratio of the measured and the total
+//calculated amplitudes.
+void PartialCDI::scale_intensity(Complex_2D & dominant,
+				 Double_2D & magnitude){
+
+  NADIA_PROFILE(profile, Profiler::SCALE_INTENSITY);
   double norm2_mag=0;
   double norm2_diff=0;
-  double measured_int=0;
-  double calc_int=0;
-  double scaled_mag=0;
-
-  Double_2D magnitude=sum_intensity(c);
 
   //set the intensities to 0
   /*  for(int i=0; i< nx; i++){
@@ -324,58 +405,45 @@ void PartialCDI::scale_intensity(vector<Complex_2D> & c){
       }
       }
    */
-  for(int i=0; i< nx; i++){
-    for(int j=0; j< ny; j++){
-      //reset the magnitude
-      if(beam_stop==0 || beam_stop->get(i,j)>0){
-
-	measured_int=intensity_sqrt.get(i,j);
-
-	calc_int=sqrt(magnitude.get(i,j)); 
-
-	scaled_mag=c.back().get_mag(i,j)*measured_int/calc_int;
-	//std::cout<<scaled_mag<<"\n";
-	c.back().set_mag(i,j,scaled_mag);
-
-	//calculate the error
-	norm2_mag += measured_int*measured_int;
+  //scale the highest occupancy mode by the ratio of the measured
+  //and the total calculated amplitudes.
+  magnitude.sq_root();
+  dominant.project_modulus(intensity_sqrt, beam_stop, 
+			   norm2_mag, norm2_diff, &magnitude);
 
-	norm2_diff += (measured_int-calc_int)*(measured_int-calc_int);
-      }
-    }
-  }
   current_error = norm2_diff/norm2_mag;
 
 }
 
 
-//add the intensities across all modes scaled by the eigenvalues
-Double_2D PartialCDI::sum_intensity(vector<Complex_2D> & c){
-
-  Double_2D magnitude(nx, ny);
-
-  //set the intensities to 0
-  /*  for(int i=0; i< nx; i++){
-      for(int j=0; j< ny; j++){
-      magnitude.set(i,j,0.0);
-      }
-      }*/
-
-
-  for(int i=0; i< nx; i++){
-    for(int j=0; j< ny; j++){
-
-      double mag_total=0;
-      for(int mode=0; mode<c.size(); mode++){
-
-	mag_total += eigen.at(mode)*c.at(mode).get_mag(i,j)*c.at(mode).get_mag(i,j);
-
-      }
-      magnitude.set(i,j,mag_total);
+//add the intensities across all modes scaled by the eigenvalues.
+//Each pixel sums over the modes in the stack, so the modes are read
+//in one pass.
+Double_2D & PartialCDI::sum_intensity(vector<Complex_2D *> & c){
+
+  if(mode_intensity.get_size_x()!=nx || mode_intensity.get_size_y()!=ny)
+    mode_intensity.allocate_memory(nx, ny);
+
+  const int modes = c.size();
+  vector<const FFTW_COMPLEX *> arrays(modes);
+  for(int mode=0; mode<modes; mode++)
+    arrays[mode] = c.at(mode)->get_array();
+  vector<double> weight(eigen.begin(), eigen.begin()+modes);
+
+  Double_2D::value_type * magnitude = mode_intensity.get_array();
+  const int n = nx*ny;
+  NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(n*modes,get_num_threads()))
+  for(int k=0; k<n; k++){
+    double mag_total=0;
+    for(int mode=0; mode<modes; mode++){
+      double re = arrays[mode][k][REAL];
+      double im = arrays[mode][k][IMAG];
+      mag_total += weight[mode]*(re*re + im*im);
     }
+    magnitude[k] = mag_total;
   }
 
-  return(magnitude);
+  return(mode_intensity);
 };
 
 
@@ -391,8 +459,8 @@ void PartialCDI::update_transmission(){
 
       rd = singlemode.back().get_real(i,j);
       id = singlemode.back().get_imag(i,j);
-      rs = singleCDI.back().get_real(i,j);
-      is = singleCDI.back().get_imag(i,j);
+      rs = singleCDI.back()->get_real(i,j);
+      is = singleCDI.back()->get_imag(i,j);
 
       //  if((abs(rs) > 0.01)||(abs(is) > 0.01)){ 
 
@@ -435,21 +503,41 @@ void PartialCDI::update_transmission(){
 
     eigen.clear();
 
-    //    std::cout<<nleg<<"\n";
-    Double_2D roots = legroots(nleg);
+    //the eigenproblem only depends on these parameters, so it isn't
+    //solved again by set_threshold(), or for another PartialCDI with
+    //the same coherence. The J matrix is kept for fill_jmatrix() if
+    //it isn't.
+    if(!jmatrix || jmatrix->get_size_x()!=nmode*nmode){
+      delete jmatrix;
+      jmatrix = new Complex_2D(nmode*nmode, nmode*nmode);
+    }
 
-    vector<double> rootval;
+    if(!GEPSolver::find_solution(nleg, nmode, lcx, lcy, *jmatrix, eigen)){
 
+      //    std::cout<<nleg<<"\n";
+      Double_2D roots = legroots(nleg);
 
-    for(int i=0; i< roots.get_size_x(); i++){
-      rootval.push_back(roots.get(i, 0));
-    }
+      vector<double> rootval;
 
-    Double_2D legmatrix = fill_legmatrix(rootval, nmode); 
 
-    fill_jmatrix(legmatrix, roots);
-    fill_smatrix(legmatrix, roots);
-    solve_gep(*jmatrix, *smatrix, eigen);
+      for(int i=0; i< roots.get_size_x(); i++){
+	rootval.push_back(roots.get(i, 0));
+      }
+
+      Double_2D legmatrix = fill_legmatrix(rootval, nmode); 
+
+      fill_jmatrix(legmatrix, roots);
+      fill_smatrix(legmatrix, roots);
+      //the old modes no longer match the coherence, and there are no
+      //new ones to use instead.
+      if(GEPSolver::solve(*jmatrix, *smatrix, eigen)==FAILURE){
+	cout << "The modes could not be found for this coherence "
+	     << "length and number of modes. Exiting..." << endl;
+	exit(1);
+      }
+      GEPSolver::add_solution(nleg, nmode, lcx, lcy, *jmatrix, eigen);
+    }
+
     fill_modes(*jmatrix);
 
     Complex_2D mags(nx, ny);
@@ -487,7 +575,11 @@ void PartialCDI::update_transmission(){
 
     Complex_2D s1d(nleg,nleg);
 
-    smatrix = new Complex_2D(nmode*nmode, nmode*nmode);
+    //every element is set below, so the old matrix can be reused
+    if(!smatrix || smatrix->get_size_x()!=nmode*nmode){
+      delete smatrix;
+      smatrix = new Complex_2D(nmode*nmode, nmode*nmode);
+    }
 
     for(int i = 0; i < nmode; i++){
       for(int j = 0; j < nmode; j++){
@@ -575,7 +667,11 @@ void PartialCDI::update_transmission(){
       }
     }
 
-    jmatrix = new Complex_2D(nmode*nmode, nmode*nmode);
+    //every element is set below, so the old matrix can be reused
+    if(!jmatrix || jmatrix->get_size_x()!=nmode*nmode){
+      delete jmatrix;
+      jmatrix = new Complex_2D(nmode*nmode, nmode*nmode);
+    }
 
     for(int i=0; i<nmode; i++){
       for(int j=0; j<nmode; j++){
@@ -596,16 +692,34 @@ void PartialCDI::update_transmission(){
   }
 
   //fill a vector of Complex_2D for single modes. These 
-  //modes do not evolve over time, and so are not BaseCDI's
+  //modes do not evolve over time, and so are not BaseCDI's.
+  //
+  //Each mode is separable, mode(i,j) = sum_kl c(k,l)*X(i,k)*Y(j,l),
+  //where X and Y are the normalised Legendre polynomials, so it is
+  //made as the matrix product X*C*Y^T: first H = C*Y^T, which is
+  //small, then X*H a row at a time.
   void PartialCDI::fill_modes(Complex_2D & c){
 
     Double_2D x_legmatrix = fill_legmatrix(x_position, nmode);
     Double_2D y_legmatrix = fill_legmatrix(y_position, nmode);
 
-    double val_imag; 
-    double val_real;
+    //the polynomials with their normalisation, X as nx*nmode and
+    //Y^T as nmode*ny, so the inner loops below are contiguous.
+    vector<double> x_leg(nx*nmode);
+    vector<double> y_leg(nmode*ny);
+    for(int k=0; k<nmode; k++){
+      double norm = 1.0/sqrt(2.0/(2*k+1));
+      for(int i=0; i<nx; i++)
+	x_leg[i*nmode+k] = x_legmatrix.get(i, k)*norm;
+      for(int j=0; j<ny; j++)
+	y_leg[k*ny+j] = y_legmatrix.get(j, k)*norm;
+    }
+
+    vector<double> h_real(nmode*ny);
+    vector<double> h_imag(nmode*ny);
 
     singlemode.clear();
+    singlemode.reserve(nmode*nmode);
 
     int e_mode=0;
 
@@ -613,49 +727,249 @@ void PartialCDI::update_transmission(){
 
       if(eigen.at(e_mode)/eigen.back() > threshold){
 
-	Complex_2D tmp(nx, ny);
-
-	for(int i=0; i<nx; i++){
+	//H = C*Y^T
+	NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(nmode*nmode*ny,get_num_threads()))
+	for(int k=0; k<nmode; k++){
+	  double * hr = &h_real[k*ny];
+	  double * hi = &h_imag[k*ny];
 	  for(int j=0; j<ny; j++){
+	    hr[j] = 0;
+	    hi[j] = 0;
+	  }
+	  for(int l=0; l<nmode; l++){
+	    double cr = c.get_real(l+nmode*k, mode);
+	    double ci = c.get_imag(l+nmode*k, mode);
+	    const double * y = &y_leg[l*ny];
+	    for(int j=0; j<ny; j++){
+	      hr[j] += cr*y[j];
+	      hi[j] += ci*y[j];
+	    }
+	  }
+	}
 
-	    val_imag=0;
-	    val_real=0;
-	    for(int k=0; k<nmode; k++){
-	      for(int l=0; l<nmode; l++){
-
-		val_real +=c.get_real(l+nmode*k, mode)*x_legmatrix.get(i, k)*y_legmatrix.get(j, l)/sqrt(2.0/(2*k+1))/sqrt(2.0/(2*l+1));
-		val_imag +=c.get_imag(l+nmode*k, mode)*x_legmatrix.get(i, k)*y_legmatrix.get(j, l)/sqrt(2.0/(2*k+1))/sqrt(2.0/(2*l+1));
+	singlemode.push_back(Complex_2D(nx, ny));
+	FFTW_COMPLEX * out = singlemode.back().get_array();
 
+	//mode = X*H. The columns are done in blocks, so the part of H
+	//being used stays in cache while the rows go through it.
+	const int block = 256;
+	NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(nx*ny*nmode,get_num_threads()))
+	for(int i=0; i<nx; i++){
+	  double sum_real[block];
+	  double sum_imag[block];
+	  const double * x = &x_leg[i*nmode];
+	  for(int j0=0; j0<ny; j0+=block){
+	    int nj = ny-j0 < block ? ny-j0 : block;
+	    for(int j=0; j<nj; j++){
+	      sum_real[j] = 0;
+	      sum_imag[j] = 0;
+	    }
+	    for(int k=0; k<nmode; k++){
+	      const double * hr = &h_real[k*ny+j0];
+	      const double * hi = &h_imag[k*ny+j0];
+	      for(int j=0; j<nj; j++){
+		sum_real[j] += x[k]*hr[j];
+		sum_imag[j] += x[k]*hi[j];
 	      }
 	    }
-
-	    tmp.set_real(i, j, val_real);
-	    tmp.set_imag(i, j, val_imag);
+	    for(int j=0; j<nj; j++){
+	      out[i*ny+j0+j][REAL] = sum_real[j];
+	      out[i*ny+j0+j][IMAG] = sum_imag[j];
+	    }
 	  }
 	}
 
-	singlemode.push_back(tmp);
-
 	e_mode++;
       }else{
 	eigen.erase(eigen.begin()+e_mode);
       }
     }
+
+    //the workspace for iterate() is made once, here.
+    reallocate_mode_workspace();
+  }
+
+  void PartialCDI::allocate_stack(vector<Complex_2D *> & stack,
+				FFTW_COMPLEX * & memory, unsigned int n){
+
+    if(stack.size()==n)
+      return;
+
+    free_stack(stack, memory);
+    if(n==0)
+      return;
+
+    memory = (FFTW_COMPLEX*) FFTW_MALLOC(sizeof(FFTW_COMPLEX)*nx*ny*n);
+    for(unsigned int mode=0; mode<n; mode++){
+      stack.push_back(new Complex_2D(nx, ny, memory + mode*nx*ny));
+      stack.back()->set_fftw_type(complex.get_fftw_type());
+    }
   }
 
-  //Propagate from the object plane to the detector
+  void PartialCDI::free_stack(vector<Complex_2D *> & stack,
+			      FFTW_COMPLEX * & memory){
+    for(unsigned int mode=0; mode<stack.size(); mode++)
+      delete stack[mode];
+    stack.clear();
+    if(memory)
+      FFTW_FREE(memory);
+    memory = 0;
+  }
+
+  void PartialCDI::reallocate_mode_workspace(){
+
+    unsigned int all = singlemode.size();
+    unsigned int last = all ? 1 : 0;
+
+    //in lean mode only the dominant mode is kept, and one more
+    //array is shared by the others.
+    if(lean){
+      allocate_stack(lean_scratch, lean_memory, all>1 ? 1 : 0);
+      all = last;
+    }
+
+    allocate_stack(singleCDI, single_memory, all);
+
+    //the generic code only needs the arrays for the terms in the
+    //algorithm. PS, and PSF when it is made from PF, only use the
+    //last mode.
+    bool generic = algorithm!=ER;
+    allocate_stack(temp_modes_PFS, pfs_memory,
+		   generic && algorithm_structure[PFS]!=0 ? all : 0);
+    allocate_stack(temp_modes_PF, pf_memory,
+		   generic && algorithm_structure[PF]!=0 ? all : 0);
+    allocate_stack(temp_modes_PS, ps_memory,
+		   generic && algorithm_structure[PS]!=0 ? last : 0);
+    allocate_stack(temp_modes_PSF, psf_memory,
+		   !generic || algorithm_structure[PSF]==0 ? 0
+		   : algorithm_structure[PF]!=0 ? last : all);
+  }
+
+  bool PartialCDI::transmit_modes(bool centre){
+
+    bool centred = false;
+    for(unsigned int mode=0; mode<singlemode.size(); mode++)
+      centred = transmit_mode(mode, *singleCDI.at(mode), centre);
+
+    return centred;
+  }
+
+  bool PartialCDI::transmit_mode(int mode, Complex_2D & c, bool centre){
+
+    //the checkerboard trick only works for even dimensions
+    centre = centre && nx%2==0 && ny%2==0;
+    const double scale = centre ? 1.0/sqrt((double)nx*ny) : 1.0;
+
+    const FFTW_COMPLEX * t = complex.get_array();
+    const FFTW_COMPLEX * in = singlemode.at(mode).get_array();
+    FFTW_COMPLEX * out = c.get_array();
+
+    NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(nx*ny,get_num_threads()))
+    for(int i=0; i<nx; i++){
+      for(int j=0; j<ny; j++){
+	int k = i*ny+j;
+	//as Complex_2D::multiply() then Complex_2D::checkerboard()
+	FFTW_REAL a = in[k][REAL];
+	FFTW_REAL b = in[k][IMAG];
+	FFTW_REAL d = t[k][REAL];
+	FFTW_REAL e = t[k][IMAG];
+	FFTW_REAL re = a*d - b*e;
+	FFTW_REAL im = a*e + b*d;
+	if(centre){
+	  FFTW_REAL sign = (i+j)%2==0 ? scale : -scale;
+	  re*=sign;
+	  im*=sign;
+	}
+	out[k][REAL] = re;
+	out[k][IMAG] = im;
+      }
+    }
+
+    return centre;
+  }
+
+  Double_2D & PartialCDI::propagate_modes_lean(Complex_2D & dominant,
+					       bool support){
+
+    if(mode_intensity.get_size_x()!=nx || mode_intensity.get_size_y()!=ny)
+      mode_intensity.allocate_memory(nx, ny);
+
+    Double_2D::value_type * magnitude = mode_intensity.get_array();
+    const int modes = singlemode.size();
+    const int n = nx*ny;
+
+    for(int mode=0; mode<modes; mode++){
+
+      //the dominant mode is last, so the scratch array is free to be
+      //reused as soon as a mode's intensity has been added.
+      Complex_2D & c = mode==modes-1 ? dominant : *lean_scratch.back();
+
+      //the support has to be applied before the checkerboard when the
+      //support is not a simple mask
+      bool centred = transmit_mode(mode, c, !support);
+      if(support)
+	apply_support(c);
+
+      vector<Complex_2D *> one(1, &c);
+      propagate_stack_to_detector(one, c.get_array(), centred);
+
+      //add |z|^2 weighted by the eigenvalue
+      const FFTW_COMPLEX * z = c.get_array();
+      const double weight = eigen.at(mode);
+      NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(n,get_num_threads()))
+      for(int k=0; k<n; k++){
+	double re = z[k][REAL];
+	double im = z[k][IMAG];
+	if(mode==0)
+	  magnitude[k] = weight*(re*re + im*im);
+	else
+	  magnitude[k] += weight*(re*re + im*im);
+      }
+    }
+
+    return(mode_intensity);
+  }
+
+  void PartialCDI::propagate_stack_to_detector(vector<Complex_2D *> & stack,
+					       FFTW_COMPLEX * memory,
+					       bool centred){
+
+    //odd sized arrays are centred after the transform, so they are
+    //done one at a time.
+    if(nx%2==1 || ny%2==1){
+      for(unsigned int mode=0; mode<stack.size(); mode++)
+	propagate_to_detector(*stack[mode]);
+      return;
+    }
+
+    NADIA_PROFILE(profile, Profiler::PROPAGATE_TO_DETECTOR);
+
+    if(!centred){
+      for(unsigned int mode=0; mode<stack.size(); mode++)
+	stack[mode]->checkerboard(1.0/sqrt((double)nx*ny));
+    }
+
+    FFTW_EXECUTE_DFT(FFTWPlanCache::get_many_plan(nx, ny, stack.size(),
+						  FFTW_FORWARD,
+						  complex.get_fftw_type(),
+						  memory, get_num_threads()),
+		     memory, memory);
+  }
+
+  //Propagate from the object plane to the detector. The modes are
+  //propagated one at a time by iterate(), so they are timed here.
   void PartialCDI::propagate_to_detector(Complex_2D & c){
 
-    c.perform_forward_fft();
-    c.invert(true);
+    NADIA_PROFILE(profile, Profiler::PROPAGATE_TO_DETECTOR);
+    c.perform_forward_fft_centred();
 
   }
 
   //Propagate form the detector plane to the object
   void PartialCDI::propagate_from_detector(Complex_2D & c){
 
-    c.invert(true);
-    c.perform_backward_fft();
+    NADIA_PROFILE(profile, Profiler::PROPAGATE_FROM_DETECTOR);
+    c.perform_backward_fft_centred();
 
   }
 
@@ -663,28 +977,15 @@ void PartialCDI::update_transmission(){
   //for use in simulations.
   Double_2D PartialCDI::propagate_modes_to_detector(){
 
-    singleCDI.clear();
-    for(unsigned int i=0; i<singlemode.size(); i++){
-      singleCDI.push_back(singlemode.at(i));
-    }
-
-    for(int mode=0; mode<singleCDI.size(); mode++){
-      apply_transmission(singleCDI.at(mode));
-      propagate_to_detector(singleCDI.at(mode));
-    }
+    reallocate_mode_workspace();
 
-    Double_2D magnitude(nx, ny);
-    for(unsigned int mode=0; mode<singleCDI.size(); mode++){
+    if(lean)
+      return(propagate_modes_lean(*singleCDI.back(), false));
 
-      for(int i=0; i< nx; i++){
-	for(int j=0; j< ny; j++){
+    bool centred = transmit_modes(true);
+    propagate_stack_to_detector(singleCDI, single_memory, centred);
 
-	  double mag_total = magnitude.get(i,j)+eigen.at(mode)*singleCDI.at(mode).get_mag(i,j)*singleCDI.at(mode).get_mag(i,j);
-	  magnitude.set(i,j,mag_total);
-	}
-      }
-    }
-    return(magnitude);
+    return(sum_intensity(singleCDI));
   }
 
   //a function that returns a single mode.
@@ -11,6 +11,7 @@
 #include <sstream>
 #include <utils.h>
 #include <PartialCharCDI.h>
+#include <GaussianFilter.h>
 #include <cstdlib> 
 
 using namespace std;
@@ -31,6 +32,7 @@ PartialCharCDI::PartialCharCDI(Complex_2D & initial_guess,
     px_x_size(pixel_x_size),
     px_y_size(pixel_y_size),
     measured_intensity(),
+    measured_spectrum(nx, ny/2+1),
     minima_search_bounds_coefficient(DEFAULT_MINIMA_SEARCH_BOUNDS_COEFFICIENT),
     minima_search_tolerance(DEFAULT_MINIMA_SEARCH_TOLERANCE),
     minima_recalculation_interval(DEFAULT_MINIMA_RECALCULATION_INTERVAL),
@@ -106,11 +108,11 @@ void PartialCharCDI::set_minima_moving_average_weight(double w){
 }
 
 /** 
- * Default = 5
+ * Default = 1
  *
- * The values of lx and ly will only be updated every ival iterations (since the process is rather slow).
- * There's not much advantage to doing this more frquently than the default of 5 unless there are very few
- * total iterations being calculated.
+ * The values of lx and ly will only be updated every ival iterations. The fit is done in fourier space and
+ * costs little more than one extra transform of the estimate, so it is now done every iteration by default.
+ * Larger values may still save some time for very large arrays.
  */
 void PartialCharCDI::set_minima_recalculation_interval(unsigned int ival){
   minima_recalculation_interval = ival;
@@ -191,16 +193,17 @@ void PartialCharCDI::set_intensity(const Double_2D &detector_intensity){
 
   // Store a copy of the un-square-rooted intensity values:
   measured_intensity = detector_intensity;
+
+  // Its transform is used every time lx and ly are fitted:
+  measured_spectrum.perform_forward_fft_real(measured_intensity);
 }
 
 void PartialCharCDI::propagate_to_detector(Complex_2D & c){
-    c.perform_forward_fft();
-    c.invert(true);
+    c.perform_forward_fft_centred();
 }
 
 void PartialCharCDI::propagate_from_detector(Complex_2D & c){
-  c.invert(true);
-  c.perform_backward_fft(); 
+  c.perform_backward_fft_centred();
 }
 
 
@@ -219,7 +222,7 @@ void PartialCharCDI::scale_intensity(Complex_2D & c){
   if(iteration % minima_recalculation_interval == 0){ 
     // Every few iterations:
     // Recalculate the optimal gaussian convolution of the estimated intensity to minimise the difference with the measured intensity:
-    optimally_convoluted_estimate = get_convoluted_intensity_estimate(estimate_intensity, measured_intensity); // lx and ly attributes are updated in here
+    optimally_convoluted_estimate = get_convoluted_intensity_estimate(estimate_intensity); // lx and ly attributes are updated in here
   } else{ // Use last lx and ly values:
     optimally_convoluted_estimate = gaussian_convolution(estimate_intensity, lx, ly);
   }
@@ -259,29 +262,104 @@ void PartialCharCDI::scale_intensity(Complex_2D & c){
  * coherence characterisation using diffractive imaging' [doi: 10.1063/1.3650265]
  * for further details.
  */
-Double_2D PartialCharCDI::get_convoluted_intensity_estimate(Double_2D const & estimated_intensity, Double_2D const & measured_intensity){
-  double lbound, rbound;
+Double_2D PartialCharCDI::get_convoluted_intensity_estimate(Double_2D const & estimated_intensity){
 
-  // Find optimal lx estimate with exponential moving average:
-  // Use last values as initial guess and a fixed multiple/division of the last value as the search bounds
-  lbound = max(MIN_SEARCH_LBOUND, lx / minima_search_bounds_coefficient); // Don't search the region where the gaussian is delta-function like
-  rbound = max(MIN_SEARCH_RBOUND, lx * minima_search_bounds_coefficient); // Dont let the bound size get too small
-  error_in_lx f_lx(measured_intensity, estimated_intensity, ly); // Error as a function of lx (using the previous value of ly w.l.o.g.)
-  
-  // Find new error-minimising value and time-average with old value:
-  lx = ((1-minima_moving_average_weight) * lx) + (minima_moving_average_weight * minimise_function(f_lx, lbound, lx, rbound, minima_search_tolerance));
+  // The estimate is fourier transformed once, and each (lx, ly) tried below is then cheap to evaluate
+  SpectralCoherenceError error(measured_spectrum, estimated_intensity);
 
-  // Find optimal ly estimate with exponential moving average:
-  lbound = max(MIN_SEARCH_LBOUND, ly / minima_search_bounds_coefficient);
-  rbound = max(MIN_SEARCH_RBOUND, ly * minima_search_bounds_coefficient);
-  error_in_ly f_ly(measured_intensity, estimated_intensity, lx); // Error as a function of ly
+  // Use last values as initial guess and a fixed multiple/division of the last value as the search bounds
+  double lx_lbound = max(MIN_SEARCH_LBOUND, lx / minima_search_bounds_coefficient); // Don't search the region where the gaussian is delta-function like
+  double lx_rbound = max(MIN_SEARCH_RBOUND, lx * minima_search_bounds_coefficient); // Dont let the bound size get too small
+  double ly_lbound = max(MIN_SEARCH_LBOUND, ly / minima_search_bounds_coefficient);
+  double ly_rbound = max(MIN_SEARCH_RBOUND, ly * minima_search_bounds_coefficient);
+
+  // Fit lx and ly together by searching along each in turn until neither changes:
+  double new_lx = min(max(lx, lx_lbound), lx_rbound);
+  double new_ly = min(max(ly, ly_lbound), ly_rbound);
+  for(int round=0; round < MINIMA_SEARCH_MAX_ROUNDS; round++){
+    error_in_lx f_lx(error, new_ly); // Error as a function of lx
+    double next_lx = minimise_function(f_lx, lx_lbound, new_lx, lx_rbound, minima_search_tolerance);
+
+    error_in_ly f_ly(error, next_lx); // Error as a function of ly
+    double next_ly = minimise_function(f_ly, ly_lbound, new_ly, ly_rbound, minima_search_tolerance);
+
+    bool converged = fabs(next_lx - new_lx) < minima_search_tolerance && fabs(next_ly - new_ly) < minima_search_tolerance;
+    new_lx = next_lx;
+    new_ly = next_ly;
+    if(converged)
+      break;
+  }
 
-  // Find new error-minimising value and time-average with old value:
-  ly = ((1-minima_moving_average_weight) * ly) + (minima_moving_average_weight * minimise_function(f_ly, lbound, ly, rbound, minima_search_tolerance));
+  // Time-average the new error-minimising values with the old ones:
+  lx = ((1-minima_moving_average_weight) * lx) + (minima_moving_average_weight * new_lx);
+  ly = ((1-minima_moving_average_weight) * ly) + (minima_moving_average_weight * new_ly);
   
   return gaussian_convolution(estimated_intensity, lx, ly); // Return the convolution of estimated_intensity with a gaussian of optimal parameters
 }
 
+SpectralCoherenceError::SpectralCoherenceError(Complex_2D const & measured_spectrum, Double_2D const & estimated_intensity)
+  : nx(estimated_intensity.get_size_x()),
+    ny(estimated_intensity.get_size_y()),
+    ny_half(estimated_intensity.get_size_y()/2+1),
+    measured_term(0),
+    cross_term(nx*ny_half),
+    estimate_term(nx*ny_half){
+
+  Complex_2D estimated_spectrum(nx, ny_half);
+  estimated_spectrum.perform_forward_fft_real(estimated_intensity);
+
+  for(int i=0; i<nx; i++){
+    for(int j=0; j<ny_half; j++){
+      // Points other than the first (and, for even ny, the last) column stand for two points of the full spectrum
+      double weight = (j==0 || (ny%2==0 && j==ny/2)) ? 1 : 2;
+
+      double m_r = measured_spectrum.get_real(i,j);
+      double m_i = measured_spectrum.get_imag(i,j);
+      double e_r = estimated_spectrum.get_real(i,j);
+      double e_i = estimated_spectrum.get_imag(i,j);
+
+      measured_term += weight*(m_r*m_r + m_i*m_i);
+      cross_term[i*ny_half+j] = 2*weight*(m_r*e_r + m_i*e_i);
+      estimate_term[i*ny_half+j] = weight*(e_r*e_r + e_i*e_i);
+    }
+  }
+}
+
+double SpectralCoherenceError::call(double lx, double ly){
+  lx = fabs(lx);
+  ly = fabs(ly);
+
+  std::pair<double,double> key(lx, ly);
+  std::map<std::pair<double,double>, double>::iterator it = cache.find(key);
+  if(it != cache.end())
+    return it->second;
+
+  // The same (truncated) kernels as gaussian_convolution; lx is along the second index
+  vector<double> gx(nx, 1.0);
+  vector<double> gy(ny, 1.0);
+  int radius_y = GaussianFilter::get_radius(lx, DEFAULT_GAUSSIAN_KERNEL_SIZE_IN_STD_DEVIATIONS);
+  int radius_x = GaussianFilter::get_radius(ly, DEFAULT_GAUSSIAN_KERNEL_SIZE_IN_STD_DEVIATIONS);
+  if(radius_y > 0)
+    gy = GaussianFilter::get_cached_kernel_transform(ny, lx, radius_y);
+  if(radius_x > 0)
+    gx = GaussianFilter::get_cached_kernel_transform(nx, ly, radius_x);
+
+  // |M - GE|^2 = |M|^2 - 2 G Re(conj(M)E) + G^2 |E|^2, as G is real
+  double sum = measured_term;
+  NADIA_OMP(parallel for NADIA_OMP_CLAUSES(nx*ny_half) reduction(+:sum))
+  for(int i=0; i<nx; i++){
+    for(int j=0; j<ny_half; j++){
+      double g = gx[i]*gy[j];
+      sum += g*(g*estimate_term[i*ny_half+j] - cross_term[i*ny_half+j]);
+    }
+  }
+
+  // Undo the scaling of the (unnormalised) transforms
+  double result = sum/((double) nx*ny);
+  cache[key] = result;
+  return result;
+}
+
 /**
  * Returns the energy difference between the measureed intensity, and the intensity
  * estimate assuming partial coherence described by gaussian std deviation parameters lx & ly
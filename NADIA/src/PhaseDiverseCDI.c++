@@ -8,6 +8,8 @@
 #include <fstream>
 #include <math.h>
 #include <string>
+#include <map>
+#include <vector>
 #include <stdlib.h>
 #include <cstdlib> 
 #include <Complex_2D.h>
@@ -19,27 +21,52 @@
 #include <sstream>
 #include <typeinfo>
 #include <utils.h>
+#include <Parallel.h>
 
 using namespace std;
 
+//get element (i,j) of an array kept in tiles which line up with the
+//tiles of "grid" (see "covered" in PhaseDiverseCDI.h). A tile of
+//zeros is made if (i,j) is not in one yet.
+template<class T>
+static T & tiled_element(map<pair<int,int>, vector<T> > & tiles,
+			 const TiledComplex_2D & grid, int i, int j){
+  const int size = TiledComplex_2D::TILE_SIZE;
+  int ti = grid.get_tile_origin_x(i);
+  int tj = grid.get_tile_origin_y(j);
+  vector<T> & tile = tiles[make_pair(ti,tj)];
+  if(tile.empty())
+    tile.assign(size*size, 0);
+  return tile[(i-ti)*size + (j-tj)];
+}
+
 
 //constructor for the class which handles phase diversity.
 PhaseDiverseCDI::PhaseDiverseCDI(
 				 double beta, 
 				 double gamma, 
 				 bool parallel,
-				 int granularity):scale(granularity),
-						  beta(beta), 
+				 int granularity):beta(beta), 
 						  gamma(gamma), 
-						  parallel(parallel),
+						  object(0),
+						  dense_object(0),
+						  iterations_per_cycle(1),
+						  scale(granularity),
 						  nx(0),
 						  ny(0),
 						  x_min(0),
 						  y_min(0),
+						  parallel(parallel),
 						  weights_set(false),
-                                                  iterations_per_cycle(1),
-                                                  object(0){
-  
+						  coverage_set(false),
+						  num_threads(0),
+						  stream_frames(false),
+						  frame_store(0){
+
+  //pretabulate the spacings (only used if sub-pixel reconstruction
+  //is performed i.e. scale>1)
+  for(int di=0; di < scale; di++)
+    sub_pos.push_back((di + 0.5*((scale+1) % 2)) /((double) scale));
 };
 
 
@@ -56,10 +83,17 @@ PhaseDiverseCDI::~PhaseDiverseCDI(){
   
   if(object)
     delete object;
+
+  if(dense_object)
+    delete dense_object;
+
+  if(frame_store)
+    delete frame_store;
   
 }
 
 void PhaseDiverseCDI::remove_positions(){
+  stream_in_frames();
   if ( !singleCDI.empty() ) {
       singleCDI.clear();
   }
@@ -69,21 +103,39 @@ void PhaseDiverseCDI::remove_positions(){
 //change the size of the global transmission function 
 //this function is used for dynamically determining the size
 //of the glocal transmission function array.
-void PhaseDiverseCDI::reallocate_object_memory(int new_nx,int new_ny){
+//The tiles of the object are kept, so nothing is copied.
+void PhaseDiverseCDI::reallocate_object_memory(int new_nx,int new_ny,
+					       int shift_x, int shift_y){
 
   if(object)
-    delete object;
-
-  object = new Complex_2D(new_nx,new_ny);
+    object->resize(new_nx,new_ny,shift_x,shift_y);
+  else
+    object = new TiledComplex_2D(new_nx,new_ny);
   
   nx = new_nx;
   ny = new_ny;
 
+  //the tiles may have moved
+  coverage_set = false;
+
 }
 
 //return the global transmision function.
 Complex_2D * PhaseDiverseCDI::get_transmission(){
-  return object;
+
+  if(!object)
+    return 0;
+
+  if(dense_object && (dense_object->get_size_x()!=nx ||
+		      dense_object->get_size_y()!=ny)){
+    delete dense_object;
+    dense_object = 0;
+  }
+  if(!dense_object)
+    dense_object = new Complex_2D(nx,ny);
+
+  object->get_dense(*dense_object);
+  return dense_object;
 }
 
 
@@ -135,6 +187,9 @@ void PhaseDiverseCDI::add_new_position(BaseCDI * local,
   weights.push_back(new Double_2D(lnx,lny));
 
   cout << "Added position "<<singleCDI.size()-1<<endl;
+
+  if(stream_frames)
+    stream_out_frame(singleCDI.size()-1);
   
   //if this is the first frame we will need to create the 
   //global transmission object as well
@@ -150,6 +205,8 @@ void PhaseDiverseCDI::add_new_position(BaseCDI * local,
   //pixel if we don't increase the frame size  
   int extra_x=0;
   int extra_y=0;
+  int shift_x=0;
+  int shift_y=0;
 
   int global_x_min = get_global_x_pos(0,x)*scale;  
   int global_y_min = get_global_y_pos(0,y)*scale;  
@@ -159,10 +216,12 @@ void PhaseDiverseCDI::add_new_position(BaseCDI * local,
   if(global_x_min<0){
     x_min = -x;
     extra_x += -global_x_min;
+    shift_x = -global_x_min;
   }
   if(global_y_min<0){
     y_min = -y;
     extra_y += -global_y_min;
+    shift_y = -global_y_min;
   }
   if(global_x_max>nx)
     extra_x += global_x_max-nx;
@@ -171,7 +230,7 @@ void PhaseDiverseCDI::add_new_position(BaseCDI * local,
 
   //if required, increase the global object size
   if(extra_x || extra_y)
-    reallocate_object_memory(nx+extra_x, ny+extra_y);
+    reallocate_object_memory(nx+extra_x, ny+extra_y, shift_x, shift_y);
 
 }
 
@@ -182,12 +241,7 @@ void PhaseDiverseCDI::add_new_position(BaseCDI * local,
 void PhaseDiverseCDI::initialise_estimate(){
 
   //start by setting the magnitude to 1 and phase to 0
-  for(int i=0; i<nx; i++){
-    for(int j=0; j<ny; j++){
-      object->set_real(i,j,1);
-      object->set_imag(i,j,0);
-    }
-  }
+  object->clear();
 
   //add the transmission from each frame
   //to the global object.
@@ -205,11 +259,29 @@ void PhaseDiverseCDI::iterate(){
 
   cout << "Iteration "<<total_iterations<<endl;
 
+  //if we are running in parallel mode, do at least one 'small'
+  //iteration for each frame. Then merge the results to form the new
+  //global transmission function.
+  if(parallel){
+    iterate_frames();
+    merge_frames();
+    if(stream_frames){
+      for(int i=0; i<singleCDI.size(); i++)
+	stream_out_frame(i);
+    }
+    total_iterations++;
+    return;
+  }
+
   //for each frame do a 'small' iteration.
   for(int i=0; i<singleCDI.size(); i++){
 
     int x, y;
 
+    //read the next frame while this one is iterated
+    if(frame_store)
+      frame_store->prefetch(i+1);
+
     //if(i!=0 && (total_iterations==2 || total_iterations==4))
     //  check_position(i);
     update_from_object(i);
@@ -238,74 +310,216 @@ void PhaseDiverseCDI::iterate(){
 
     }
 
-    //if we are running in series mode, update the
+    //we are running in series mode, so update the
     //small transmission to the large transmission function
     //after each 'small' iteration
-    if(!parallel)
-      add_to_object(i);
-
-  }
-  
-  //if we are running in parallel mode, wait until at least one
-  //'small' iteration have been performed for each frame. Then
-  //merge the results to form the new global transmission function. 
-  if(parallel){
+    add_to_object(i);
 
-    scale_object(1-beta);
+    if(stream_frames)
+      stream_out_frame(i);
 
-    for(int i=0; i<singleCDI.size(); i++){
-      add_to_object(i);
-    }
   }
 
+  //start reading the first frame for the next iteration
+  if(frame_store)
+    frame_store->prefetch(0);
+
   total_iterations++;
 
 };
 
+void PhaseDiverseCDI::iterate_frames(){
 
-//scale each element in the global transmission object.
-//note that the region outside the sample will not be scaled.
-//this function is only used when performing the reconstruction
-//in parallel mode.
-void PhaseDiverseCDI::scale_object(double factor){
+  int frames = singleCDI.size();
+  if(frames==0)
+    return;
 
+  //the weights are shared by the frames, so make them before the
+  //threads start.
   set_up_weights();
 
+  //one frame per thread. If there are more threads than frames the
+  //spare ones are given to the frames.
+  int threads = nadia::get_num_threads(num_threads);
+  int pool = threads < frames ? threads : frames;
+  if(pool > 1){
+    for(int i=0; i<frames; i++)
+      singleCDI.at(i)->set_num_threads(threads/pool);
+  }
+
+  std::vector<double> errors(frames*iterations_per_cycle);
+
+  //frames are handed out one at a time, so a thread which finishes
+  //early takes the next one.
+  NADIA_OMP(parallel for if(pool > 1) num_threads(pool) schedule(dynamic,1))
+  for(int i=0; i<frames; i++){
+
+    update_from_object(i);
+
+    for(int j=0; j<iterations_per_cycle; j++){
+      singleCDI.at(i)->iterate();
+      errors[i*iterations_per_cycle+j] = singleCDI.at(i)->get_error();
+    }
+
+    get_result(singleCDI.at(i),*(single_result.at(i)));
+
+    //with frame streaming only the frames being iterated need
+    //temporary arrays.
+    if(stream_frames)
+      singleCDI.at(i)->release_workspace();
+  }
+
+  if(pool > 1){
+    for(int i=0; i<frames; i++)
+      singleCDI.at(i)->set_num_threads(0);
+  }
+
+  for(int i=0; i<frames; i++){
+    for(int j=0; j<iterations_per_cycle; j++)
+      cout << "Error for frame "<<i<<" is "
+	   << errors[i*iterations_per_cycle+j] << endl;
+  }
+
+}
+
+void PhaseDiverseCDI::set_frame_streaming(bool stream,
+					  const char * directory){
+
+  scratch_directory = directory ? directory : "";
+
+  if(!stream)
+    stream_in_frames();
+  stream_frames = stream;
+
+  //move the frames which are already here
+  if(stream_frames){
+    for(int i=0; i<singleCDI.size(); i++)
+      stream_out_frame(i);
+  }
+}
+
+void PhaseDiverseCDI::stream_out_frame(int n_probe){
+
+  if(!frame_store)
+    frame_store = new FrameStore(scratch_directory.empty() ? 0 
+				 : scratch_directory.c_str());
+
+  BaseCDI * local = singleCDI.at(n_probe);
+  local->release_workspace();
+
+  //only the arrays which aren't in the file yet are moved
+  vector<Complex_2D*> complex_arrays;
+  vector<Double_2D*> real_arrays;
+  local->get_state_arrays(complex_arrays, real_arrays);
+  complex_arrays.push_back(single_result.at(n_probe));
+  real_arrays.push_back(weights.at(n_probe));
+  frame_store->add_arrays(n_probe, complex_arrays, real_arrays);
+
+  frame_store->release(n_probe);
+}
+
+void PhaseDiverseCDI::stream_in_frames(){
+
+  if(!frame_store)
+    return;
+
+  frame_store->wait();
+
+  int frames = frame_store->get_number_of_frames();
+  for(int n=0; n<frames && n<singleCDI.size(); n++){
+
+    vector<Complex_2D*> complex_arrays;
+    vector<Double_2D*> real_arrays;
+    singleCDI.at(n)->get_state_arrays(complex_arrays, real_arrays);
+    complex_arrays.push_back(single_result.at(n));
+    real_arrays.push_back(weights.at(n));
+
+    for(int a=0; a<complex_arrays.size(); a++){
+      if(frame_store->contains(n, complex_arrays[a]->get_array()))
+	complex_arrays[a]->move_to(0);
+    }
+    for(int a=0; a<real_arrays.size(); a++){
+      if(frame_store->contains(n, real_arrays[a]->get_array()))
+	real_arrays[a]->move_to(0);
+    }
+  }
+
+  delete frame_store;
+  frame_store = 0;
+}
+
+void PhaseDiverseCDI::merge_frames(){
+
+  scale_object(1-beta);
+
+  //the object is split into bands of rows, and each thread adds
+  //every frame to its own band. No two threads write to the same
+  //pixel, and each pixel sums the frames in the same order as the
+  //single threaded code.
   int frames = singleCDI.size();
+  int threads = nadia::get_num_threads(num_threads);
+  int bands = threads < nx ? threads : nx;
+  NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(nx*ny,bands))
+  for(int b=0; b<bands; b++){
+    int i_begin = (b*nx)/bands;
+    int i_end = ((b+1)*nx)/bands;
+    for(int i=0; i<frames; i++)
+      add_to_object(i, i_begin, i_end);
+  }
 
-  //loop over each element in the global transmission function.
-  for(int i=0; i<nx; i++){
-    for(int j=0; j<ny; j++){
+}
 
-      bool not_in_image = true;
-      int n_probe = 0;
 
-      //loop over each frame and check their weight function to determine
-      //if the current pixel is included inside the sample or not.
-      while(not_in_image&&n_probe<frames){
+//scale each element in the global transmission object.
+//note that the region outside the sample will not be scaled.
+//this function is only used when performing the reconstruction
+//in parallel mode.
+void PhaseDiverseCDI::scale_object(double factor){
 
-	int i_ = get_local_x_pos(i/scale, x_position.at(n_probe));  
-	int j_ = get_local_y_pos(j/scale, y_position.at(n_probe));
-	
-	if(i_>=0&&j_>=0
-	   &&i_<weights.at(n_probe)->get_size_x()
-	   &&j_<weights.at(n_probe)->get_size_y())
-	  not_in_image=(weights.at(n_probe)->get(i_,j_)==0); 
+  set_up_weights();
+  if(!coverage_set)
+    update_coverage();
+
+  //only the allocated tiles of the global transmission function are
+  //visited. The rest of it already reads as 1, which is what the
+  //pixels outside the frames are set to. Each pixel is independent,
+  //so the tiles are shared between threads.
+  vector<int> tile_x;
+  vector<int> tile_y;
+  object->get_tile_origins(tile_x,tile_y);
+
+  const int size = TiledComplex_2D::TILE_SIZE;
+  const int tiles = tile_x.size();
+  NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(tiles*size*size,nadia::get_num_threads(num_threads)))
+  for(int t=0; t<tiles; t++){
+
+    int ti = tile_x[t];
+    int tj = tile_y[t];
+    map<pair<int,int>, vector<unsigned char> >::const_iterator
+      it = covered.find(make_pair(ti,tj));
+    const unsigned char * in_image = it==covered.end() ? 0 : &(it->second[0]);
+
+    //the part of the tile inside the array
+    int i_min = ti < 0 ? 0 : ti;
+    int j_min = tj < 0 ? 0 : tj;
+    int i_max = ti+size > nx ? nx : ti+size;
+    int j_max = tj+size > ny ? ny : tj+size;
+
+    for(int i=i_min; i<i_max; i++){
+      for(int j=j_min; j<j_max; j++){
+
+	//in the case the pixel is outside, set the magntiude 
+	//to 1 and phase to 0.
+	if(!in_image || !in_image[(i-ti)*size+(j-tj)]){
+	  object->set_real(i,j,1.0);
+	  object->set_imag(i,j,0.0);
+	} //otherwise scale the value of the pixel.
+	else{
+	  object->set_real(i,j,factor*object->get_real(i,j));
+	  object->set_imag(i,j,factor*object->get_imag(i,j));
+	}	
 	
-	n_probe++;	
       }
-
-      //in the case the pixel is outside, set the magntiude 
-      //to 1 and phase to 0.
-      if(not_in_image){
-	object->set_real(i,j,1.0);
-	object->set_imag(i,j,0.0);
-      } //otherwise scale the value of the pixel.
-      else{
-	object->set_real(i,j,factor*object->get_real(i,j));
-	object->set_imag(i,j,factor*object->get_imag(i,j));
-      }	
-      
     }
   }
   
@@ -362,7 +576,7 @@ void PhaseDiverseCDI::adjust_positions(int type, bool forward,
 
   //make a copy of the tranmission function
 
-  Complex_2D * pointer_to_object = object;
+  TiledComplex_2D * pointer_to_object = object;
   int nx_c = nx;
   int ny_c = ny;
   double x_min_c = x_min; 
@@ -381,14 +595,8 @@ void PhaseDiverseCDI::adjust_positions(int type, bool forward,
     limit=-1;
   }
 
-  Complex_2D temp_object(nx,ny);
+  TiledComplex_2D temp_object(nx,ny);
   object = &temp_object;
-  for(int i=0; i<nx; i++){
-    for(int j=0; j<ny; j++){
-      temp_object.set_real(i,j,1);
-      temp_object.set_imag(i,j,0);
-    }
-  }
 
   beta = 1.0;
   weights_set=false;
@@ -503,7 +711,7 @@ void PhaseDiverseCDI::adjust_positions(int type, bool forward,
     //if we are using the minimum error algorithm
     if(type==MINIMUM_ERROR){
       
-      Complex_2D temp(lnx*scale,lny*scale);
+      TiledComplex_2D temp(lnx*scale,lny*scale,0,0);
       
       for(int i=0; i<lnx*scale; i++){
 	for(int j=0; j<lny*scale; j++){
@@ -620,8 +828,7 @@ int PhaseDiverseCDI::check_position(int n_probe, double step_size,
   //record the one with the lowest error metric.
 
   //copy some local stuff.
-  Complex_2D * object_copy = new Complex_2D(object->get_size_x(),object->get_size_y());
-  object_copy->copy(*object);
+  TiledComplex_2D * object_copy = new TiledComplex_2D(*object);
   Complex_2D * single_copy = new Complex_2D(size_x,size_y);
   single_copy->copy(*single_result.at(n_probe));
   double beta_c = beta;
@@ -771,7 +978,8 @@ void PhaseDiverseCDI::set_up_weights(){
   
   if(parallel){
     
-    Double_2D weight_norm(object->get_size_x(),object->get_size_y());
+    //the sum of the weights, only kept under the frames
+    map<pair<int,int>, vector<Double_2D::value_type> > weight_norm;
     
     for(int n=0; n<frames; n++){
       
@@ -791,12 +999,12 @@ void PhaseDiverseCDI::set_up_weights(){
 	  if(i>=0&&j>=0&&i<nx&&j<ny){
 	    
 	    double new_weight = weights.at(n)->get(i_,j_);
-	    double old_weight = weight_norm.get(i,j);
+	    Double_2D::value_type & norm = tiled_element(weight_norm,*object,i,j);
 	    
 	    if(n==0)
-	      weight_norm.set(i,j,new_weight);
+	      norm = new_weight;
 	    else
-	      weight_norm.set(i,j,new_weight+old_weight);
+	      norm = new_weight+norm;
 	  }
 	}
       }
@@ -822,7 +1030,7 @@ void PhaseDiverseCDI::set_up_weights(){
 	  if(i>=0&&j>=0&&i<nx&&j<ny){
 	    
 	    double old_weight = weights.at(n)->get(i_,j_);
-	    double norm = weight_norm.get(i,j);
+	    double norm = tiled_element(weight_norm,*object,i,j);
 
 	    if(norm<=0)
 	      weights.at(n)->set(i_,j_,0);
@@ -837,11 +1045,61 @@ void PhaseDiverseCDI::set_up_weights(){
  
   }
 
+  update_coverage();
+
   //  write_image("weight_0.tiff",*(weights.at(0)));
  };
 
 
   
+void PhaseDiverseCDI::update_coverage(){
+
+  covered.clear();
+  coverage_set = true;
+  if(!object)
+    return;
+
+  int frames = singleCDI.size();
+
+  for(int n_probe=0; n_probe<frames; n_probe++){
+
+    double x = x_position.at(n_probe);
+    double y = y_position.at(n_probe);
+    const Double_2D & this_weight = *weights.at(n_probe);
+    int lnx = this_weight.get_size_x();
+    int lny = this_weight.get_size_y();
+
+    //the global pixels which could map into this frame, with a
+    //couple of pixels to spare for the rounding of the positions.
+    int i_min = (get_global_x_pos(0,x)-2)*scale;
+    int i_max = (get_global_x_pos(lnx,x)+3)*scale;
+    int j_min = (get_global_y_pos(0,y)-2)*scale;
+    int j_max = (get_global_y_pos(lny,y)+3)*scale;
+    if(i_min < 0) i_min = 0;
+    if(j_min < 0) j_min = 0;
+    if(i_max > nx) i_max = nx;
+    if(j_max > ny) j_max = ny;
+
+    //the object is only written under the frames. Make sure that
+    //memory exists now, as it can't be allocated while several
+    //threads write to the object (see merge_frames()).
+    object->allocate(i_min,i_max,j_min,j_max);
+
+    //the same test scale_object() used to do for every frame
+    for(int i=i_min; i<i_max; i++){
+      int i_ = get_local_x_pos(i/scale, x);
+      if(i_<0 || i_>=lnx)
+	continue;
+      for(int j=j_min; j<j_max; j++){
+	int j_ = get_local_y_pos(j/scale, y);
+	if(j_>=0 && j_<lny && this_weight.get(i_,j_)!=0)
+	  tiled_element(covered,*object,i,j) = 1;
+      }
+    }
+  }
+
+}
+  
 /**
  * Update the result of the 'n_probe'th sub-frame to the
  * global object. This is a rather complicated, messy looking
@@ -853,6 +1111,11 @@ void PhaseDiverseCDI::add_to_object(int n_probe){
   //get the result from the local FresnelCDI or PlanarCDI
   get_result(singleCDI.at(n_probe),*(single_result.at(n_probe)));  
   set_up_weights();
+
+  add_to_object(n_probe, 0, nx);
+}
+
+void PhaseDiverseCDI::add_to_object(int n_probe, int i_begin, int i_end){
   
   double x_offset = x_position.at(n_probe);
   double y_offset = y_position.at(n_probe);
@@ -866,15 +1129,21 @@ void PhaseDiverseCDI::add_to_object(int n_probe){
   int lnx = small->get_size_x();
   int lny = small->get_size_y();
   
-  //pretabulate the spacings (only used if sub-pixel reconstruction
-  //is performed i.e. scale>1)
-  double * sub_pos = new double[scale];
-  for(int di=0; di < scale; di++){
-    sub_pos[di] = (di + 0.5*((scale+1) % 2)) /((double) scale);
-  }
+  //only the local rows which land in rows i_begin to i_end-1 are
+  //visited, so the threads of merge_frames() share the work rather
+  //than each going over every frame. The range has a margin for the
+  //rounding of get_global_x_pos() and the sub-pixel points, and the
+  //rows are still checked exactly below.
+  double x_shift = x_offset + x_min;
+  int i_first = (int) floor(i_begin/(double) scale + x_shift) - 2;
+  int i_last = (int) ceil(i_end/(double) scale + x_shift) + 2;
+  if(i_first < 1)
+    i_first = 1;
+  if(i_last > lnx-1)
+    i_last = lnx-1;
 
   //i_, j_ - the local (small) coordinate system
-  for(int i_=1; i_< lnx-1; i_++){
+  for(int i_=i_first; i_< i_last; i_++){
     for(int j_=1; j_< lny-1; j_++){
       
       double weight = this_weight.get(i_,j_);
@@ -930,6 +1199,10 @@ void PhaseDiverseCDI::add_to_object(int n_probe){
 		//work out the global position for each sub-pixel point
 		double new_i = (i_+0.5-x_offset-x_min)*scale + di;
 		double new_j = (j_+0.5-y_offset-y_min)*scale + dj;
+
+		//only change the rows we were asked to
+		if((int) new_i < i_begin || (int) new_i >= i_end)
+		  continue;
 		
 		//calculate the new value in the object (also using the pixel weight).
 		double new_real = weight*value_r 
@@ -950,7 +1223,8 @@ void PhaseDiverseCDI::add_to_object(int n_probe){
 	      }
 	    }
 	  }
-	  else{ //if we are not doing sub-pixel positioning
+	  else if(i>=i_begin && i<i_end){ //if we are not doing
+	                                  //sub-pixel positioning
 
 	    //just work out the value in the simple way.
 	    double new_real = weight*f00r + object->get_real(i,j);
@@ -1028,8 +1302,6 @@ void PhaseDiverseCDI::add_to_object(int n_probe){
   //  object->get_2d(MAG,temp);
   //write_image("after_norm.tiff",temp,false,0,1);
 
-  delete [] sub_pos;
-  
 }
 
 /**void PhaseDiverseCDI::get_object_sub_grid(Complex_2D & result,
@@ -12,31 +12,46 @@
 //double ** PlanarCDI::get_intensity_autocorrelation(){
 void PlanarCDI::get_intensity_autocorrelation(Double_2D & autoc){
 
-  //make a temporary object
-  Complex_2D temp_intensity(nx,ny);
+  //the intensity is real, so only half of its fourier transform
+  //needs to be calculated.
+  Double_2D intensity(nx,ny);
+  intensity.copy(intensity_sqrt);
+  intensity.square();
+
+  Complex_2D half_spectrum(nx,ny/2+1);
+  half_spectrum.perform_forward_fft_real(intensity);
+
+  //get the magnitude of the fourier transformed data. The other half
+  //of the spectrum is the mirror image of the first, and has the same
+  //magnitude. The result is centred and scaled as if invert(true)
+  //had been used.
+  const int middle_x = nx/2;
+  const int middle_y = ny/2;
+  const int ny_half = ny/2+1;
+  const double scale = 1.0/sqrt((double)nx*ny);
 
   for(int i=0; i<nx; i++){
+    int i_mirror = (nx-i)%nx;
+    int i_new = (i+middle_x)%nx;
     for(int j=0; j<ny; j++){
-      //set the real and imaginary components using the magnitude.
-      double component = (1.0/sqrt(2.0))*(intensity_sqrt.get(i,j)*intensity_sqrt.get(i,j));
-      temp_intensity.set_value(i,j,REAL, component);
-      temp_intensity.set_value(i,j,IMAG, component);
+      int j_new = (j+middle_y)%ny;
+      double mag;
+      if(j<ny_half)
+	mag = half_spectrum.get_mag(i,j);
+      else
+	mag = half_spectrum.get_mag(i_mirror,ny-j);
+      autoc.set(i_new,j_new,scale*mag);
     }
   }
   
-  // fourier transform the intensity 
-  //propagate_from_detector(temp_intensity);  
-
-  temp_intensity.perform_backward_fft(); 
-  temp_intensity.invert(true);
-
-  //get the magnitude of the fourier transformed data.
-  temp_intensity.get_2d(MAG, autoc);
-  
 }
 
 
 void PlanarCDI::initialise_estimate(int seed){
+  fill_random_estimate(complex, seed);
+}
+
+void PlanarCDI::fill_random_estimate(Complex_2D & c, int seed){
   //initialise the random number generator
   srand(seed);
 
@@ -46,15 +61,15 @@ void PlanarCDI::initialise_estimate(int seed){
     for(int j=0; j<ny; j++){
 
       if(!support.get(i,j)){ //enforce the support condition on the inital guess
-	complex.set_value(i,j,REAL,0); 
-	complex.set_value(i,j,IMAG,0);
+	c.set_value(i,j,REAL,0); 
+	c.set_value(i,j,IMAG,0);
       }
       else{
 	double r = support.get(i,j)*(max_value*rand()/(double) RAND_MAX);
 	double im = support.get(i,j)*(max_value*rand()/(double) RAND_MAX);
 
-	complex.set_value(i,j,REAL,r); 
-	complex.set_value(i,j,IMAG,im);
+	c.set_value(i,j,REAL,r); 
+	c.set_value(i,j,IMAG,im);
       }
     }
   }
@@ -63,11 +78,28 @@ void PlanarCDI::initialise_estimate(int seed){
 
 
 void PlanarCDI::propagate_to_detector(Complex_2D & c){
-    c.perform_forward_fft();
-    c.invert(true);
+    c.perform_forward_fft_centred();
 }
 
 void PlanarCDI::propagate_from_detector(Complex_2D & c){
-  c.invert(true);
-  c.perform_backward_fft(); 
+  c.perform_backward_fft_centred();
+}
+
+void PlanarCDI::project_intensity(Complex_2D & c){
+
+  if(!fused_projection || nx%2==1 || ny%2==1){
+    BaseCDI::project_intensity(c);
+    return;
+  }
+
+  {
+    NADIA_PROFILE(profile, Profiler::PROPAGATE_TO_DETECTOR);
+    c.perform_forward_fft();
+  }
+  {
+    NADIA_PROFILE(profile, Profiler::SCALE_INTENSITY);
+    scale_intensity_fft_order(c);
+  }
+  NADIA_PROFILE(profile, Profiler::PROPAGATE_FROM_DETECTOR);
+  c.perform_backward_fft();
 }
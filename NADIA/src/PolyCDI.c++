@@ -30,7 +30,8 @@ PolyCDI::PolyCDI(Complex_2D & initial_guess,
   : BaseCDI(initial_guess,n_best),
   beta(beta), 
   parallel(parallel),
-  intensity_sqrt_calc(nx, ny){
+  intensity_sqrt_calc(nx, ny),
+  padded(nx, ny){
 
 }
 
@@ -129,124 +130,31 @@ void PolyCDI::initialise_estimate(int seed){
 //and handles the multiple modes.
 int PolyCDI::iterate(){
 
-  //below is the code for the special case of ER
-  //this is faster than using the generic algorithm code
-  //further down in this function.
-
-  Complex_2D temp_complex_PFS(nx+2*paddingx, ny+2*paddingy);
-  Complex_2D temp_complex_PF(nx+2*paddingx, ny+2*paddingy);
-  Complex_2D temp_complex_PS(nx+2*paddingx, ny+2*paddingy);
-  Complex_2D temp_complex_PSF(nx+2*paddingx, ny+2*paddingy);
-
   singleCDI.clear();
 
-  if(algorithm==ER){
-    cout<<"before get padded"<<endl;
-    complex=complex.get_padded(paddingx, paddingy);
-    cout<<"after get padded"<<endl;
-    propagate_to_detector(complex);
-
-    scale_intensity(complex);
-    propagate_from_detector(complex);
-
-    complex=complex.get_unpadded(paddingx, paddingy);
-    apply_support(complex);
-    update_n_best();
-
-    return SUCCESS;
-
-  }
-
-  //start of the generic algorithm code
-
-  //PFS
-  if(algorithm_structure[PFS]!=0){
-    temp_complex_PFS=complex;
-    apply_support(temp_complex_PFS);
-    temp_complex_PFS=temp_complex_PFS.get_padded(paddingx, paddingy);
-    propagate_to_detector(temp_complex_PFS);
-    scale_intensity(temp_complex_PFS);
-    propagate_from_detector(temp_complex_PFS);
-    temp_complex_PFS=temp_complex_PFS.get_unpadded(paddingx, paddingy);
-
-  }
+  //the padding is added and removed in project_intensity, so the
+  //generic algorithm code can be used.
+  return BaseCDI::iterate();
+}
 
-  //F
-  if(algorithm_structure[PF]!=0){
-    temp_complex_PF=complex;
-    temp_complex_PF=temp_complex_PF.get_padded(paddingx, paddingy);
-    propagate_to_detector(temp_complex_PF);
-    scale_intensity(temp_complex_PF);
-    propagate_from_detector(temp_complex_PF);
-    temp_complex_PF=temp_complex_PF.get_unpadded(paddingx, paddingy);
+//pad the estimate, apply the intensity constraint and remove the
+//padding again. "padded" is only allocated the first time.
+void PolyCDI::project_intensity(Complex_2D & c){
 
+  c.pad_into(padded, paddingx, paddingy);
+  {
+    NADIA_PROFILE(profile, Profiler::PROPAGATE_TO_DETECTOR);
+    propagate_to_detector(padded);
   }
-
-  //S
-  if(algorithm_structure[PS]!=0){
-    temp_complex_PS=complex;
-    apply_support(temp_complex_PS);
+  {
+    NADIA_PROFILE(profile, Profiler::SCALE_INTENSITY);
+    scale_intensity(padded);
   }
-
-  //SF
-  if(algorithm_structure[PSF]!=0){
-    if(algorithm_structure[PF]!=0){
-      temp_complex_PSF=temp_complex_PF;
-      apply_support(temp_complex_PSF);
-    }else{
-      temp_complex_PSF=complex;
-      temp_complex_PSF=temp_complex_PSF.get_padded(paddingx, paddingy);
-      propagate_to_detector(temp_complex_PSF);
-      scale_intensity(temp_complex_PSF);
-      propagate_from_detector(temp_complex_PSF);
-      temp_complex_PSF=temp_complex_PSF.get_unpadded(paddingx, paddingy);
-      apply_support(temp_complex_PSF);
-    }
+  {
+    NADIA_PROFILE(profile, Profiler::PROPAGATE_FROM_DETECTOR);
+    propagate_from_detector(padded);
   }
-
-  //combine the result of the separate operators
-  double value_real, value_imag;
-  for(int i=0; i < nx; ++i){
-    for(int j=0; j < ny; ++j){
-
-      //Add the identity
-      value_real = (1+algorithm_structure[PI])*complex.get_real(i,j);
-      value_imag = (1+algorithm_structure[PI])*complex.get_imag(i,j);
-
-      //Add the component from the PfPs operator
-      if(algorithm_structure[PFS]!=0){
-	value_real+=algorithm_structure[PFS]*temp_complex_PFS.get_real(i,j);
-	value_imag+=algorithm_structure[PFS]*temp_complex_PFS.get_imag(i,j);
-      }
-
-      //Add the component from the Pf operator
-      if(algorithm_structure[PF]!=0){
-	value_real+=algorithm_structure[PF]*temp_complex_PF.get_real(i,j);
-	value_imag+=algorithm_structure[PF]*temp_complex_PF.get_imag(i,j);
-
-      }
-
-      //Add the component from the Ps operator
-      if(algorithm_structure[PS]!=0){
-	value_real+=algorithm_structure[PS]*temp_complex_PS.get_real(i,j);
-	value_imag+=algorithm_structure[PS]*temp_complex_PS.get_imag(i,j);
-      }
-
-      //Add the component from the PsPf operator
-      if(algorithm_structure[PSF]!=0){
-	value_real+=algorithm_structure[PSF]*temp_complex_PSF.get_real(i,j);
-	value_imag+=algorithm_structure[PSF]*temp_complex_PSF.get_imag(i,j);
-      }
-
-      complex.set_real(i,j,value_real);
-      complex.set_imag(i,j,value_imag);
-
-    }
-  }
-
-  //Update the transmission using the dominant mode
-  update_n_best();
-  return SUCCESS;
+  padded.unpad_into(c, paddingx, paddingy);
 }
 
 //scale the highest occupancy mode 
@@ -255,9 +163,6 @@ int PolyCDI::iterate(){
 void PolyCDI::scale_intensity(Complex_2D & c){
   double norm2_mag=0;
   double norm2_diff=0;
-  double measured_int=0;
-  double calc_int=0;
-  double scaled_mag=0;
 
   //  double lambdmax = spectrum.get(nlambda, wl);
   //  double nxmin = (1.0-lambdac/lambdmax)*((nx-1)/2);
@@ -265,29 +170,11 @@ void PolyCDI::scale_intensity(Complex_2D & c){
 
   expand_wl(c);
 
-  for(int i=0; i< nx; i++){
-    for(int j=0; j< ny; j++){
-      //reset the magnitude
-      if(beam_stop==0 || beam_stop->get(i,j)>0){
-
-	calc_int=intensity_sqrt_calc.get(i,j);
-	measured_int=intensity_sqrt.get(i,j); 
-
-	if(calc_int==0.0){
-	  scaled_mag=0.0;
-	}else{
-	  scaled_mag=c.get_mag(i+paddingx,j+paddingy)*measured_int/calc_int;
-	}
-	c.set_mag(i+paddingx,j+paddingy,scaled_mag);
+  //scale by the ratio of the measured and calculated amplitudes.
+  //c is padded, so only the central region is changed.
+  c.project_modulus(intensity_sqrt, beam_stop, norm2_mag, norm2_diff,
+		    &intensity_sqrt_calc, 0, 1, 1, paddingx, paddingy);
 
-	//calculate the error
-	norm2_mag += measured_int*measured_int;
-
-	norm2_diff += (measured_int-calc_int)*(measured_int-calc_int);
-
-      }
-    }
-  }
   current_error = norm2_diff/norm2_mag;
 }
 
@@ -388,16 +275,14 @@ void PolyCDI::unpad_support(){
 //Propagate from the object plane to the detector
 void PolyCDI::propagate_to_detector(Complex_2D & c){
 
-  c.perform_forward_fft();
-  c.invert(true);
+  c.perform_forward_fft_centred();
 
 }
 
 //Propagate form the detector plane to the object
 void PolyCDI::propagate_from_detector(Complex_2D & c){
 
-  c.invert(true);
-  c.perform_backward_fft();
+  c.perform_backward_fft_centred();
 
 }
 
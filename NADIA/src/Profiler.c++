@@ -0,0 +1,82 @@
+// Copyright 2011 Nadia Davidson for The ARC Centre of Excellence in
+// Coherent X-ray Science. This program is distributed under the GNU
+// General Public License. We also ask that you cite this software in
+// publications where you made use of it for any part of the data
+// analysis.
+
+#include <iomanip>
+#include <sys/time.h>
+#include <Profiler.h>
+
+using namespace std;
+
+static const char * stage_names[Profiler::N_STAGES] = {
+  "propagate_to_detector",
+  "scale_intensity",
+  "propagate_from_detector",
+  "apply_support",
+  "transmission_constraint",
+  "update_n_best",
+  "combine",
+  "iterate"
+};
+
+Profiler::Profiler(){
+  reset();
+}
+
+void Profiler::reset(){
+  for(int s=0; s < N_STAGES; s++){
+    total_time[s] = 0;
+    calls[s] = 0;
+  }
+}
+
+double Profiler::get_time(int stage) const{
+  return total_time[stage];
+}
+
+long Profiler::get_calls(int stage) const{
+  return calls[stage];
+}
+
+const char * Profiler::get_name(int stage){
+  return stage_names[stage];
+}
+
+bool Profiler::is_enabled(){
+#ifdef NADIA_PROFILING
+  return true;
+#else
+  return false;
+#endif
+}
+
+double Profiler::now(){
+  struct timeval t;
+  gettimeofday(&t, 0);
+  return t.tv_sec + 1e-6*t.tv_usec;
+}
+
+void Profiler::print(ostream & out) const{
+
+  if(!is_enabled()){
+    out << "No profile, the library was built without "
+	<< "--enable-profiling" << endl;
+    return;
+  }
+
+  out << setw(25) << left << "stage"
+      << setw(10) << right << "calls"
+      << setw(14) << "total (s)"
+      << setw(14) << "per call (ms)" << endl;
+
+  for(int s=0; s < N_STAGES; s++){
+    if(calls[s]==0)
+      continue;
+    out << setw(25) << left << stage_names[s]
+	<< setw(10) << right << calls[s]
+	<< setw(14) << total_time[s]
+	<< setw(14) << 1000*total_time[s]/calls[s] << endl;
+  }
+}
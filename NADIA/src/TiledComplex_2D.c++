@@ -0,0 +1,287 @@
+// Copyright 2011 Nadia Davidson for The ARC Centre of Excellence in
+// Coherent X-ray Science. This program is distributed under the GNU
+// General Public License. We also ask that you cite this software in
+// publications where you made use of it for any part of the data
+// analysis.
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <TiledComplex_2D.h>
+
+using namespace std;
+
+//the number of tiles needed to hold n elements starting at "offset"
+static int tiles_needed(int offset, int n){
+  return (offset + n + TiledComplex_2D::TILE_SIZE - 1)
+    >> TiledComplex_2D::TILE_BITS;
+}
+
+TiledComplex_2D::TiledComplex_2D(int x_size, int y_size,
+				 double fill_real, double fill_imag)
+  : nx(x_size), ny(y_size),
+    offset_x(0), offset_y(0),
+    fill_real(fill_real), fill_imag(fill_imag){
+
+  if(nx < 0 || ny < 0){
+    cout << "A TiledComplex_2D can not have a negative size. "
+	 << "Exiting..." << endl;
+    exit(1);
+  }
+
+  tiles_x = tiles_needed(0, nx);
+  tiles_y = tiles_needed(0, ny);
+  tiles.assign(tiles_x*tiles_y, (FFTW_COMPLEX *) 0);
+}
+
+TiledComplex_2D::TiledComplex_2D(const TiledComplex_2D & object)
+  : nx(0), ny(0), offset_x(0), offset_y(0), tiles_x(0), tiles_y(0){
+  *this = object;
+}
+
+TiledComplex_2D & TiledComplex_2D::operator=(const TiledComplex_2D & rhs){
+  if(this==&rhs)
+    return *this;
+
+  free_tiles();
+
+  nx = rhs.nx;
+  ny = rhs.ny;
+  offset_x = rhs.offset_x;
+  offset_y = rhs.offset_y;
+  tiles_x = rhs.tiles_x;
+  tiles_y = rhs.tiles_y;
+  fill_real = rhs.fill_real;
+  fill_imag = rhs.fill_imag;
+
+  const int tile_elements = TILE_SIZE*TILE_SIZE;
+  tiles.assign(tiles_x*tiles_y, (FFTW_COMPLEX *) 0);
+  for(unsigned int t=0; t < tiles.size(); t++){
+    if(rhs.tiles[t]){
+      tiles[t] = (FFTW_COMPLEX*) FFTW_MALLOC(sizeof(FFTW_COMPLEX)*tile_elements);
+      memcpy(tiles[t], rhs.tiles[t], sizeof(FFTW_COMPLEX)*tile_elements);
+    }
+  }
+
+  return *this;
+}
+
+TiledComplex_2D::~TiledComplex_2D(){
+  free_tiles();
+}
+
+void TiledComplex_2D::free_tiles(){
+  for(unsigned int t=0; t < tiles.size(); t++){
+    if(tiles[t])
+      FFTW_FREE(tiles[t]);
+  }
+  tiles.clear();
+}
+
+FFTW_COMPLEX * TiledComplex_2D::allocate_element(int x, int y){
+
+  int gx = x + offset_x;
+  int gy = y + offset_y;
+  FFTW_COMPLEX * & tile = tiles[(gx >> TILE_BITS)*tiles_y
+				+ (gy >> TILE_BITS)];
+
+  const int tile_elements = TILE_SIZE*TILE_SIZE;
+  tile = (FFTW_COMPLEX*) FFTW_MALLOC(sizeof(FFTW_COMPLEX)*tile_elements);
+  for(int k=0; k < tile_elements; k++){
+    tile[k][REAL] = fill_real;
+    tile[k][IMAG] = fill_imag;
+  }
+
+  return tile + (((gx & (TILE_SIZE-1)) << TILE_BITS)
+		 | (gy & (TILE_SIZE-1)));
+}
+
+void TiledComplex_2D::resize(int x_size, int y_size,
+			     int shift_x, int shift_y){
+
+  if(x_size < 0 || y_size < 0){
+    cout << "A TiledComplex_2D can not have a negative size. "
+	 << "Exiting..." << endl;
+    exit(1);
+  }
+
+  //where element (0,0) will be in the grid. If it is off the grid,
+  //whole tiles are added before the old ones.
+  int new_offset_x = offset_x - shift_x;
+  int new_offset_y = offset_y - shift_y;
+  int add_x = new_offset_x < 0 ? (TILE_SIZE - 1 - new_offset_x) >> TILE_BITS : 0;
+  int add_y = new_offset_y < 0 ? (TILE_SIZE - 1 - new_offset_y) >> TILE_BITS : 0;
+  new_offset_x += add_x*TILE_SIZE;
+  new_offset_y += add_y*TILE_SIZE;
+
+  int new_tiles_x = tiles_needed(new_offset_x, x_size);
+  int new_tiles_y = tiles_needed(new_offset_y, y_size);
+
+  //the tiles the old grid needs in the new one
+  if(new_tiles_x < tiles_x + add_x)
+    new_tiles_x = tiles_x + add_x;
+  if(new_tiles_y < tiles_y + add_y)
+    new_tiles_y = tiles_y + add_y;
+
+  //move the tile pointers (not the tiles) to the new grid, freeing
+  //the tiles which are no longer inside the array.
+  int first_x = new_offset_x >> TILE_BITS;
+  int first_y = new_offset_y >> TILE_BITS;
+  int last_x = tiles_needed(new_offset_x, x_size);
+  int last_y = tiles_needed(new_offset_y, y_size);
+
+  vector<FFTW_COMPLEX *> new_tiles(new_tiles_x*new_tiles_y,
+				   (FFTW_COMPLEX *) 0);
+  for(int tx=0; tx < tiles_x; tx++){
+    for(int ty=0; ty < tiles_y; ty++){
+      FFTW_COMPLEX * tile = tiles[tx*tiles_y + ty];
+      if(!tile)
+	continue;
+      int ntx = tx + add_x;
+      int nty = ty + add_y;
+      if(ntx < first_x || ntx >= last_x || nty < first_y || nty >= last_y)
+	FFTW_FREE(tile);
+      else
+	new_tiles[ntx*new_tiles_y + nty] = tile;
+    }
+  }
+
+  tiles.swap(new_tiles);
+  tiles_x = new_tiles_x;
+  tiles_y = new_tiles_y;
+  offset_x = new_offset_x;
+  offset_y = new_offset_y;
+
+  int old_nx = nx;
+  int old_ny = ny;
+  nx = x_size;
+  ny = y_size;
+
+  //parts of the kept tiles may have been outside the old array and
+  //hold stale values, but must now read as the fill value.
+  for(int tx=first_x; tx < last_x; tx++){
+    for(int ty=first_y; ty < last_y; ty++){
+      FFTW_COMPLEX * tile = tiles[tx*tiles_y + ty];
+      if(!tile)
+	continue;
+      //nothing to do if the whole tile was inside the old array
+      int x0 = (tx << TILE_BITS) - offset_x - shift_x;
+      int y0 = (ty << TILE_BITS) - offset_y - shift_y;
+      if(x0 >= 0 && y0 >= 0 && x0 + TILE_SIZE <= old_nx
+	 && y0 + TILE_SIZE <= old_ny)
+	continue;
+      for(int lx=0; lx < TILE_SIZE; lx++){
+	for(int ly=0; ly < TILE_SIZE; ly++){
+	  int x = (tx << TILE_BITS) + lx - offset_x;
+	  int y = (ty << TILE_BITS) + ly - offset_y;
+	  //the element was in the old array
+	  int old_x = x - shift_x;
+	  int old_y = y - shift_y;
+	  bool inside_old = old_x >= 0 && old_y >= 0
+	    && old_x < old_nx && old_y < old_ny;
+	  if(!inside_old){
+	    tile[(lx << TILE_BITS) | ly][REAL] = fill_real;
+	    tile[(lx << TILE_BITS) | ly][IMAG] = fill_imag;
+	  }
+	}
+      }
+    }
+  }
+
+}
+
+void TiledComplex_2D::allocate(int x_min, int x_max, int y_min, int y_max){
+
+  if(x_min < 0) x_min = 0;
+  if(y_min < 0) y_min = 0;
+  if(x_max > nx) x_max = nx;
+  if(y_max > ny) y_max = ny;
+  if(x_min >= x_max || y_min >= y_max)
+    return;
+
+  //visit one element in each tile of the region
+  for(int tx=(x_min+offset_x) >> TILE_BITS;
+      tx <= (x_max-1+offset_x) >> TILE_BITS; tx++){
+    for(int ty=(y_min+offset_y) >> TILE_BITS;
+	ty <= (y_max-1+offset_y) >> TILE_BITS; ty++){
+      int x = (tx << TILE_BITS) - offset_x;
+      int y = (ty << TILE_BITS) - offset_y;
+      if(x < x_min) x = x_min;
+      if(y < y_min) y = y_min;
+      if(!find_element(x, y))
+	allocate_element(x, y);
+    }
+  }
+
+}
+
+void TiledComplex_2D::clear(){
+  const int tile_elements = TILE_SIZE*TILE_SIZE;
+  for(unsigned int t=0; t < tiles.size(); t++){
+    if(tiles[t]){
+      for(int k=0; k < tile_elements; k++){
+	tiles[t][k][REAL] = fill_real;
+	tiles[t][k][IMAG] = fill_imag;
+      }
+    }
+  }
+}
+
+void TiledComplex_2D::copy(const TiledComplex_2D & c){
+  if(c.get_size_x()!=nx || c.get_size_y()!=ny){
+    cout << "In TiledComplex_2D::copy, the arrays do not have the "
+	 << "same dimensions. Exiting..." << endl;
+    exit(1);
+  }
+  *this = c;
+}
+
+void TiledComplex_2D::copy(const Complex_2D & c){
+  if(c.get_size_x()!=nx || c.get_size_y()!=ny){
+    cout << "In TiledComplex_2D::copy, the arrays do not have the "
+	 << "same dimensions. Exiting..." << endl;
+    exit(1);
+  }
+  clear();
+  for(int x=0; x < nx; x++){
+    for(int y=0; y < ny; y++){
+      set_real(x, y, c.get_real(x, y));
+      set_imag(x, y, c.get_imag(x, y));
+    }
+  }
+}
+
+void TiledComplex_2D::get_dense(Complex_2D & result) const{
+  if(result.get_size_x()!=nx || result.get_size_y()!=ny){
+    cout << "In TiledComplex_2D::get_dense, the arrays do not have "
+	 << "the same dimensions. Exiting..." << endl;
+    exit(1);
+  }
+  for(int x=0; x < nx; x++){
+    for(int y=0; y < ny; y++){
+      result.set_real(x, y, get_real(x, y));
+      result.set_imag(x, y, get_imag(x, y));
+    }
+  }
+}
+
+int TiledComplex_2D::get_allocated_tiles() const{
+  int count = 0;
+  for(unsigned int t=0; t < tiles.size(); t++){
+    if(tiles[t])
+      count++;
+  }
+  return count;
+}
+
+void TiledComplex_2D::get_tile_origins(vector<int> & x,
+				       vector<int> & y) const{
+  x.clear();
+  y.clear();
+  for(unsigned int t=0; t < tiles.size(); t++){
+    if(tiles[t]){
+      x.push_back((t / tiles_y)*TILE_SIZE - offset_x);
+      y.push_back((t % tiles_y)*TILE_SIZE - offset_y);
+    }
+  }
+}
@@ -9,6 +9,7 @@
 #include <Double_2D.h>
 #include <Complex_2D.h>
 #include <TransmissionConstraint.h>
+#include <Parallel.h>
 
 
 
@@ -83,7 +84,6 @@ void TransmissionConstraint::apply_constraint(Complex_2D & transmission){
     int nx = transmission.get_size_x();
     int ny = transmission.get_size_y();
 
-    int region_number;
     ComplexConstraint * current_constraint = 0;
 
     vector<double> mean_lnA;
@@ -99,16 +99,30 @@ void TransmissionConstraint::apply_constraint(Complex_2D & transmission){
 	mean_phase.push_back(0);
       }
 
-      //recalculate the mean c for each region
-      for(int i=0; i < nx; i++){
-	for(int j=0; j < ny; j++){
+      //recalculate the mean c for each region. Each thread sums
+      //its own rows and the totals are added together at the end.
+      NADIA_OMP(parallel NADIA_OMP_PARALLEL_CLAUSES_WITH(nx*ny,transmission.get_num_threads()))
+      {
+	vector<double> thread_lnA(regions,0);
+	vector<double> thread_phase(regions,0);
+
+	NADIA_OMP(for schedule(static))
+	for(int i=0; i < nx; i++){
+	  for(int j=0; j < ny; j++){
 	
-	  if(region_map->get(i,j)>0){
-	    region_number = region_map->get(i,j)-1;
-	    mean_phase.at(region_number) += fabs(transmission.get_phase(i,j));
-	    mean_lnA.at(region_number) += fabs(log(transmission.get_mag(i,j)));
+	    if(region_map->get(i,j)>0){
+	      int region_number = region_map->get(i,j)-1;
+	      thread_phase.at(region_number) += fabs(transmission.get_phase(i,j));
+	      thread_lnA.at(region_number) += fabs(log(transmission.get_mag(i,j)));
+	    }
 	  }
 	}
+
+	NADIA_OMP(critical)
+	for(int i=0; i < regions; i++){
+	  mean_lnA.at(i) += thread_lnA.at(i);
+	  mean_phase.at(i) += thread_phase.at(i);
+	}
       }
 
       for(int i=0; i<regions; i++){
@@ -120,28 +134,25 @@ void TransmissionConstraint::apply_constraint(Complex_2D & transmission){
     /**  now we start the main loop to alter the
 	   values in the transmission function array */
     
-    double mag_old;
-    double mag_new;
-    double phase_old;
-    double phase_new;
-
     if(regions>0||do_charge_flip||do_enforce_unity){
 
+      NADIA_OMP(parallel for NADIA_OMP_CLAUSES_WITH(nx*ny,transmission.get_num_threads()))
       for(int i=0; i < nx; i++){
 	for(int j=0; j < ny; j++){
 	
-	  phase_old = transmission.get_phase(i,j);
-	  mag_old = transmission.get_mag(i,j);
+	  double phase_old = transmission.get_phase(i,j);
+	  double mag_old = transmission.get_mag(i,j);
 
 	  //apply complex constraints based on refractive indicies.
 	  if(regions>0 && region_map->get(i,j)>0){
-	    region_number =  region_map->get(i,j)-1;
-	    current_constraint = complex_constraint_list.at(region_number);
+	    int region_number =  region_map->get(i,j)-1;
+	    ComplexConstraint * constraint =
+	      complex_constraint_list.at(region_number);
 	    
 	    //cout <<"mag/phase old: "<< phase_old<<" "<< mag_old<<endl;
 
-	    mag_new = current_constraint->get_new_mag(mag_old, phase_old);
-	    phase_new = current_constraint->get_new_phase(mag_old, phase_old);
+	    double mag_new = constraint->get_new_mag(mag_old, phase_old);
+	    double phase_new = constraint->get_new_phase(mag_old, phase_old);
 	    
 	    //	cout <<"mag/phase old: "<< phase_new<<" "<< mag_new<<endl;
 
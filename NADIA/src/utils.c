@@ -12,6 +12,8 @@
 #include <Complex_2D.h>
 #include <Double_2D.h>
 #include <FresnelCDI.h>
+#include <GaussianFilter.h>
+#include <GEPSolver.h>
 #include <cstdlib>
 #include <cmath>
 #include <limits>
@@ -21,16 +23,6 @@
 
 using namespace std;
 
-extern"C" {
-
-
-  void zhegv_(int *itype, char *jobz, char *uplo, int *n,
-      double *a, int *lda, double *b, int *ldb,
-      double *w, double *work, int *lwork, double *rwork,
-      int *info);
-
-}
-
 #define BINS 100
 #define sgn(x) (( x > 0 ) - ( x < 0 ))
 
@@ -1249,8 +1241,9 @@ double edges(Double_2D & image){
       Double_2D temp_img_1_weight(nx,ny);
       Double_2D temp_img_2_weight(nx,ny);
 
-      Complex_2D temp_fft_1(nx,ny);
-      Complex_2D temp_fft_2(nx,ny);
+      //the images are real, so only half of each spectrum is kept
+      Complex_2D temp_fft_1(nx,ny/2+1);
+      Complex_2D temp_fft_2(nx,ny/2+1);
 
       //plan for backwards fourier transform
       //Complex_2D fft_total(nx,ny);
@@ -1777,77 +1770,9 @@ Double_2D fill_legmatrix(std::vector<double> x, int norder){
   return(legmatrix);
 }
 
-//Uses the LAPACK library to solve JC=nSC. As
-//LAPACK is FORTRAN, there is some matrix 
-//transposing.
+//Uses the LAPACK library to solve JC=nSC (see GEPSolver).
 void solve_gep(Complex_2D & A, Complex_2D & B, vector<double> & eigen){
-
-  if(A.get_size_x()!=B.get_size_x()||A.get_size_y()!=B.get_size_y()||A.get_size_x()!=B.get_size_y()){
-
-    std::cout<<"The matrices are the wrong size to solve. "
-      <<"Something is amiss."<<std::endl;
-    return;
-  }
-
-  double Afort[2*A.get_size_x()*A.get_size_x()+A.get_size_x()], Bfort[2*B.get_size_x()*B.get_size_x()], eigenfort[B.get_size_x()];
-
-  for(int i=0; i<A.get_size_x(); i++){
-    for(int j=0; j<A.get_size_y(); j++){
-
-      Afort[2*(j+A.get_size_x()*i)]=A.get_real(j,i);
-      Afort[2*(j+A.get_size_x()*i)+1]=A.get_imag(j,i);
-      Bfort[2*(j+B.get_size_x()*i)]=B.get_real(j,i);
-      Bfort[2*(j+B.get_size_x()*i)+1]=B.get_imag(j,i);
-    }
-  }
-
-  int ITYPE=1;
-  char UPLO='L';
-  int N=A.get_size_x();
-  char JOB='V';
-  int LDA=A.get_size_x();
-  int LDB=B.get_size_x();
-  int LWORK=2*A.get_size_x();
-  double WORK[2*LWORK];
-  double RWORK[2*LWORK];
-  int INFO;
-
-
-  zhegv_(&ITYPE, &JOB, &UPLO, &N, Afort, &LDA, Bfort,&LDB, eigenfort, WORK, &LWORK, RWORK, &INFO);
-
-//  eigen.clear();
-
-  for(int i=0; i<A.get_size_x(); i++){
-
-    eigen.push_back(eigenfort[i]);
-    //std::cout<< eigenfort[i]/4<<" "<<eigen.at(i)<<" is eigen"<<endl;
-
-    for(int j=0; j<A.get_size_y(); j++){
-/*
-      if(Afort[2*(j+A.get_size_x()*i)]<1e-30){
-	Afort[2*(j+A.get_size_x()*i)]=0;
-      }
-      if(Afort[2*(j+A.get_size_x()*i)+1]<1e-30){
-	Afort[2*(j+A.get_size_x()*i)+1]=0;
-      }
-      if(Bfort[2*(j+B.get_size_x()*i)]<1e-30){
-	Bfort[2*(j+B.get_size_x()*i)]=0;
-      }
-      if(Bfort[2*(j+B.get_size_x()*i)+1]<1e-30){
-	Bfort[2*(j+B.get_size_x()*i)+1]=0;
-      }
-*/
-      A.set_real(j,i, Afort[2*(j+A.get_size_x()*i)]);
-      //      std::cout<<A.get_real(j,i)<<"\n";
-      A.set_imag(j,i, Afort[2*(j+A.get_size_x()*i)+1]);
-      B.set_real(j,i, Bfort[2*(j+B.get_size_x()*i)]);
-      B.set_imag(j,i, Bfort[2*(j+B.get_size_x()*i)+1]);
-
-
-    }
-  }
-
-  return;
+  GEPSolver::solve(A, B, eigen);
 }
 
 ////////////////////////////////
@@ -1984,40 +1909,22 @@ Double_2D vector_convolution(Double_2D const & m, double* v, unsigned int n, boo
 }
 
 /**
- * Use seperability to calculate a gaussian convolution of the given matrix using 1D gaussian
- * vectors in x and y.
- * lx and ly are the standard deviations of the gaussian in x and y respectivley.
+ * Calculate a gaussian convolution of the given matrix. lx and ly are
+ * the standard deviations of the gaussian. As in the original
+ * implementation (two vector_convolution passes), lx blurs along the
+ * second array index and ly along the first. GaussianFilter chooses
+ * between a direct, recursive or fourier space convolution depending
+ * on the width.
  */
 Double_2D gaussian_convolution(Double_2D const & m, double lx, double ly, double kernel_x_size_in_std_dev, double kernel_y_size_in_std_dev){
-  // Ensure that std_deviations are positive
-  lx = fabs(lx);
-  ly = fabs(ly);
-
-  // Calculate gaussian vector sizes based on std_deviation to give fixed accuracy:
-  unsigned int x_gaussian_length = 1024;//(unsigned int) ceil(lx * kernel_x_size_in_std_dev);
-  if (x_gaussian_length%2 == 0){ // Enforce that length is odd to simplify computation
-    x_gaussian_length += 1;
-  }
-  unsigned int y_gaussian_length = 1024;//(unsigned int) ceil(ly * kernel_y_size_in_std_dev);
-  if (y_gaussian_length%2 == 0){ // Enforce that length is odd to simplify computation
-    y_gaussian_length += 1;
-  }
 
-  double* g; // Gaussian vector
-  Double_2D convolution; // Result matrix
-
-  if(x_gaussian_length > 1){ // If the gaussian is only of length 1, then it will just be a delta-fn and thus do nothing
-    g = get_gaussian_vector(lx, x_gaussian_length); // Gaussian x-vector
-    convolution = vector_convolution(m, g, x_gaussian_length, false); // Column-wise (x-aligned) convolution (intermediate result)
-    free(g); // Prevent memory leak
-  } else{
-    convolution = m; // Leave the original matrix unchanged and set it to be the intermediate result
-  }
+  Double_2D convolution(m.get_size_x(), m.get_size_y()); // Result matrix
 
-  if(y_gaussian_length > 1){ // If the gaussian is only of length 1, then it will just  be a delta-fn and thus do nothing
-    g = get_gaussian_vector(ly, y_gaussian_length); // Gaussian y-vector
-    convolution = vector_convolution(convolution, g, y_gaussian_length, true); // Row-wise (y-aligned) convolution
-    free(g); // Prevent memory leak
+  if(kernel_x_size_in_std_dev == kernel_y_size_in_std_dev){
+    GaussianFilter::apply(m, convolution, ly, lx, kernel_x_size_in_std_dev);
+  } else{ // The kernels are cut off differently, so do one direction at a time
+    GaussianFilter::apply(m, convolution, 0, lx, kernel_x_size_in_std_dev);
+    GaussianFilter::apply(convolution, convolution, ly, 0, kernel_y_size_in_std_dev);
   }
 
   return convolution;
@@ -2034,8 +1941,7 @@ Double_2D radial_gaussian_convolution(Double_2D const & m, double lr, double ker
  */
 void convolve(Double_2D & array, double gauss_width, int pixel_cut_off){
   gauss_width *= sqrt(2);
-  Double_2D temp_array = radial_gaussian_convolution(array, gauss_width, ((double) pixel_cut_off)/gauss_width);
-  array.copy(temp_array);
+  GaussianFilter::apply(array, array, gauss_width, gauss_width, ((double) pixel_cut_off)/gauss_width);
 }
 
 /** 
@@ -2047,6 +1953,8 @@ void convolve(Double_2D & array, double gauss_width, int pixel_cut_off){
  */
 double minimise_function(MathFunction & f, double left, double guess, double right, double tolerance){
   double x, left_bracket_size, right_bracket_size;
+  double f_guess = f.call(guess); // f is only evaluated again when the guess moves
+  double f_x;
 
   while(fabs(right-left) > tolerance){
     left_bracket_size = fabs(guess - left);
@@ -2056,7 +1964,8 @@ double minimise_function(MathFunction & f, double left, double guess, double rig
     x = 0.38197 * max(left_bracket_size, right_bracket_size) * ((left_bracket_size > right_bracket_size) ? -1:1) + guess;
 
     // Choose the new bracket by evaluating f at guess and at x
-    if(f.call(guess) < f.call(x)){
+    f_x = f.call(x);
+    if(f_guess < f_x){
       if(left_bracket_size > right_bracket_size){
 	left = x;
       } else{
@@ -2069,6 +1978,7 @@ double minimise_function(MathFunction & f, double left, double guess, double rig
 	left = guess;
       }
       guess = x;
+      f_guess = f_x;
     }
   }
 
@@ -14,7 +14,7 @@
  * Partial Coherent (spatial and temporal) ESW reconstruction.  This 
  * tool is provided as a demonstrative tool and to obtain results quickly.
  *
- * \par Usage: CDI_reconstruction.exe \<config filename\> \<reco_type\> \<seed\>
+ * \par Usage: CDI_reconstruction.exe \<config filename\> \<reco_type\> \<seed\> \<n_seeds\>
  *
  * 
  * where reco_type may be:
@@ -30,12 +30,39 @@
  * command line arguments, it is assumed to be "0". If reco_type is
  * also excluded, it is assumed to be "planar".
  *
+ * For planar reconstruction, n_seeds random starts (with the seeds
+ * seed, seed+1, ...) can be reconstructed together by giving
+ * n_seeds. They share the data, support and fftw plans (see
+ * BatchCDI), which is much quicker than running the tool n_seeds
+ * times. The result of each start is written to
+ * \<output_file_name_prefix\>_seed_\<seed\>.cplx, and the one with
+ * the lowest error is also written to the usual output file. If
+ * "n_best" is given in the configuration file, the n_best best
+ * estimates from all the starts are written to
+ * \<output_file_name_prefix\>_best_\<n\>.cplx. n_seeds defaults to 1.
+ *
+ * The number of iterations given for each algorithm is the most
+ * which will be done. An algorithm is ended early if the error
+ * stops improving (by convergence_tolerance over convergence_window
+ * iterations) or grows by more than divergence_factor, and the
+ * reconstruction stops once the error reaches target_error. With
+ * plateau_shrinkwraps set, a plateau triggers a shrinkwrap (up to
+ * that many times per algorithm) before the algorithm is ended. See
+ * IterationScheduler and planar_example.config.
+ *
+ * If the library was built with --enable-profiling and info_level
+ * is 2 or more, the time spent in each stage of the iterations is
+ * printed at the end (see Profiler.h).
+ *
  * \par Example:
  * \verbatim CDI_reconstruction.exe planar_example.config "planar" 3 \endverbatim
  * Perform planar CDI reconstruction using the configuration given in the file,
  * "planar_example.config". The random number generator (used to initial the
  * first guess) is given a seed value of 3.
  *
+ * \verbatim CDI_reconstruction.exe planar_example.config "planar" 3 50 \endverbatim
+ * As above, but for 50 random starts with the seeds 3 to 52.
+ *
  */
 
 #include <iostream>
@@ -51,12 +78,15 @@
 #include <Double_2D.h>
 #include <BaseCDI.h>
 #include <PlanarCDI.h>
+#include <BatchCDI.h>
 #include <FresnelCDI.h>
 #include <FresnelCDI_WF.h>
 #include <PartialCDI.h>
 #include <PartialCharCDI.h>
 #include <PolyCDI.h>
 #include <Config.h>
+#include <FFTWPlanCache.h>
+#include <IterationScheduler.h>
 
 using namespace std;
 
@@ -77,17 +107,19 @@ void print_usage(){
 
   cout << "Usage: " << endl << endl
        << "CDI_reconstruction.exe <config filename> " 
-       << "<reco_type> <seed>" << endl << endl
+       << "<reco_type> <seed> <n_seeds>" << endl << endl
        << "where <reco_type> may be: " << planar_string 
        << ", " << fresnel_string
        << ", " << fresnel_wf_string 
        << ", " << partial_string
        << ", " << partchar_string
        << " or " << poly_string << endl
-       << "<seed> should be an integer" << endl <<endl
+       << "<seed> should be an integer" << endl
+       << "<n_seeds> is the number of random starts to reconstruct "
+       << "together (" << planar_string << " only)" << endl << endl
        << "If <reco_type> and <seed> do not need to be specified."
        << "if they are not, <reco_type> will default to "<<planar_string 
-       << " and <seed> to 0." << endl;
+       << ", <seed> to 0 and <n_seeds> to 1." << endl;
 
 }
 
@@ -99,6 +131,9 @@ int main(int argc, char * argv[]){
   //and set the seed of the initial guess
   int seed = 0;
 
+  //and the number of seeds to reconstruct at once
+  int n_seeds = 1;
+
   string reco_type = "";
 
   if(argc==1){
@@ -121,7 +156,10 @@ int main(int argc, char * argv[]){
   else
     seed = atoi(argv[3]);
 
-  if(argc>4){
+  if(argc>4)
+    n_seeds = atoi(argv[4]);
+
+  if(argc>5 || n_seeds<1){
     cout << endl << "Wrong number of arguments given. ";
     print_usage();
     exit(0);
@@ -172,6 +210,28 @@ int main(int argc, char * argv[]){
 
   string output_file_type = c.getString("output_file_type");
 
+  //the iterations for each algorithm can be cut short once the error
+  //stops improving or diverges, or the reconstruction stopped once
+  //the error is small enough. These are all off unless given.
+  IterationScheduler scheduler;
+  if(c.hasKey("convergence_window")){
+    double tolerance = 0.01;
+    if(c.hasKey("convergence_tolerance"))
+      tolerance = c.getDouble("convergence_tolerance");
+    scheduler.set_plateau(c.getInt("convergence_window"), tolerance);
+  }
+  if(c.hasKey("divergence_factor"))
+    scheduler.set_divergence_factor(c.getDouble("divergence_factor"));
+  if(c.hasKey("target_error"))
+    scheduler.set_target_error(c.getDouble("target_error"));
+  if(c.hasKey("plateau_shrinkwraps"))
+    scheduler.set_plateau_shrinkwraps(c.getInt("plateau_shrinkwraps"));
+
+  //fftw plans are loaded from and saved to this file if it is given.
+  string fftw_wisdom_file = c.getString("fftw_wisdom_file");
+  if(fftw_wisdom_file.compare("")!=0)
+    FFTWPlanCache::set_wisdom_file(fftw_wisdom_file);
+
   /*******  set up the reconstruction ***************/
 
   //create the projection object which will be used to
@@ -190,6 +250,8 @@ int main(int argc, char * argv[]){
   }
 
   BaseCDI * proj = 0;
+  BatchCDI * batch = 0;
+  int n_best = 0;
   
   //the data file name
   string data_file_name = c.getString("data_file_name");
@@ -204,8 +266,29 @@ int main(int argc, char * argv[]){
   temp_str << output_file_name_prefix << ".cplx" << flush;
   string output_file_name = temp_str.str();
 
+  if(n_seeds>1 && reco_type.compare(planar_string)!=0){
+    cout << "Several seeds can only be used for " << planar_string
+	 << " reconstruction. Exiting" << endl;
+    exit(0);
+  }
+
+  if(n_seeds>1 && starting_point_file_name.compare("")!=0){
+    cout << "A starting point was given, so only one "
+	 << "seed will be used" << endl;
+    n_seeds = 1;
+  }
+
   if(reco_type.compare(planar_string)==0){ //if Planar CDI
-    proj = new PlanarCDI(object_estimate);
+    if(n_seeds>1){
+      //how many of the best estimates from all the seeds to keep
+      n_best = c.getInt("n_best");
+      if(n_best < 0)
+	n_best = 0;
+      batch = new BatchCDI(object_estimate, n_seeds, n_best);
+      proj = batch;
+    }
+    else
+      proj = new PlanarCDI(object_estimate);
   }
   else{
 
@@ -374,7 +457,8 @@ int main(int argc, char * argv[]){
   //loop over the algorithms
   int i=0;
   int cumulative_iterations = 0;
-  while(algorithms_itr != algorithms->end()&&
+  bool stop = false;
+  while(!stop && algorithms_itr != algorithms->end()&&
       iterations_itr != iterations->end()){
 
     if(output_level!=OUTPUT_MINIMAL)
@@ -391,9 +475,12 @@ int main(int argc, char * argv[]){
     }
 
     proj->set_algorithm(alg);
-    cumulative_iterations+=(*iterations_itr);
+    scheduler.start_algorithm();
+    //the last algorithm may have been stopped early
+    cumulative_iterations = i + (*iterations_itr);
 
-    for(; i < cumulative_iterations; i++){
+    bool next_algorithm = false;
+    for(; !next_algorithm && i < cumulative_iterations; i++){
       if(output_level!=OUTPUT_MINIMAL)
 	cout << "Iteration " << i << endl;
 
@@ -407,6 +494,9 @@ int main(int argc, char * argv[]){
       if(i%output_iterations==0){
 	//output the current estimate of the object
 	ostringstream temp_str ( ostringstream::out ) ;
+	//for several seeds, show the one doing best so far
+	if(batch)
+	  batch->copy_best_estimate();
 	object_estimate.get_2d(MAG,result);
 	temp_str << output_file_name_prefix << "_" << i << "."
 	  << output_file_type << flush;
@@ -432,13 +522,66 @@ int main(int argc, char * argv[]){
 	proj->apply_shrinkwrap(shrinkwrap_gauss_width, 
 	    shrinkwrap_threshold);
 	cout << "Applying shrink-wrap at iteration "<< i<<endl;
+	//the error jumps when the support changes
+	scheduler.reset();
+	continue;
+      }
+
+      switch(scheduler.update(proj->get_error())){
+      case IterationScheduler::APPLY_SHRINKWRAP:
+	proj->apply_shrinkwrap(shrinkwrap_gauss_width, 
+	    shrinkwrap_threshold);
+	cout << "The error has stopped improving. Applying "
+	     << "shrink-wrap at iteration "<< i<<endl;
+	break;
+      case IterationScheduler::NEXT_ALGORITHM:
+	cout << "The error has stopped improving or diverged. "
+	     << "Ending the " << (*algorithms_itr) 
+	     << " algorithm at iteration "<< i << endl;
+	next_algorithm = true;
+	break;
+      case IterationScheduler::STOP:
+	cout << "The target error has been reached at iteration "
+	     << i << endl;
+	next_algorithm = true;
+	stop = true;
+	break;
       }
     }
     iterations_itr++;
     algorithms_itr++;
   }
 
+  //show where the time went (needs --enable-profiling)
+  if(output_level>=OUTPUT_ERROR && Profiler::is_enabled()){
+    cout << "Time spent in each stage of the iterations:" << endl;
+    proj->get_profile().print(cout);
+  }
+
   //write out the final result
+  if(batch){
+    for(int s=0; s < n_seeds; s++){
+      ostringstream seed_str ( ostringstream::out ) ;
+      seed_str << output_file_name_prefix << "_seed_" << (seed+s)
+	       << ".cplx" << flush;
+      write_cplx(seed_str.str(), batch->get_estimate(s));
+      cout << "Error for seed " << (seed+s) << " is "
+	   << batch->get_seed_error(s) << endl;
+    }
+    for(int n=0; n < n_best; n++){
+      double error;
+      Complex_2D * best = batch->get_best_result(error, n);
+      ostringstream best_str ( ostringstream::out ) ;
+      best_str << output_file_name_prefix << "_best_" << n
+	       << ".cplx" << flush;
+      write_cplx(best_str.str(), *best);
+      cout << "Error for best estimate " << n << " is "
+	   << error << endl;
+    }
+    batch->copy_best_estimate();
+    cout << "The best seed was " << (seed+batch->get_best_seed())
+	 << endl;
+  }
   write_cplx(output_file_name, object_estimate);
 
   //if it's fresnel reconstruction also output the
@@ -50,6 +50,12 @@ void print_usage(){
        << "The parameter file must list the experimental variables "
        << "including focal, sample and detector distances, normalisations "
        << "etc." << endl
+       << "The parameter file of the first frame may also set "
+       << "STREAM_FRAMES = 1 to keep the frames in a scratch file rather "
+       << "than in memory, for scans with too many frames to fit in memory, "
+       << "and SCRATCH_DIRECTORY to choose where that file goes (by default "
+       << "$TMPDIR or /tmp, which is often held in memory itself, so a "
+       << "directory on a disk should be given)." << endl
        << "Examples can be found in /data/cputkunz/phase_diverse_cdi/example_data.tar.gz " <<endl << endl;
   
   cout << "Other command-line parameters:" << endl << endl
@@ -81,6 +87,110 @@ void print_usage(){
 
 }
 
+/**********************************/
+//turn on frame streaming if the parameter file asks for it. 
+void set_up_streaming(PhaseDiverseCDI & pd, string param_file_name){
+
+  Config config_file(param_file_name);
+
+  if(config_file.hasKey("STREAM_FRAMES")
+     && config_file.getInt("STREAM_FRAMES")){
+
+    string directory = "";
+    if(config_file.hasKey("SCRATCH_DIRECTORY"))
+      directory = config_file.getString("SCRATCH_DIRECTORY");
+
+    cout << "Keeping the frames in a scratch file";
+    if(directory!="")
+      cout << " in " << directory;
+    cout << endl;
+
+    pd.set_frame_streaming(true, directory=="" ? 0 : directory.c_str());
+  }
+}
+
+/**********************************/
+//read the data for one frame, set up its FresnelCDI and add it to
+//the PhaseDiverseCDI. The data is only read now, and the temporary
+//arrays are freed before the next frame is read, so with frame
+//streaming only one frame is held in memory at a time.
+void add_frame(PhaseDiverseCDI & pd,
+	       vector<FresnelCDI *> & proj,
+	       vector<Complex_2D *> & object_estimate,
+	       TransmissionConstraint & tc, int seed,
+	       string image_file_name, string white_field_file_name,
+	       string param_file_name, int x_pos, int y_pos){
+
+  //read the parameter file 
+  Config config_file(param_file_name);
+  
+  double wavelength = config_file.getDouble("LAMBDA");
+  double z2 = config_file.getDouble("Z2");
+  double z3 = config_file.getDouble("Z3");
+  double zI = config_file.getDouble("ZI");
+
+  double fs = zI - z2; //focal to sample distance
+  double fd = z3 - z2; //focal to detector distance
+  double norm = config_file.getDouble("NORMALISATION");
+  int nx = config_file.getInt("N");
+  int ny = nx;
+  double ps = config_file.getDouble("IMAGE_WIDTH")/((double)nx);
+
+  cout << "fs=" <<fs<< " fd="<<fd<<" ps="
+       <<ps<<" norm="<<norm<<" nx="<<nx<<endl;
+  
+  if(config_file.getStatus()==FAILURE){
+    cerr << "Could not read the parameter file "
+	 << param_file_name << " correctly.."
+	 << "exiting" << endl;
+    exit(0);
+  }
+
+  Double_2D diffraction_image(nx,ny);
+  Complex_2D white_field(nx,ny);
+  read_image(image_file_name, diffraction_image, nx, ny);
+  read_cplx(white_field_file_name, white_field);
+
+  //Set up the fresnel CDI in the same way you would
+  //if you weren't doing phase-diversity
+  object_estimate.push_back(new Complex_2D(nx,ny));
+  
+  //set-up the reconstruction for a single frame
+  proj.push_back(new FresnelCDI(*object_estimate.back(),
+				white_field,
+				wavelength,
+				fd,
+				fs,
+				ps,
+				norm));
+
+  //make the support from a thresholded white-field
+  Double_2D beam(nx,ny);
+  proj.back()->get_illumination_at_sample().get_2d(MAG,beam);
+  double max = beam.get_max();
+  double threshold = 0.5;
+  
+  for(int i=0; i<nx; i++){
+    for(int j=0; j<ny; j++){
+      if( beam.get(i,j) > max*threshold )
+	beam.set(i,j,100);
+      else
+	beam.set(i,j,0);
+    }
+  }
+  
+  //set the support and intensity and initialise
+  proj.back()->set_intensity(diffraction_image);
+  proj.back()->set_support(beam,true); //use fussy edges  
+  proj.back()->initialise_estimate(seed);
+  
+  //add the most basic additional constraint
+  proj.back()->set_complex_constraint(tc);
+
+  //New part.. Add the FresnelCDI to the PhaseDiverseCDI.
+  pd.add_new_position(proj.back(), x_pos, y_pos);
+}
+
 int main(int argc, char * argv[]){
 
   //parameters (from corey's code):
@@ -176,79 +286,13 @@ int main(int argc, char * argv[]){
       cout << image_file_name << " "<< white_field_file_name
 	   << " "<< param_file_name << " " << x_pos << " " << y_pos <<endl;
       
-      //read the parameter file 
-      Config config_file(param_file_name);
-      
-      double wavelength = config_file.getDouble("LAMBDA");
-      double z2 = config_file.getDouble("Z2");
-      double z3 = config_file.getDouble("Z3");
-      double zI = config_file.getDouble("ZI");
-
-      double fs = zI - z2; //focal to sample distance
-      double fd = z3 - z2; //focal to detector distance
-      double norm = config_file.getDouble("NORMALISATION");
-      int nx = config_file.getInt("N");
-      int ny = nx;
-      double ps = config_file.getDouble("IMAGE_WIDTH")/((double)nx);
-
-      cout << "fs=" <<fs<< " fd="<<fd<<" ps="
-	   <<ps<<" norm="<<norm<<" nx="<<nx<<endl;
-      
-      if(config_file.getStatus()==FAILURE){
-	cerr << "Could not read the parameter file "
-	     << param_file_name << " correctly.."
-	     << "exiting" << endl;
-	exit(0);
-      }
-    
-      Double_2D diffraction_image(nx,ny);
-      Complex_2D white_field(nx,ny);
-      read_image(image_file_name, diffraction_image, nx, ny);
-      read_cplx(white_field_file_name, white_field);
-    
-      //Set up the fresnel CDI in the same way you would
-      //if you weren't doing phase-diversity
-      object_estimate.push_back(new Complex_2D(nx,ny));
-      
-      //set-up the reconstruction for a single frame
-      proj.push_back(new FresnelCDI(*object_estimate.back(),
-				    white_field,
-				    wavelength,
-				    fd,
-				    fs,
-				    ps,
-				    norm));
-
-      //make the support from a thresholded white-field
-      Double_2D beam(nx,ny);
-      proj.back()->get_illumination_at_sample().get_2d(MAG,beam);
-      double max = beam.get_max();
-      double threshold = 0.5;
-      
-      for(int i=0; i<nx; i++){
-	for(int j=0; j<ny; j++){
-	  if( beam.get(i,j) > max*threshold )
-	    beam.set(i,j,100);
-	  else
-	    beam.set(i,j,0);
-	}
-      }
-      
-      
-
+      //the scratch file options must be set before any frame is added
+      if(proj.empty())
+	set_up_streaming(pd, param_file_name);
 
-
-      
-      //set the support and intensity and initialise
-      proj.back()->set_intensity(diffraction_image);
-      proj.back()->set_support(beam,true); //use fussy edges  
-      proj.back()->initialise_estimate(seed);
-      
-      //add the most basic additional constraint
-      proj.back()->set_complex_constraint(tc);
-      
-      //New part.. Add the FresnelCDI to the PhaseDiverseCDI.
-      pd.add_new_position(proj.back(), x_pos, y_pos);
+      add_frame(pd, proj, object_estimate, tc, seed,
+		image_file_name, white_field_file_name,
+		param_file_name, x_pos, y_pos);
     }    
   }
   filelist.close();
@@ -0,0 +1,124 @@
+// Copyright 2011 Nadia Davidson for The ARC Centre of Excellence in
+// Coherent X-ray Science. This program is distributed under the GNU
+// General Public License. We also ask that you cite this software in
+// publications where you made use of it for any part of the data
+// analysis.
+
+/**
+ * @file nadia-plan-warmup.c
+ *
+ * \a nadia-plan-warmup.exe - Create the fftw plans for a list of
+ * array sizes and save them to a wisdom file. The planning can be
+ * done with a more thorough planner flag than is used in the
+ * reconstructions. Reconstructions which are given the same wisdom
+ * file (using the "fftw_wisdom_file" key in the CDI_reconstruction
+ * config file, or the NADIA_FFTW_WISDOM environment variable) then
+ * start straight away and get the best plans.
+ *
+ * \par Usage: nadia-plan-warmup.exe \<wisdom file\> \<planner\> \<size\> [\<size\> ...]
+ * \par
+ * where planner is one of:
+ * - measure
+ * - patient
+ * - exhaustive
+ *
+ * and each size is given as \<nx\>x\<ny\>, or as a single number
+ * for square arrays.
+ *
+ * \par Example:
+ * \verbatim nadia-plan-warmup.exe nadia.wisdom patient 1024 2048x2048 \endverbatim
+ * Make the plans for 1024x1024 and 2048x2048 arrays using
+ * FFTW_PATIENT and add them to the file nadia.wisdom.
+ *
+ * Plans are made for the number of threads given by the
+ * NADIA_NUM_THREADS environment variable (or the number of
+ * processors), so this should be the same as for the reconstructions.
+ *
+ **/
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <stdlib.h>
+#include <string>
+#include <FFTWPlanCache.h>
+#include <Parallel.h>
+
+using namespace std;
+
+void print_usage(){
+  cout << "Usage: nadia-plan-warmup.exe <wisdom file> <planner> "
+       << "<size> [<size> ...]" << endl
+       << "  where planner is one of: measure, patient or exhaustive"
+       << endl
+       << "  and each size is given as <nx>x<ny> (or <n> for a "
+       << "square array)" << endl;
+}
+
+/**************************************/
+int main(int argc, char * argv[]){
+
+  if(argc<4){
+    cout << "Wrong number of arguments." << endl;
+    print_usage();
+    return 1;
+  }
+
+  string wisdom_file = argv[1];
+  string planner = argv[2];
+
+  int flags;
+  if(planner=="measure")
+    flags = FFTW_MEASURE;
+  else if(planner=="patient")
+    flags = FFTW_PATIENT;
+  else if(planner=="exhaustive")
+    flags = FFTW_EXHAUSTIVE;
+  else{
+    cout << "Unknown planner: " << planner << endl;
+    print_usage();
+    return 1;
+  }
+
+  //load whatever wisdom we already have.
+  if(FFTWPlanCache::set_wisdom_file(wisdom_file)==FAILURE)
+    return 1;
+
+  for(int i=3; i < argc; i++){
+
+    int nx = 0;
+    int ny = 0;
+    int n_read = sscanf(argv[i],"%dx%d",&nx,&ny);
+    if(n_read==1)
+      ny = nx;
+    if(n_read < 1 || nx <= 0 || ny <= 0){
+      cout << "Could not understand the size " << argv[i] << endl;
+      print_usage();
+      return 1;
+    }
+
+    cout << "Planning " << nx << "x" << ny << "..." << flush;
+
+    //plan on an array allocated in the same way as in Complex_2D
+    //so that the alignment matches.
+    FFTW_COMPLEX * array =
+      (FFTW_COMPLEX*) FFTW_MALLOC(sizeof(FFTW_COMPLEX)*nx*ny);
+    FFTWPlanCache::get_plan(nx, ny, FFTW_FORWARD, flags, array,
+			    nadia::get_num_threads());
+    FFTWPlanCache::get_plan(nx, ny, FFTW_BACKWARD, flags, array,
+			    nadia::get_num_threads());
+    FFTW_FREE(array);
+
+    cout << " done" << endl;
+  }
+
+  //save now, rather than at exit, so a failure can be reported.
+  if(FFTWPlanCache::save_wisdom()==FAILURE){
+    cout << "Could not write the wisdom file " << wisdom_file << endl;
+    return 1;
+  }
+
+  cout << "Wisdom saved to " << wisdom_file << endl;
+
+  return 0;
+}